@@ -1,5 +1,6 @@
 #include "disk.h"
 
+#include <drivers/pci/pci.h>
 #include <kernel/error.h>
 #include <kernel/irq.h>
 #include <kernel/low_level.h>
@@ -65,6 +66,7 @@ static void assign_ata_ports(enum disk_channel channel, struct ata_port_config *
         config->status_port = HD_PORT_STATUS_PRIMARY;
         config->error_port = HD_PORT_ERROR_PRIMARY;
         config->data_port = HD_PORT_DATA_PRIMARY;
+        config->control_port = HD_PORT_DEV_CTRL_PRIMARY;
         break;
     case SECONDARY:
         config->sector_count_port = HD_PORT_SECT_COUNT_SECONDARY;
@@ -76,78 +78,540 @@ static void assign_ata_ports(enum disk_channel channel, struct ata_port_config *
         config->status_port = HD_PORT_STATUS_SECONDARY;
         config->error_port = HD_PORT_ERROR_SECONDARY;
         config->data_port = HD_PORT_DATA_SECONDARY;
+        config->control_port = HD_PORT_DEV_CTRL_SECONDARY;
         break;
     default:
         print_string("Bad drive selection. Neither primary or secondary chosen.\n");
     }
 }
 
-static enum sys_error __read_sectors_from_disk(struct ata_port_config *config, int n_sectors, uint8_t *buffer) {
-    // Do we need this? According to https://wiki.osdev.org/ATA_PIO_Mode#Hardware, we do.
-    // "When a driver issues a PIO read or write command, it needs to wait
-    //  until the drive is ready before transferring data."
-    __poll_status_register(config);
+/**
+ * The queue of pending disk requests. The request at the head is the one
+ * currently on the device. Only modified with interrupts disabled.
+ */
+static struct disk_request *disk_queue_head = NULL;
+static struct disk_request *disk_queue_tail = NULL;
+
+// Set once the IRQ14 handler is installed and the device may interrupt us.
+static bool disk_irq_ready = false;
+
+// Base I/O port of the bus master IDE registers, 0 if DMA is unavailable.
+static uint16_t bm_ide_base = 0;
+static enum disk_transfer_mode transfer_mode = DISK_MODE_PIO;
 
-    insw(config->data_port, buffer, ((n_sectors * SECTOR_SIZE) >> WORD_TO_BYTE_SHIFT));
+// Aligned so that the table never crosses a 64KiB boundary.
+static struct prd_entry prdt[PRDT_MAX_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
 
-    return NONE;
+static void __start_disk_command(struct disk_request *req);
+
+/**
+ * @brief Wait until the device is no longer busy and is ready to move data.
+ *
+ * @param config
+ * @return the last status read.
+ */
+static uint8_t __poll_drq(struct ata_port_config *config) {
+    uint8_t status;
+
+    do {
+        status = port_byte_in(config->status_port);
+    } while ((status & HD_STATUS_BSY) ||
+             !(status & (HD_STATUS_DRQ | HD_STATUS_ERR | HD_STATUS_DF)));
+
+    return status;
 }
 
-static enum sys_error __read_from_disk(enum disk_channel channel, enum drive_class class, lba_t block_address, int n_sectors, uint8_t *buffer) {
-    int to_read = n_sectors, sectors_read = 0;
+/**
+ * @brief Wait until the device clears BSY.
+ *
+ * The alternate status register is read a few times first to give the device
+ * the 400ns it needs to raise BSY after the last command or data block.
+ *
+ * @param config
+ */
+static void __poll_not_busy(struct ata_port_config *config) {
+    for (int i = 0; i < 4; i++)
+        port_byte_in(config->control_port);
+
+    while (port_byte_in(config->control_port) & HD_STATUS_BSY)
+        ;
+}
+
+/**
+ * @brief The number of sectors the device moves per DRQ data block (and so
+ * per interrupt) for a command.
+ *
+ * @param command
+ */
+static int __drq_block_sectors(uint8_t command) {
+    if ((command == HD_READ_MULTIPLE || command == HD_WRITE_MULTIPLE) && device_data.CURRENT_DRQ_DATA_BLOCK)
+        return device_data.CURRENT_DRQ_DATA_BLOCK;
+
+    return 1;
+}
+
+static uint8_t __request_command(struct disk_request *req) {
+    if (req->dma)
+        return req->write ? HD_WRITE_DMA : HD_READ_DMA;
+
+    if (req->write)
+        return req->command_sectors > 1 ? HD_WRITE_MULTIPLE : HD_WRITE;
+
+    return req->command_sectors > 1 ? HD_READ_MULTIPLE : HD_READ;
+}
+
+/**
+ * @brief Find the buffer holding sector n (counted from the start) of a
+ * request.
+ *
+ * @param req
+ * @param n
+ * @param offset output, the index of the sector within the returned entry.
+ */
+static struct disk_sg_entry *__request_locate(struct disk_request *req, int n, int *offset) {
+    struct disk_sg_entry *sg = req->sg;
+
+    while (n >= sg->n_sectors) {
+        n -= sg->n_sectors;
+        sg++;
+    }
+
+    *offset = n;
+    return sg;
+}
+
+static uint8_t *__request_sector_data(struct disk_request *req, int n) {
+    int offset;
+    struct disk_sg_entry *sg = __request_locate(req, n, &offset);
+
+    return sg->buffer + offset * SECTOR_SIZE;
+}
+
+/**
+ * @brief Write the next DRQ data block of a write request to the device.
+ *
+ * @param config
+ * @param req
+ */
+static void __send_drq_block(struct ata_port_config *config, struct disk_request *req) {
+    int block = __drq_block_sectors(__request_command(req));
+
+    if (block > req->command_sectors)
+        block = req->command_sectors;
+
+    // TODO: osdev warns against using rep outsw for multi-sector writes.
+    // The sectors of a block may come from different buffers, so they are
+    // sent one at a time.
+    for (int i = 0; i < block; i++)
+        outsw(config->data_port, __request_sector_data(req, req->sectors_done + i),
+              SECTOR_SIZE >> WORD_TO_BYTE_SHIFT);
+
+    req->sectors_done += block;
+    req->command_sectors -= block;
+}
+
+static uint16_t __bm_ide_port(struct disk_request *req, uint16_t reg) {
+    return bm_ide_base + (req->channel == SECONDARY ? BM_IDE_SECONDARY_OFFSET : 0) + reg;
+}
+
+/**
+ * @brief Check whether a request can be transferred by the bus master.
+ *
+ * The buffer address is used as the physical address (kernel memory is
+ * identity mapped), so it has to be below 4GiB, and the bus master needs it
+ * to be word aligned. Single sector transfers are left to PIO, where the
+ * DMA setup would cost more than it saves.
+ *
+ * @param req
+ */
+static bool __dma_usable(struct disk_request *req) {
+    if (transfer_mode != DISK_MODE_DMA || !bm_ide_base || req->n_sectors < 2)
+        return false;
+
+    for (int i = 0; i < req->sg_count; i++) {
+        uint64_t start = addr_to_u64(req->sg[i].buffer);
+        uint64_t end = start + (uint64_t) req->sg[i].n_sectors * SECTOR_SIZE;
+
+        if ((start & 0x1) || end > (1ULL << 32))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Fill in the PRD table for the next command of a DMA request,
+ * splitting the buffer at 64KiB boundaries.
+ *
+ * @param req
+ * @param count number of sectors in the command.
+ * @return 0 on success, -1 if the table is too small.
+ */
+static int __setup_prdt(struct disk_request *req, int count) {
+    int sector = req->sectors_done, entry = 0;
+
+    while (count) {
+        int offset, run;
+        struct disk_sg_entry *sg = __request_locate(req, sector, &offset);
+        uint64_t addr = addr_to_u64(sg->buffer + offset * SECTOR_SIZE);
+        uint64_t remaining;
+
+        run = sg->n_sectors - offset;
+        if (run > count)
+            run = count;
+        remaining = (uint64_t) run * SECTOR_SIZE;
+
+        while (remaining) {
+            uint64_t len = PRD_MAX_BYTES - (addr & (PRD_MAX_BYTES - 1));
+
+            if (entry == PRDT_MAX_ENTRIES)
+                return -1;
+
+            if (len > remaining)
+                len = remaining;
+
+            prdt[entry].addr = (uint32_t) addr;
+            prdt[entry].byte_count = (uint16_t) len;    // 64KiB is encoded as 0.
+            prdt[entry].flags = 0;
+
+            addr += len;
+            remaining -= len;
+            entry++;
+        }
+
+        sector += run;
+        count -= run;
+    }
+    prdt[entry - 1].flags = PRD_END_OF_TABLE;
+
+    return 0;
+}
+
+/**
+ * @brief Remove the request at the head of the queue, signal its completion
+ * and start the next queued request, if any.
+ *
+ * Must be called with interrupts disabled.
+ *
+ * @param req
+ * @param error
+ */
+static void __complete_disk_request(struct disk_request *req, int error) {
+    disk_queue_head = req->next;
+    if (!disk_queue_head)
+        disk_queue_tail = NULL;
+
+    req->next = NULL;
+    req->error = error;
+    req->state = DISK_REQUEST_DONE;
+
+    // The callback is allowed to resubmit or free the request.
+    if (req->on_complete)
+        req->on_complete(req);
+
+    if (disk_queue_head && disk_queue_head->state == DISK_REQUEST_QUEUED)
+        __start_disk_command(disk_queue_head);
+}
+
+/**
+ * @brief Issue the command for the next (at most HD_MAX_SECTORS_PER_COMMAND)
+ * sectors of a request.
+ *
+ * For reads the data is moved by the IRQ handler as each DRQ block becomes
+ * ready. For writes the device asks for the first block without raising an
+ * interrupt, so that one is sent from here.
+ *
+ * Must be called with interrupts disabled.
+ *
+ * @param req
+ */
+static void __start_disk_command(struct disk_request *req) {
+    lba_t block_address = req->block_address + req->sectors_done;
     struct ata_port_config config;
-    enum sys_error err = NONE;
-    uint8_t command;
+    int count = req->n_sectors - req->sectors_done;
 
-    if (n_sectors <= 0)
-        return -1;
+    if (count > HD_MAX_SECTORS_PER_COMMAND)
+        count = HD_MAX_SECTORS_PER_COMMAND;
 
-    disable_interrupts();
-    assign_ata_ports(channel, &config);
+    req->state = DISK_REQUEST_ACTIVE;
+    req->command_sectors = count;
+    assign_ata_ports(req->channel, &config);
 
     // According to https://wiki.osdev.org/ATA_PIO_Mode#Hardware, we need to
     // select the correct driver first before reading from the status register.
     // Then, because the device might need some time to respond to the drive
     // select, we need to read the status register at least 15 times before
     // beginning to trust its output.
-    port_byte_out(config.drive_select_port, (class == SLAVE ? 0xF0 : 0xE0) | ((block_address >> 24) & 0x0f));
+    port_byte_out(config.drive_select_port, (req->class == SLAVE ? 0xF0 : 0xE0) | ((block_address >> 24) & 0x0F));
     for (int i = 0; i < 14; i++)
         port_byte_in(config.status_port);
 
     __poll_status_register(&config);
 
     port_byte_out(config.error_port, 0x0);
-    port_byte_out(config.sector_count_port, n_sectors);
+    // A count of 256 is written as 0.
+    port_byte_out(config.sector_count_port, count);
     port_byte_out(config.lba_low_port, block_address);
     port_byte_out(config.lba_mid_port, block_address >> 8);
     port_byte_out(config.lba_high_port, block_address >> 16);
 
-    // Do we need this?
     __poll_status_register(&config);
-    port_byte_out(config.sector_count_port, n_sectors);
 
-    // Send read command to controller.
-    command = n_sectors > 1 ? HD_READ_MULTIPLE : HD_READ;
-    port_byte_out(config.command_port, command);
+    if (req->dma) {
+        uint8_t direction = req->write ? 0 : BM_IDE_COMMAND_READ;
 
-    while (to_read)
-    {
-        int drq_sectors = to_read > device_data.CURRENT_DRQ_DATA_BLOCK ? device_data.CURRENT_DRQ_DATA_BLOCK : to_read;
+        if (__setup_prdt(req, count)) {
+            print_string("Error: PRD table too small for DMA transfer.\n");
+            __complete_disk_request(req, -1);
+            return;
+        }
+
+        port_byte_out(__bm_ide_port(req, BM_IDE_COMMAND), 0);
+        port_long_out(__bm_ide_port(req, BM_IDE_PRDT), addr_to_u32(prdt));
+        // The error and interrupt bits are cleared by writing 1s to them.
+        port_byte_out(__bm_ide_port(req, BM_IDE_STATUS), BM_IDE_STATUS_ERROR | BM_IDE_STATUS_IRQ);
+        port_byte_out(__bm_ide_port(req, BM_IDE_COMMAND), direction);
 
-        err = __read_sectors_from_disk(&config, drq_sectors, buffer + sectors_read * SECTOR_SIZE);
-        if (err)
-        {
+        port_byte_out(config.command_port, __request_command(req));
+        port_byte_out(__bm_ide_port(req, BM_IDE_COMMAND), direction | BM_IDE_COMMAND_START);
+        return;
+    }
+
+    port_byte_out(config.command_port, __request_command(req));
+
+    if (req->write) {
+        uint8_t status = __poll_drq(&config);
+
+        if (status & (HD_STATUS_ERR | HD_STATUS_DF)) {
             __display_registers(&config);
-            return err;
+            __complete_disk_request(req, -1);
+            return;
         }
 
-        to_read -= drq_sectors;
-        sectors_read += drq_sectors;
+        __send_drq_block(&config, req);
     }
+}
 
+/**
+ * @brief Advance the active request after the device has signalled that it
+ * needs attention (from IRQ14, or from polling when interrupts are off).
+ *
+ * Must be called with interrupts disabled.
+ */
+static void __service_disk_request(void) {
+    struct disk_request *req = disk_queue_head;
+    struct ata_port_config config;
+    uint8_t status;
+
+    if (!req || req->state != DISK_REQUEST_ACTIVE) {
+        // Reading the status register acknowledges the interrupt.
+        port_byte_in(HD_PORT_STATUS);
+        return;
+    }
+
+    assign_ata_ports(req->channel, &config);
+
+    if (req->dma) {
+        uint8_t bm_status = port_byte_in(__bm_ide_port(req, BM_IDE_STATUS));
+
+        if (!(bm_status & (BM_IDE_STATUS_IRQ | BM_IDE_STATUS_ERROR))) {
+            port_byte_in(config.status_port);
+            return;
+        }
+
+        port_byte_out(__bm_ide_port(req, BM_IDE_COMMAND), 0);
+        status = port_byte_in(config.status_port);
+        port_byte_out(__bm_ide_port(req, BM_IDE_STATUS), BM_IDE_STATUS_ERROR | BM_IDE_STATUS_IRQ);
+
+        if ((bm_status & BM_IDE_STATUS_ERROR) || (status & (HD_STATUS_ERR | HD_STATUS_DF))) {
+            print_string("Error: DMA transfer failed.\n");
+            __complete_disk_request(req, -1);
+            return;
+        }
+
+        req->sectors_done += req->command_sectors;
+        req->command_sectors = 0;
+
+        if (req->sectors_done < req->n_sectors)
+            __start_disk_command(req);
+        else
+            __complete_disk_request(req, 0);
+        return;
+    }
+
+    status = port_byte_in(config.status_port);
+
+    // Not for us (or a stale interrupt); the device will interrupt again.
+    if (status & HD_STATUS_BSY)
+        return;
+
+    if (status & (HD_STATUS_ERR | HD_STATUS_DF)) {
+        __display_registers(&config);
+        __complete_disk_request(req, -1);
+        return;
+    }
+
+    if (req->write) {
+        // The block sent last has been written.
+        if (req->command_sectors) {
+            if (!(status & HD_STATUS_DRQ))
+                return;
+
+            __send_drq_block(&config, req);
+            return;
+        }
+    } else {
+        int block = __drq_block_sectors(__request_command(req));
+
+        if (!(status & HD_STATUS_DRQ))
+            return;
+
+        if (block > req->command_sectors)
+            block = req->command_sectors;
+
+        for (int i = 0; i < block; i++)
+            insw(config.data_port, __request_sector_data(req, req->sectors_done + i),
+                 SECTOR_SIZE >> WORD_TO_BYTE_SHIFT);
+
+        req->sectors_done += block;
+        req->command_sectors -= block;
+
+        if (req->command_sectors)
+            return;
+    }
+
+    if (req->sectors_done < req->n_sectors)
+        __start_disk_command(req);
+    else
+        __complete_disk_request(req, 0);
+}
+
+/**
+ * @brief Queue a disk request. It is started immediately if the device is idle.
+ *
+ * @param req a request with channel, class, block_address, n_sectors, write
+ * and buffer (and optionally on_complete) filled in. The request must stay
+ * valid until it completes.
+ * @return 0 if the request was queued, -1 otherwise.
+ */
+int submit_disk_request(struct disk_request *req) {
+    bool restore_interrupts = interrupts_enabled();
+
+    if (req->n_sectors <= 0)
+        return -1;
+
+    if (!req->sg) {
+        req->single_sg.buffer = req->buffer;
+        req->single_sg.n_sectors = req->n_sectors;
+        req->sg = &req->single_sg;
+        req->sg_count = 1;
+    }
+
+    req->state = DISK_REQUEST_QUEUED;
+    req->error = 0;
+    req->sectors_done = 0;
+    req->command_sectors = 0;
+    req->next = NULL;
+    req->dma = __dma_usable(req);
+
+    disable_interrupts();
+
+    if (disk_queue_tail)
+        disk_queue_tail->next = req;
+    else
+        disk_queue_head = req;
+    disk_queue_tail = req;
+
+    if (disk_queue_head == req)
+        __start_disk_command(req);
+
+    if (restore_interrupts)
+        enable_interrupts();
+
+    return 0;
+}
+
+/**
+ * @brief Wait for a submitted request to complete.
+ *
+ * The CPU halts between disk interrupts (so timer ticks and keystrokes are
+ * still handled). If interrupts are off, or the disk IRQ is not installed yet,
+ * the device is polled instead.
+ *
+ * @param req
+ * @return the request's error status, 0 on success.
+ */
+int wait_disk_request(struct disk_request *req) {
+    if (!disk_irq_ready || !interrupts_enabled()) {
+        struct ata_port_config config;
+
+        assign_ata_ports(req->channel, &config);
+        while (req->state != DISK_REQUEST_DONE) {
+            __poll_not_busy(&config);
+            __service_disk_request();
+        }
+
+        return req->error;
+    }
+
+    while (true) {
+        disable_interrupts();
+        if (req->state == DISK_REQUEST_DONE)
+            break;
+
+        // Re-enables interrupts and halts atomically, so the completing
+        // interrupt cannot slip in between the check and the halt.
+        wait_for_interrupt();
+    }
     enable_interrupts();
 
-    return err;
+    return req->error;
+}
+
+/**
+ * @brief Choose between PIO and bus master DMA for requests submitted from now
+ * on. Requests DMA can't handle still use PIO.
+ *
+ * @param mode
+ * @return 0 on success, -1 if DMA was asked for but isn't available.
+ */
+int disk_set_transfer_mode(enum disk_transfer_mode mode) {
+    if (mode == DISK_MODE_DMA && !bm_ide_base)
+        return -1;
+
+    transfer_mode = mode;
+
+    return 0;
+}
+
+enum disk_transfer_mode disk_get_transfer_mode(void) {
+    return transfer_mode;
+}
+
+static enum sys_error __transfer_disk(enum disk_channel channel, enum drive_class class, lba_t block_address,
+                                      int n_sectors, void *buffer, bool write) {
+    struct disk_request req = {
+        .channel = channel,
+        .class = class,
+        .block_address = block_address,
+        .n_sectors = n_sectors,
+        .write = write,
+        .buffer = buffer,
+        .sg = NULL,
+        .on_complete = NULL,
+    };
+
+    if (submit_disk_request(&req))
+        return -1;
+
+    return wait_disk_request(&req);
+}
+
+static enum sys_error __read_from_disk(enum disk_channel channel, enum drive_class class, lba_t block_address, int n_sectors, uint8_t *buffer) {
+    if (n_sectors <= 0)
+        return -1;
+
+    return __transfer_disk(channel, class, block_address, n_sectors, buffer, false);
 }
 
 /**
@@ -176,40 +640,13 @@ static enum sys_error __read_from_disk(enum disk_channel channel, enum drive_cla
  * @return enum sys_error
  */
 static enum sys_error __write_to_disk(enum disk_channel channel, enum drive_class class, lba_t block_address, int n_sectors, void *buffer) {
-    struct ata_port_config config;
-    int command;
-
     if (n_sectors < 0)
         return -1;
 
-    disable_interrupts();
-    assign_ata_ports(channel, &config);
+    if (!n_sectors)
+        return NONE;
 
-    port_byte_out(config.drive_select_port, (class == SLAVE ? 0xF0 : 0xE0) | ((block_address >> 24) & 0x0F));
-    for (int i = 0; i < 14; i++)
-        port_byte_in(config.status_port);
-
-    __poll_status_register(&config);
-
-    port_byte_out(config.error_port, 0x0);
-    port_byte_out(config.sector_count_port, n_sectors);
-    port_byte_out(config.lba_low_port, block_address);
-    port_byte_out(config.lba_mid_port, block_address >> 8);
-    port_byte_out(config.lba_high_port, block_address >> 16);
-
-    __poll_status_register(&config);
-
-    // Send write command to controller.
-    command = n_sectors > 1 ? HD_WRITE_MULTIPLE : HD_WRITE;
-    port_byte_out(config.command_port, command);
-
-    __poll_status_register(&config);
-
-    // TODO: osdev warns against using rep outsw for multi-sector writes.
-    outsw(config.data_port, buffer, (n_sectors * SECTOR_SIZE) >> WORD_TO_BYTE_SHIFT);
-
-    enable_interrupts();
-    return NONE;
+    return __transfer_disk(channel, class, block_address, n_sectors, buffer, true);
 }
 
 /**
@@ -246,6 +683,54 @@ int write_to_storage_disk(lba_t block_address, int n_bytes, void *buffer) {
     return error;
 }
 
+/**
+ * write_sectors_to_storage_disk - Write whole sectors to the storage disk.
+ *
+ * Unlike write_to_storage_disk, there is no partial trailing sector to
+ * preserve, so this never reads from the disk: callers pad the last sector
+ * themselves.
+ *
+ * @block_address:
+ * @n_sectors:
+ * @buffer: n_sectors * SECTOR_SIZE bytes.
+ */
+int write_sectors_to_storage_disk(lba_t block_address, int n_sectors, void *buffer) {
+    return __write_to_disk(PRIMARY, SLAVE, block_address, n_sectors, buffer);
+}
+
+/**
+ * write_sg_to_storage_disk - Write sectors gathered from several buffers to
+ * consecutive sectors of the storage disk, as a single request.
+ *
+ * @block_address:
+ * @sg: list of buffers, each holding whole (caller-padded) sectors.
+ * @sg_count: number of entries in sg.
+ */
+int write_sg_to_storage_disk(lba_t block_address, struct disk_sg_entry *sg, int sg_count) {
+    struct disk_request req = {
+        .channel = PRIMARY,
+        .class = SLAVE,
+        .block_address = block_address,
+        .n_sectors = 0,
+        .write = true,
+        .buffer = NULL,
+        .sg = sg,
+        .sg_count = sg_count,
+        .on_complete = NULL,
+    };
+
+    for (int i = 0; i < sg_count; i++)
+        req.n_sectors += sg[i].n_sectors;
+
+    if (!req.n_sectors)
+        return NONE;
+
+    if (submit_disk_request(&req))
+        return -1;
+
+    return wait_disk_request(&req);
+}
+
 /**
  * read_from_storage_disk - Read from ATA/IDE hard disk into buffer.
  *
@@ -309,12 +794,48 @@ void identify_device(void) {
     enable_interrupts();
 }
 
-static inline void disk_irq_handler(struct registers *r) {
+static void disk_irq_handler(struct registers *r) {
     interrupt_count++;
+
+    __service_disk_request();
 }
 
 static void install_disk_irq_handler(void) {
     install_irq(14, disk_irq_handler);
+
+    // Clear nIEN so that the device raises IRQ14.
+    port_byte_out(HD_PORT_DEV_CTRL_PRIMARY, 0x00);
+    disk_irq_ready = true;
+}
+
+/**
+ * @brief Look for a PCI IDE controller capable of bus mastering and, if one
+ * is found, enable it and switch to DMA transfers.
+ */
+static void init_disk_dma(void) {
+    struct pci_device dev;
+    uint32_t bar4;
+    uint16_t command;
+
+    if (pci_find_device_by_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_IDE, &dev)) {
+        print_string("No PCI IDE controller found, using PIO.\n");
+        return;
+    }
+
+    bar4 = pci_config_read32(dev.bus, dev.slot, dev.func, PCI_BAR4);
+    if (!(dev.prog_if & IDE_PROG_IF_BUS_MASTER) || !(bar4 & PCI_BAR_IO_SPACE) || !(bar4 & PCI_BAR_IO_MASK)) {
+        print_string("IDE controller can't bus master, using PIO.\n");
+        return;
+    }
+
+    command = pci_config_read16(dev.bus, dev.slot, dev.func, PCI_COMMAND);
+    pci_config_write16(dev.bus, dev.slot, dev.func, PCI_COMMAND,
+                       command | PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+
+    bm_ide_base = bar4 & PCI_BAR_IO_MASK;
+    transfer_mode = DISK_MODE_DMA;
+
+    print_string("IDE bus master DMA at port "); print_int32(bm_ide_base); print_string("\n");
 }
 
 /**
@@ -323,7 +844,9 @@ static void install_disk_irq_handler(void) {
  * Perhaps a TODO: implement more useful disk setup.
  */
 void init_disk(void) {
-    install_disk_irq_handler();
-
     identify_device();
+
+    init_disk_dma();
+
+    install_disk_irq_handler();
 }
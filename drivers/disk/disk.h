@@ -27,6 +27,11 @@
 #define HD_PORT_STATUS_SECONDARY      0x177
 #define HD_PORT_COMMAND_SECONDARY     0x177 
 
+// Device control registers (the "alternate status" register when read).
+// Bit 1 (nIEN) disables INTRQ from the device when set.
+#define HD_PORT_DEV_CTRL_PRIMARY    0x3f6
+#define HD_PORT_DEV_CTRL_SECONDARY  0x376
+
 #define HD_PRIMARY
 
 #ifdef HD_PRIMARY
@@ -59,6 +64,42 @@
 
 #define HD_IDENTIFY_DEVICE		 0xEC
 
+// IDE/ATA DMA Commands.
+#define HD_READ_DMA              0xC8
+#define HD_WRITE_DMA             0xCA
+
+// Bus master IDE registers, relative to the channel's base I/O port
+// (BAR4 of the IDE controller for the primary channel, +8 for the secondary).
+#define BM_IDE_COMMAND              0x0
+#define BM_IDE_STATUS               0x2
+#define BM_IDE_PRDT                 0x4
+#define BM_IDE_SECONDARY_OFFSET     0x8
+
+#define BM_IDE_COMMAND_START        0x1
+#define BM_IDE_COMMAND_READ         0x8     // The bus master writes to memory.
+
+#define BM_IDE_STATUS_ACTIVE        0x1
+#define BM_IDE_STATUS_ERROR         0x2
+#define BM_IDE_STATUS_IRQ           0x4
+
+// PCI programming interface bit set by IDE controllers capable of bus mastering.
+#define IDE_PROG_IF_BUS_MASTER      0x80
+
+// A physical region descriptor may not cross a 64KiB boundary.
+#define PRD_MAX_BYTES               0x10000
+#define PRD_END_OF_TABLE            0x8000
+#define PRDT_MAX_ENTRIES            32
+
+// Status register bits.
+#define HD_STATUS_ERR            0x01
+#define HD_STATUS_DRQ            0x08
+#define HD_STATUS_DF             0x20
+#define HD_STATUS_BSY            0x80
+
+// The sector count register is 8 bits wide, with 0 meaning 256 sectors.
+// Larger requests are issued to the device as several commands.
+#define HD_MAX_SECTORS_PER_COMMAND 256
+
 typedef uint32_t lba_t;
 
 enum disk_channel {
@@ -81,6 +122,7 @@ struct ata_port_config {
     uint16_t status_port;
     uint16_t error_port;
     uint16_t data_port;
+    uint16_t control_port;
 }__attribute__((packed));
 
 struct identify_device_data {
@@ -93,10 +135,77 @@ struct identify_device_data {
     uint16_t reserved2[196];
 }__attribute__((packed));
 
+/**
+ * Physical region descriptor. The bus master walks a table of these to find
+ * the memory to transfer to or from. A byte_count of 0 means 64KiB.
+ */
+struct prd_entry {
+    uint32_t addr;
+    uint16_t byte_count;
+    uint16_t flags;
+}__attribute__((packed));
+
+enum disk_transfer_mode {
+    DISK_MODE_PIO,
+    DISK_MODE_DMA
+};
+
+/**
+ * One piece of a scatter/gather list: n_sectors whole sectors at buffer.
+ */
+struct disk_sg_entry {
+    uint8_t *buffer;
+    int n_sectors;
+};
+
+enum disk_request_state {
+    DISK_REQUEST_QUEUED,
+    DISK_REQUEST_ACTIVE,
+    DISK_REQUEST_DONE
+};
+
+/**
+ * A single read or write of n_sectors contiguous sectors.
+ *
+ * Requests are queued with submit_disk_request() and serviced in order by the
+ * disk IRQ handler, which moves each DRQ data block and then starts the next
+ * queued request. Completion is signalled by state becoming DISK_REQUEST_DONE
+ * and, if set, by a call to on_complete (from interrupt context).
+ */
+struct disk_request {
+    enum disk_channel channel;
+    enum drive_class class;
+    lba_t block_address;
+    int n_sectors;
+    bool write;
+    uint8_t *buffer;                        // Used if sg is NULL.
+    struct disk_sg_entry *sg;               // Optional list of buffers making up the n_sectors.
+    int sg_count;
+    void (*on_complete)(struct disk_request *);
+    void *private;                          // For use by the owner of the request.
+
+    // Driver-owned fields, initialized by submit_disk_request().
+    volatile enum disk_request_state state;
+    volatile int error;
+    bool dma;                               // Set if the request is transferred by the bus master.
+    struct disk_sg_entry single_sg;         // Stands in for sg when a plain buffer is used.
+    int sectors_done;                       // Sectors transferred so far.
+    int command_sectors;                    // Sectors left in the command currently on the device.
+    struct disk_request *next;
+};
+
 void init_disk(void);
 
+int submit_disk_request(struct disk_request *);
+int wait_disk_request(struct disk_request *);
+
+int disk_set_transfer_mode(enum disk_transfer_mode);
+enum disk_transfer_mode disk_get_transfer_mode(void);
+
 int read_from_storage_disk(lba_t, int, void*);
 int write_to_storage_disk(lba_t, int, void*);
+int write_sectors_to_storage_disk(lba_t, int, void *);
+int write_sg_to_storage_disk(lba_t, struct disk_sg_entry *, int);
 
 void identify_device(void);
 
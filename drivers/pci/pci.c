@@ -0,0 +1,98 @@
+#include "pci.h"
+
+#include <kernel/low_level.h>
+
+/**
+ * @brief Build the CONFIG_ADDRESS value selecting a dword of a function's
+ * configuration space.
+ *
+ * @param bus
+ * @param slot
+ * @param func
+ * @param offset byte offset into configuration space; the low 2 bits are ignored.
+ */
+static uint32_t __config_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return (1U << 31) | ((uint32_t) bus << 16) | ((uint32_t) (slot & 0x1F) << 11) |
+           ((uint32_t) (func & 0x7) << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    port_long_out(PCI_CONFIG_ADDRESS_PORT, __config_address(bus, slot, func, offset));
+
+    return port_long_in(PCI_CONFIG_DATA_PORT);
+}
+
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return pci_config_read32(bus, slot, func, offset) >> ((offset & 0x2) * 8);
+}
+
+uint8_t pci_config_read8(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return pci_config_read32(bus, slot, func, offset) >> ((offset & 0x3) * 8);
+}
+
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t val) {
+    port_long_out(PCI_CONFIG_ADDRESS_PORT, __config_address(bus, slot, func, offset));
+    port_long_out(PCI_CONFIG_DATA_PORT, val);
+}
+
+/**
+ * @brief Write a word of configuration space, preserving the other half of the
+ * containing dword.
+ */
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t val) {
+    const int shift = (offset & 0x2) * 8;
+    uint32_t dword = pci_config_read32(bus, slot, func, offset);
+
+    dword &= ~(0xFFFFU << shift);
+    dword |= (uint32_t) val << shift;
+
+    pci_config_write32(bus, slot, func, offset, dword);
+}
+
+static void __fill_device(uint8_t bus, uint8_t slot, uint8_t func, struct pci_device *dev) {
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->vendor_id = pci_config_read16(bus, slot, func, PCI_VENDOR_ID);
+    dev->device_id = pci_config_read16(bus, slot, func, PCI_DEVICE_ID);
+    dev->class_code = pci_config_read8(bus, slot, func, PCI_CLASS_CODE);
+    dev->subclass = pci_config_read8(bus, slot, func, PCI_SUBCLASS);
+    dev->prog_if = pci_config_read8(bus, slot, func, PCI_PROG_IF);
+}
+
+/**
+ * @brief Find the first PCI function with the given class and subclass by
+ * brute-force scanning all buses.
+ *
+ * @param class_code
+ * @param subclass
+ * @param dev output, filled in with the device found.
+ * @return 0 if a device was found, -1 otherwise.
+ */
+int pci_find_device_by_class(uint8_t class_code, uint8_t subclass, struct pci_device *dev) {
+    for (int bus = 0; bus < PCI_MAX_BUSES; bus++) {
+        for (int slot = 0; slot < PCI_MAX_SLOTS; slot++) {
+            int num_functions = 1;
+
+            if (pci_config_read16(bus, slot, 0, PCI_VENDOR_ID) == PCI_VENDOR_NONE)
+                continue;
+
+            if (pci_config_read8(bus, slot, 0, PCI_HEADER_TYPE) & PCI_HEADER_MULTIFUNCTION)
+                num_functions = PCI_MAX_FUNCTIONS;
+
+            for (int func = 0; func < num_functions; func++) {
+                if (pci_config_read16(bus, slot, func, PCI_VENDOR_ID) == PCI_VENDOR_NONE)
+                    continue;
+
+                if (pci_config_read8(bus, slot, func, PCI_CLASS_CODE) != class_code ||
+                    pci_config_read8(bus, slot, func, PCI_SUBCLASS) != subclass)
+                    continue;
+
+                __fill_device(bus, slot, func, dev);
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,60 @@
+#ifndef __PCI_H__
+#define __PCI_H__
+
+#include <kernel/system.h>
+
+// Configuration mechanism #1 I/O ports.
+#define PCI_CONFIG_ADDRESS_PORT 0xCF8
+#define PCI_CONFIG_DATA_PORT    0xCFC
+
+#define PCI_MAX_BUSES 256
+#define PCI_MAX_SLOTS 32
+#define PCI_MAX_FUNCTIONS 8
+
+// Offsets into the (type 0) configuration space header.
+#define PCI_VENDOR_ID       0x00
+#define PCI_DEVICE_ID       0x02
+#define PCI_COMMAND         0x04
+#define PCI_STATUS          0x06
+#define PCI_PROG_IF         0x09
+#define PCI_SUBCLASS        0x0A
+#define PCI_CLASS_CODE      0x0B
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_BAR0            0x10
+#define PCI_BAR4            0x20
+
+// Command register bits.
+#define PCI_COMMAND_IO_SPACE    0x1
+#define PCI_COMMAND_BUS_MASTER  0x4
+
+// A BAR with bit 0 set describes an I/O port range.
+#define PCI_BAR_IO_SPACE    0x1
+#define PCI_BAR_IO_MASK     (~0x3U)
+
+#define PCI_VENDOR_NONE     0xFFFF
+#define PCI_HEADER_MULTIFUNCTION 0x80
+
+// Class codes.
+#define PCI_CLASS_MASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE       0x01
+
+struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+};
+
+uint32_t pci_config_read32(uint8_t, uint8_t, uint8_t, uint8_t);
+uint16_t pci_config_read16(uint8_t, uint8_t, uint8_t, uint8_t);
+uint8_t pci_config_read8(uint8_t, uint8_t, uint8_t, uint8_t);
+void pci_config_write32(uint8_t, uint8_t, uint8_t, uint8_t, uint32_t);
+void pci_config_write16(uint8_t, uint8_t, uint8_t, uint8_t, uint16_t);
+
+int pci_find_device_by_class(uint8_t, uint8_t, struct pci_device *);
+
+#endif /* __PCI_H__ */
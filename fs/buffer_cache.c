@@ -0,0 +1,514 @@
+#include "buffer_cache.h"
+
+#include <kernel/mm/mm.h>
+#include <kernel/print.h>
+#include <kernel/string.h>
+
+static struct bcache_buffer buffers[BCACHE_NUM_BUFFERS];
+static struct bcache_buffer *hash_table[BCACHE_HASH_BUCKETS];
+
+// lru_head is the most recently used buffer, lru_tail the next to be evicted.
+static struct bcache_buffer *lru_head = NULL;
+static struct bcache_buffer *lru_tail = NULL;
+
+static struct bcache_stats stats;
+
+// Set while sectors written should be pinned, and the number of pinned sectors
+// and of buffers holding them.
+static bool pin_writes = false;
+static int num_pinned = 0;
+static int num_pinned_buffers = 0;
+
+static inline int __hash(lba_t lba) {
+    return (lba / BCACHE_SECTORS_PER_BUFFER) % BCACHE_HASH_BUCKETS;
+}
+
+/**
+ * @brief Bitmask of the sectors [first, first + count) of a buffer.
+ */
+static inline uint8_t __sector_mask(int first, int count) {
+    return (uint8_t) (((1U << count) - 1) << first);
+}
+
+static inline uint8_t *__sector_data(struct bcache_buffer *buf, int sector) {
+    return (uint8_t *) buf->block->addr + sector * SECTOR_SIZE;
+}
+
+static void __lru_remove(struct bcache_buffer *buf) {
+    if (buf->lru_prev)
+        buf->lru_prev->lru_next = buf->lru_next;
+    else
+        lru_head = buf->lru_next;
+
+    if (buf->lru_next)
+        buf->lru_next->lru_prev = buf->lru_prev;
+    else
+        lru_tail = buf->lru_prev;
+
+    buf->lru_prev = buf->lru_next = NULL;
+}
+
+static void __lru_push_front(struct bcache_buffer *buf) {
+    buf->lru_prev = NULL;
+    buf->lru_next = lru_head;
+
+    if (lru_head)
+        lru_head->lru_prev = buf;
+    else
+        lru_tail = buf;
+
+    lru_head = buf;
+}
+
+static void __hash_remove(struct bcache_buffer *buf) {
+    struct bcache_buffer **pp = &hash_table[__hash(buf->lba)];
+
+    while (*pp && *pp != buf)
+        pp = &(*pp)->hash_next;
+
+    if (*pp)
+        *pp = buf->hash_next;
+    buf->hash_next = NULL;
+}
+
+static struct bcache_buffer *__lookup(lba_t lba) {
+    struct bcache_buffer *buf = hash_table[__hash(lba)];
+
+    while (buf && buf->lba != lba)
+        buf = buf->hash_next;
+
+    return buf;
+}
+
+/**
+ * @brief Apply fn to each run of consecutive sectors of buf selected by mask.
+ *
+ * @return 0 if fn succeeded for every run, -1 otherwise.
+ */
+static int __for_each_run(struct bcache_buffer *buf, uint8_t mask,
+                          int (*fn)(lba_t, int, void *)) {
+    int i = 0;
+
+    while (i < BCACHE_SECTORS_PER_BUFFER) {
+        int run = 0;
+
+        if (!(mask & (1 << i))) {
+            i++;
+            continue;
+        }
+
+        while (i + run < BCACHE_SECTORS_PER_BUFFER && (mask & (1 << (i + run))))
+            run++;
+
+        if (fn(buf->lba + i, run * SECTOR_SIZE, __sector_data(buf, i)))
+            return -1;
+
+        i += run;
+    }
+
+    return 0;
+}
+
+static int __popcount8(uint8_t mask) {
+    int count = 0;
+
+    for (; mask; mask &= mask - 1)
+        count++;
+
+    return count;
+}
+
+/**
+ * @brief Write the dirty sectors of a buffer back to disk, except for pinned
+ * ones.
+ *
+ * @param buf
+ */
+static int __writeback(struct bcache_buffer *buf) {
+    const uint8_t mask = buf->dirty & ~buf->pinned;
+
+    if (!mask)
+        return 0;
+
+    if (__for_each_run(buf, mask, write_to_storage_disk)) {
+        print_string("bcache: write back failed.\n");
+        return -1;
+    }
+
+    stats.sectors_written += __popcount8(mask);
+    buf->dirty = buf->pinned;
+
+    return 0;
+}
+
+/**
+ * @brief Make sure the sectors of a buffer selected by mask hold disk content.
+ *
+ * @param buf
+ * @param mask
+ */
+static int __fill(struct bcache_buffer *buf, uint8_t mask) {
+    uint8_t missing = mask & ~buf->valid;
+
+    if (!missing)
+        return 0;
+
+    if (__for_each_run(buf, missing, read_from_storage_disk)) {
+        print_string("bcache: read failed.\n");
+        return -1;
+    }
+
+    stats.sectors_read += __popcount8(missing);
+    buf->valid |= missing;
+
+    return 0;
+}
+
+/**
+ * @brief Wait for a prefetch of a buffer to complete. If it failed, the
+ * buffer's sectors are simply left invalid (to be read again on demand).
+ *
+ * @param buf
+ */
+static void __settle(struct bcache_buffer *buf) {
+    if (!buf->reading)
+        return;
+
+    buf->reading = false;
+    if (wait_disk_request(&buf->req))
+        return;
+
+    buf->valid = __sector_mask(0, BCACHE_SECTORS_PER_BUFFER);
+    stats.sectors_read += BCACHE_SECTORS_PER_BUFFER;
+}
+
+/**
+ * @brief Find a buffer to (re)use for lba: the least recently used one which
+ * has no pinned sectors and no read in flight, written back if need be.
+ *
+ * @param lba a multiple of BCACHE_SECTORS_PER_BUFFER.
+ * @return the buffer (hashed, at the front of the lru list, with nothing
+ * valid), or NULL if none could be freed up.
+ */
+static struct bcache_buffer *__evict(lba_t lba) {
+    struct bcache_buffer *buf = lru_tail;
+
+    while (buf && (buf->pinned || buf->reading))
+        buf = buf->lru_prev;
+    if (!buf) {
+        print_string("bcache: all buffers pinned.\n");
+        return NULL;
+    }
+
+    if (buf->in_use) {
+        if (__writeback(buf))
+            return NULL;
+        __hash_remove(buf);
+        buf->in_use = false;
+    }
+
+    if (!buf->block) {
+        buf->block = zone_alloc(BCACHE_BUFFER_SIZE);
+        if (!buf->block) {
+            print_string("bcache: unable to allocate buffer.\n");
+            return NULL;
+        }
+    }
+
+    buf->lba = lba;
+    buf->valid = 0;
+    buf->dirty = 0;
+    buf->pinned = 0;
+    buf->in_use = true;
+
+    buf->hash_next = hash_table[__hash(lba)];
+    hash_table[__hash(lba)] = buf;
+
+    __lru_remove(buf);
+    __lru_push_front(buf);
+
+    return buf;
+}
+
+/**
+ * @brief Get the buffer caching the sectors starting at lba, evicting the
+ * least recently used buffer if it isn't cached.
+ *
+ * @param lba a multiple of BCACHE_SECTORS_PER_BUFFER.
+ * @return the buffer, or NULL if no buffer could be freed up.
+ */
+static struct bcache_buffer *__get_buffer(lba_t lba) {
+    struct bcache_buffer *buf = __lookup(lba);
+
+    if (buf) {
+        stats.hits++;
+        __settle(buf);
+        __lru_remove(buf);
+        __lru_push_front(buf);
+        return buf;
+    }
+
+    stats.misses++;
+
+    return __evict(lba);
+}
+
+/**
+ * @brief Read n_bytes starting at sector block_address through the cache.
+ * Same semantics as read_from_storage_disk.
+ *
+ * @param block_address
+ * @param n_bytes
+ * @param buffer
+ */
+int bcache_read(lba_t block_address, int n_bytes, void *buffer) {
+    uint8_t *out = (uint8_t *) buffer;
+    lba_t sector = block_address;
+
+    while (n_bytes > 0) {
+        int first = sector & BCACHE_SECTOR_MASK;
+        int bytes = (BCACHE_SECTORS_PER_BUFFER - first) * SECTOR_SIZE;
+        struct bcache_buffer *buf;
+        int count;
+
+        if (bytes > n_bytes)
+            bytes = n_bytes;
+        count = (bytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+        buf = __get_buffer(sector - first);
+        if (!buf || __fill(buf, __sector_mask(first, count)))
+            return -1;
+
+        memcpy((char *) out, (char *) __sector_data(buf, first), bytes);
+
+        out += bytes;
+        n_bytes -= bytes;
+        sector += count;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Write n_bytes starting at sector block_address into the cache. The
+ * data reaches the disk when the buffer is evicted or on bcache_sync().
+ *
+ * As with write_to_storage_disk, a partial final sector keeps the rest of its
+ * on-disk content.
+ *
+ * @param block_address
+ * @param n_bytes
+ * @param buffer
+ */
+int bcache_write(lba_t block_address, int n_bytes, void *buffer) {
+    uint8_t *in = (uint8_t *) buffer;
+    lba_t sector = block_address;
+
+    while (n_bytes > 0) {
+        int first = sector & BCACHE_SECTOR_MASK;
+        int bytes = (BCACHE_SECTORS_PER_BUFFER - first) * SECTOR_SIZE;
+        struct bcache_buffer *buf;
+        uint8_t mask;
+        int count;
+
+        if (bytes > n_bytes)
+            bytes = n_bytes;
+        count = (bytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        mask = __sector_mask(first, count);
+
+        buf = __get_buffer(sector - first);
+        if (!buf)
+            return -1;
+
+        // Only a partially written sector needs its old content.
+        if (bytes % SECTOR_SIZE && __fill(buf, __sector_mask(first + count - 1, 1)))
+            return -1;
+
+        memcpy((char *) __sector_data(buf, first), (char *) in, bytes);
+        buf->valid |= mask;
+        buf->dirty |= mask;
+        if (pin_writes) {
+            if (!buf->pinned)
+                num_pinned_buffers++;
+            num_pinned += __popcount8(mask & ~buf->pinned);
+            buf->pinned |= mask;
+        }
+
+        in += bytes;
+        n_bytes -= bytes;
+        sector += count;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Start reading the n_sectors sectors starting at block_address into
+ * the cache in the background, without waiting. Buffers already cached are
+ * left alone. The reads are waited for when the buffers are next accessed.
+ *
+ * @param block_address
+ * @param n_sectors
+ */
+void bcache_prefetch(lba_t block_address, int n_sectors) {
+    lba_t sector = block_address & ~BCACHE_SECTOR_MASK;
+    const lba_t end = block_address + n_sectors;
+
+    for (; sector < end; sector += BCACHE_SECTORS_PER_BUFFER) {
+        struct bcache_buffer *buf;
+
+        if (__lookup(sector))
+            continue;
+
+        buf = __evict(sector);
+        if (!buf)
+            return;
+
+        buf->req = (struct disk_request) {
+            .channel = PRIMARY,
+            .class = SLAVE,
+            .block_address = sector,
+            .n_sectors = BCACHE_SECTORS_PER_BUFFER,
+            .write = false,
+            .buffer = __sector_data(buf, 0),
+        };
+        if (submit_disk_request(&buf->req))
+            return;
+
+        buf->reading = true;
+        stats.sectors_prefetched += BCACHE_SECTORS_PER_BUFFER;
+    }
+}
+
+/**
+ * @brief Write all dirty buffers back to disk.
+ */
+int bcache_sync(void) {
+    int error = 0;
+
+    for (int i = 0; i < BCACHE_NUM_BUFFERS; i++) {
+        if (buffers[i].in_use && __writeback(&buffers[i]))
+            error = -1;
+    }
+
+    return error;
+}
+
+/**
+ * @brief Drop any cached copy (clean or dirty) of n_sectors sectors starting
+ * at block_address. Used by callers that write those sectors to the disk
+ * directly, so that the cache neither serves nor writes back stale data.
+ *
+ * @param block_address
+ * @param n_sectors
+ */
+void bcache_invalidate(lba_t block_address, int n_sectors) {
+    lba_t sector = block_address;
+
+    while (n_sectors > 0) {
+        int first = sector & BCACHE_SECTOR_MASK;
+        int count = BCACHE_SECTORS_PER_BUFFER - first;
+        struct bcache_buffer *buf;
+
+        if (count > n_sectors)
+            count = n_sectors;
+
+        buf = __lookup(sector - first);
+        if (buf) {
+            __settle(buf);
+            num_pinned -= __popcount8(buf->pinned & __sector_mask(first, count));
+            if (buf->pinned && !(buf->pinned & ~__sector_mask(first, count)))
+                num_pinned_buffers--;
+            buf->valid &= ~__sector_mask(first, count);
+            buf->dirty &= ~__sector_mask(first, count);
+            buf->pinned &= ~__sector_mask(first, count);
+        }
+
+        sector += count;
+        n_sectors -= count;
+    }
+}
+
+/**
+ * @brief Turn pinning of the sectors written from now on on or off. Sectors
+ * already pinned stay pinned until bcache_unpin_all().
+ *
+ * @param on
+ */
+void bcache_pin_writes(bool on) {
+    pin_writes = on;
+}
+
+int bcache_num_pinned(void) {
+    return num_pinned;
+}
+
+/**
+ * @brief The number of buffers holding pinned sectors, none of which can be
+ * evicted.
+ */
+int bcache_num_pinned_buffers(void) {
+    return num_pinned_buffers;
+}
+
+/**
+ * @brief Call fn on each pinned sector with its lba and (cached) content,
+ * in no particular order, stopping at the first non-zero return.
+ *
+ * @param fn
+ * @param arg passed on to fn.
+ * @return 0, or what fn returned if it failed.
+ */
+int bcache_for_each_pinned(int (*fn)(lba_t, uint8_t *, void *), void *arg) {
+    for (int i = 0; i < BCACHE_NUM_BUFFERS; i++) {
+        struct bcache_buffer *buf = &buffers[i];
+
+        if (!buf->in_use || !buf->pinned)
+            continue;
+
+        for (int s = 0; s < BCACHE_SECTORS_PER_BUFFER; s++) {
+            int error;
+
+            if (!(buf->pinned & (1 << s)))
+                continue;
+
+            error = fn(buf->lba + s, __sector_data(buf, s), arg);
+            if (error)
+                return error;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Unpin every pinned sector. They stay dirty, to be written back as
+ * usual.
+ */
+void bcache_unpin_all(void) {
+    for (int i = 0; i < BCACHE_NUM_BUFFERS; i++)
+        buffers[i].pinned = 0;
+    num_pinned = 0;
+    num_pinned_buffers = 0;
+}
+
+void bcache_get_stats(struct bcache_stats *out) {
+    *out = stats;
+}
+
+/**
+ * @brief Set up the (empty) buffer cache. Buffer memory is allocated from the
+ * zone allocator as buffers are first used.
+ */
+void init_bcache(void) {
+    clear_buffer((uint8_t *) buffers, sizeof(buffers));
+    clear_buffer((uint8_t *) hash_table, sizeof(hash_table));
+    clear_buffer((uint8_t *) &stats, sizeof(stats));
+    lru_head = lru_tail = NULL;
+    pin_writes = false;
+    num_pinned = 0;
+    num_pinned_buffers = 0;
+
+    for (int i = 0; i < BCACHE_NUM_BUFFERS; i++)
+        __lru_push_front(&buffers[i]);
+}
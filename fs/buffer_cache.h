@@ -0,0 +1,65 @@
+#ifndef __BUFFER_CACHE_H__
+#define __BUFFER_CACHE_H__
+
+#include <drivers/disk/disk.h>
+#include <kernel/system.h>
+
+// Each buffer caches a page worth of consecutive sectors, starting at a
+// sector index that is a multiple of BCACHE_SECTORS_PER_BUFFER.
+#define BCACHE_BUFFER_SIZE PAGE_SIZE
+#define BCACHE_SECTORS_PER_BUFFER (BCACHE_BUFFER_SIZE >> SECTOR_SIZE_SHIFT)
+#define BCACHE_SECTOR_MASK (BCACHE_SECTORS_PER_BUFFER - 1)
+
+#define BCACHE_NUM_BUFFERS 256
+#define BCACHE_HASH_BUCKETS 64
+
+/**
+ * A cached block of sectors. Individual sectors within the block are tracked
+ * as valid (holding disk content) and dirty (newer than the disk) so that
+ * whole-sector writes never need to read the block in first.
+ *
+ * Sectors written while pinning is on (see bcache_pin_writes) are also
+ * pinned: they are not written back, and their buffer is not evicted, until
+ * they are unpinned. The journal uses this to keep a transaction's sectors
+ * off their home locations until the transaction has been committed.
+ *
+ * A buffer can also be filled asynchronously by bcache_prefetch(), in which
+ * case reading is set until the read is waited for (by the first access to
+ * the buffer).
+ */
+struct bcache_buffer {
+    lba_t lba;                          // First sector cached by this buffer.
+    uint8_t valid;                      // 1 bit per sector.
+    uint8_t dirty;                      // 1 bit per sector.
+    uint8_t pinned;                     // 1 bit per sector, a subset of dirty.
+    bool in_use;                        // Set if lba is meaningful.
+    bool reading;                       // Set while req (a prefetch) is in flight.
+    struct disk_request req;
+    struct mem_block *block;            // Backing memory, BCACHE_BUFFER_SIZE bytes.
+    struct bcache_buffer *hash_next;
+    struct bcache_buffer *lru_prev;     // Towards the most recently used buffer.
+    struct bcache_buffer *lru_next;     // Towards the least recently used buffer.
+};
+
+struct bcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    uint32_t sectors_prefetched;
+};
+
+int bcache_read(lba_t, int, void *);
+int bcache_write(lba_t, int, void *);
+void bcache_prefetch(lba_t, int);
+int bcache_sync(void);
+void bcache_invalidate(lba_t, int);
+void bcache_pin_writes(bool);
+int bcache_num_pinned(void);
+int bcache_num_pinned_buffers(void);
+int bcache_for_each_pinned(int (*)(lba_t, uint8_t *, void *), void *);
+void bcache_unpin_all(void);
+void bcache_get_stats(struct bcache_stats *);
+void init_bcache(void);
+
+#endif /* __BUFFER_CACHE_H__ */
@@ -0,0 +1,208 @@
+#include "dentry_cache.h"
+
+#include <kernel/print.h>
+#include <kernel/string.h>
+
+static struct dcache_entry entries[DCACHE_NUM_ENTRIES];
+static struct dcache_entry *hash_table[DCACHE_HASH_BUCKETS];
+
+// lru_head is the most recently used entry, lru_tail the next to be reused.
+static struct dcache_entry *lru_head = NULL;
+static struct dcache_entry *lru_tail = NULL;
+
+static struct dcache_stats stats;
+
+static inline int __hash(fnode_id_t parent, uint32_t name_hash) {
+    return (name_hash ^ (parent * 2654435761u)) % DCACHE_HASH_BUCKETS;
+}
+
+static void __lru_remove(struct dcache_entry *entry) {
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        lru_head = entry->lru_next;
+
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        lru_tail = entry->lru_prev;
+
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void __lru_push_front(struct dcache_entry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+
+    if (lru_head)
+        lru_head->lru_prev = entry;
+    else
+        lru_tail = entry;
+
+    lru_head = entry;
+}
+
+static void __lru_push_back(struct dcache_entry *entry) {
+    entry->lru_next = NULL;
+    entry->lru_prev = lru_tail;
+
+    if (lru_tail)
+        lru_tail->lru_next = entry;
+    else
+        lru_head = entry;
+
+    lru_tail = entry;
+}
+
+static void __hash_remove(struct dcache_entry *entry) {
+    struct dcache_entry **pp = &hash_table[__hash(entry->parent, entry->hash)];
+
+    while (*pp && *pp != entry)
+        pp = &(*pp)->hash_next;
+
+    if (*pp)
+        *pp = entry->hash_next;
+    entry->hash_next = NULL;
+}
+
+static struct dcache_entry *__lookup(fnode_id_t parent, const char *name, uint32_t name_hash) {
+    struct dcache_entry *entry = hash_table[__hash(parent, name_hash)];
+    const int name_len = strlen((char *) name);
+
+    for (; entry; entry = entry->hash_next) {
+        if (entry->parent != parent || entry->hash != name_hash)
+            continue;
+        if (strlen(entry->name) == name_len &&
+            strmatchn(entry->name, (char *) name, name_len))
+            return entry;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Drop an entry, making it the next one to be reused.
+ *
+ * @param entry
+ */
+static void __drop(struct dcache_entry *entry) {
+    __hash_remove(entry);
+    entry->in_use = false;
+    __lru_remove(entry);
+    __lru_push_back(entry);
+}
+
+/**
+ * @brief Look up name in the directory with id parent.
+ *
+ * @param parent
+ * @param name
+ * @param result on a hit, a copy of the cached entry. result->negative is set
+ *        if name is known not to exist.
+ * @return 0 on a hit, -1 on a miss.
+ */
+int dcache_lookup(fnode_id_t parent, const char *name, struct dcache_entry *result) {
+    struct dcache_entry *entry = __lookup(parent, name, dir_name_hash(name));
+
+    if (!entry) {
+        stats.misses++;
+        return -1;
+    }
+
+    if (entry->negative)
+        stats.negative_hits++;
+    else
+        stats.hits++;
+
+    __lru_remove(entry);
+    __lru_push_front(entry);
+    *result = *entry;
+
+    return 0;
+}
+
+/**
+ * @brief Record the result of looking up name in the directory with id parent.
+ *
+ * @param parent
+ * @param name
+ * @param dir_entry the entry found, or NULL to record that there is none.
+ */
+void dcache_insert(fnode_id_t parent, const char *name, const struct dir_entry *dir_entry) {
+    const uint32_t name_hash = dir_name_hash(name);
+    const int name_len = strlen((char *) name);
+    struct dcache_entry *entry;
+
+    if (name_len > MAX_FILENAME_LENGTH)
+        return;
+
+    entry = __lookup(parent, name, name_hash);
+    if (!entry) {
+        entry = lru_tail;
+        if (entry->in_use)
+            __hash_remove(entry);
+
+        entry->parent = parent;
+        entry->hash = name_hash;
+        clear_buffer((uint8_t *) entry->name, sizeof(entry->name));
+        memcpy(entry->name, (char *) name, name_len);
+        entry->in_use = true;
+
+        entry->hash_next = hash_table[__hash(parent, name_hash)];
+        hash_table[__hash(parent, name_hash)] = entry;
+    }
+
+    entry->negative = !dir_entry;
+    if (dir_entry) {
+        entry->type = dir_entry->type;
+        entry->id = dir_entry->id;
+        entry->location = dir_entry->fnode_location;
+    }
+
+    __lru_remove(entry);
+    __lru_push_front(entry);
+}
+
+/**
+ * @brief Forget what is known about name in the directory with id parent.
+ * Called whenever that directory entry is added or removed.
+ *
+ * @param parent
+ * @param name
+ */
+void dcache_invalidate(fnode_id_t parent, const char *name) {
+    struct dcache_entry *entry = __lookup(parent, name, dir_name_hash(name));
+
+    if (entry)
+        __drop(entry);
+}
+
+/**
+ * @brief Forget every entry of the directory with id parent. Called when the
+ * directory is deleted, as its id may be handed out again.
+ *
+ * @param parent
+ */
+void dcache_invalidate_dir(fnode_id_t parent) {
+    for (int i = 0; i < DCACHE_NUM_ENTRIES; i++) {
+        if (entries[i].in_use && entries[i].parent == parent)
+            __drop(&entries[i]);
+    }
+}
+
+void dcache_get_stats(struct dcache_stats *out) {
+    *out = stats;
+}
+
+/**
+ * @brief Set up the (empty) dentry cache.
+ */
+void init_dcache(void) {
+    clear_buffer((uint8_t *) entries, sizeof(entries));
+    clear_buffer((uint8_t *) hash_table, sizeof(hash_table));
+    clear_buffer((uint8_t *) &stats, sizeof(stats));
+    lru_head = lru_tail = NULL;
+
+    for (int i = 0; i < DCACHE_NUM_ENTRIES; i++)
+        __lru_push_front(&entries[i]);
+}
@@ -0,0 +1,42 @@
+#ifndef __DENTRY_CACHE_H__
+#define __DENTRY_CACHE_H__
+
+#include <kernel/system.h>
+
+#include "filesystem.h"
+
+#define DCACHE_NUM_ENTRIES 128
+#define DCACHE_HASH_BUCKETS 32
+
+/**
+ * A cached result of looking up name in the directory with id parent.
+ * Negative entries record that the name does not exist there.
+ */
+struct dcache_entry {
+    fnode_id_t parent;
+    uint32_t hash;                          // dir_name_hash(name).
+    char name[MAX_FILENAME_LENGTH + 1];
+    bool in_use;
+    bool negative;
+    enum fnode_type type;
+    fnode_id_t id;
+    struct fnode_location_t location;
+    struct dcache_entry *hash_next;
+    struct dcache_entry *lru_prev;          // Towards the most recently used entry.
+    struct dcache_entry *lru_next;          // Towards the least recently used entry.
+};
+
+struct dcache_stats {
+    uint32_t hits;
+    uint32_t negative_hits;
+    uint32_t misses;
+};
+
+int dcache_lookup(fnode_id_t, const char *, struct dcache_entry *);
+void dcache_insert(fnode_id_t, const char *, const struct dir_entry *);
+void dcache_invalidate(fnode_id_t, const char *);
+void dcache_invalidate_dir(fnode_id_t);
+void dcache_get_stats(struct dcache_stats *);
+void init_dcache(void);
+
+#endif /* __DENTRY_CACHE_H__ */
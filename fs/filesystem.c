@@ -7,7 +7,10 @@
 #include <kernel/timer.h>
 #include <kernel/mm/mm.h>
 
+#include "buffer_cache.h"
+#include "dentry_cache.h"
 #include "filesystem.h"
+#include "journal.h"
 
 struct fs_master_record master_record;
 
@@ -19,18 +22,63 @@ struct dir_entry root_dir_entry = {
     .type = FOLDER,
 };
 
+// Named object caches for the structures the fs allocates most often.
+static struct memory_object_cache *chain_link_cache;
+static struct memory_object_cache *chain_cache;
+static struct memory_object_cache *file_handle_cache;
+
+/**
+ * @brief Allocate an object of one of the fs caches, or of size bytes from
+ * the general heap if the cache could not be created.
+ *
+ * @param cache
+ * @param size
+ */
+static void *fs_cache_alloc(struct memory_object_cache *cache, int size) {
+    return cache ? object_cache_alloc(cache) : object_alloc(size);
+}
+
+static void fs_cache_free(struct memory_object_cache *cache, void *obj) {
+    if (cache)
+        object_cache_free(cache, obj);
+    else
+        object_free((uint8_t *) obj);
+}
+
 /**
- * For now, we will not actually use these because some of them are so big,
- * we may not have enough memory for them. Instead when we need to access
- * them, we'll do so by accessing them on-disk, which is obviously very slow
- * but will suffice for now.
+ * For now, we will not actually use this because it is so big, we may not
+ * have enough memory for it. Instead when we need to access it, we'll do so
+ * by accessing it on-disk, which is obviously very slow but will suffice for
+ * now.
  */
 uint8_t *fnode_table;
-uint8_t *fnode_bitmap;
-uint8_t *sector_bitmap;
 
-// On init, we set this to the max fnode ID seen among pre-existing files + 1.
-uint32_t NEXT_FNODE_ID = 0;
+/**
+ * The allocation bitmaps are small enough (4MiB each with the default
+ * settings) to keep in memory. They are read in by init_usage_bits and
+ * written back by flush_usage_bits.
+ */
+struct fs_bitmap fnode_bitmap;
+struct fs_bitmap sector_bitmap;
+
+// Set while operations are waiting to be group committed by fs_sync(), and
+// the time (in ticks) the first of them started.
+static bool fs_ops_pending = false;
+static int fs_pending_since;
+
+/**
+ * Bits freed while operations are pending. They stay set in the bitmaps
+ * until fs_sync() has committed the transaction that freed them: if they
+ * were reused sooner, content could be written straight over sectors that
+ * the last committed metadata (restored by a replay) still points at.
+ */
+struct fs_deferred_free {
+    struct fs_bitmap *bitmap;
+    uint32_t start_bit;
+    uint32_t num_bits;
+};
+static struct fs_deferred_free deferred_frees[FS_MAX_DEFERRED_FREES];
+static int num_deferred_frees = 0;
 
 int load_root_fnode(struct fnode *fnode) {
     if (get_fnode(&root_dir_entry, fnode))
@@ -72,7 +120,7 @@ struct directory_chain *init_directory_chain(void) {
         return NULL;
     }
 
-    chain_head = (struct directory_chain_link *) object_alloc(sizeof(struct directory_chain_link));
+    chain_head = fs_cache_alloc(chain_link_cache, sizeof(struct directory_chain_link));
     if (!chain_head) {
        print_string("Error: unable to alloc chain_link. OOM?\n");
        return NULL;
@@ -81,14 +129,14 @@ struct directory_chain *init_directory_chain(void) {
     name_buffer = (char *) object_alloc(MAX_FILENAME_LENGTH);
     if (!name_buffer) {
         print_string("Error: unable to allocate for name_buffer.\n");
-        object_free((uint8_t *) chain_head);
+        fs_cache_free(chain_link_cache, chain_head);
         return NULL;
     }
 
     if (get_dir_name(&fnode, name_buffer) < 0) {
         print_string("Error: unable to get name for dir");
         object_free((uint8_t *) name_buffer);
-        object_free((uint8_t *) chain_head);
+        fs_cache_free(chain_link_cache, chain_head);
         return NULL;
     }
 
@@ -97,9 +145,9 @@ struct directory_chain *init_directory_chain(void) {
     chain_head->id = fnode.id;
     chain_head->name = name_buffer;
 
-    chain = (struct directory_chain *) object_alloc(sizeof(struct directory_chain));
+    chain = fs_cache_alloc(chain_cache, sizeof(struct directory_chain));
     if (!chain) {
-        object_free((uint8_t *) chain_head);
+        fs_cache_free(chain_link_cache, chain_head);
         object_free((uint8_t *) name_buffer);
         print_string("Error: unable to alloc chain. OOM?\n");
         return NULL;
@@ -161,19 +209,15 @@ fail_init:
 void destroy_directory_chain(struct directory_chain *chain) {
     struct directory_chain_link *chainp = chain->head;
 
-    object_free((uint8_t *) chain);
+    fs_cache_free(chain_cache, chain);
 
-    if (!chainp)
-        return;
+    while (chainp) {
+        struct directory_chain_link *next = chainp->next;
 
-    while (chainp->next) {
         object_free((uint8_t *) chainp->name);
-        object_free((uint8_t *) chainp);
-        chainp = chainp->next;
+        fs_cache_free(chain_link_cache, chainp);
+        chainp = next;
     }
-
-    object_free((uint8_t *) chainp->name);
-    object_free((uint8_t *) chainp);
 }
 
 /**
@@ -201,8 +245,7 @@ int push_directory_chain_link(struct directory_chain *chain, struct fnode *fnode
         return -1;
     }
 
-    chainp->next = (struct directory_chain_link *)
-                   object_alloc(sizeof(struct directory_chain_link));
+    chainp->next = fs_cache_alloc(chain_link_cache, sizeof(struct directory_chain_link));
     if (!chainp->next) {
         print_string("Error: alloc failed in chain push.\n");
         return -1;
@@ -236,9 +279,9 @@ int push_directory_chain_link(struct directory_chain *chain, struct fnode *fnode
     return 0;
 
 remove_new_link:
+    fs_cache_free(chain_link_cache, chainp->next);
     chainp->next = NULL;
     chain->tail = chainp;
-    object_free((uint8_t *) chainp->next);
 
     return error;
 }
@@ -272,7 +315,7 @@ int pop_directory_chain_link(struct directory_chain *chain) {
 
     chainp = chainp->prev;
     object_free((uint8_t *) chainp->next->name);
-    object_free((uint8_t *) chainp->next);
+    fs_cache_free(chain_link_cache, chainp->next);
     chainp->next = NULL;
 
     chain->tail = chainp;
@@ -286,24 +329,267 @@ int validate_path_string(const char *path_str) {
 }
 
 /**
- * @brief Look for a file or folder named name within the
- * directory represented by dir_fnode.
+ * @brief FNV-1a hash of a file/folder name, used to index hashed directories
+ * and the dentry cache.
  *
- * If found, put the fnode information of the file/folder in result_fnode.
+ * @param name
+ */
+uint32_t dir_name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Get the size of the header (dir_info or dir_info_hashed) that
+ * begins a directory's content.
  *
- * @param name - name of the file/folder being searched for.
- * @param dir_fnode - fnode of the folder where we should search for the
- *        file/folder.
- * @param result_fnode - if file/folder named name is found, this points to an fnode
- *        containing information about this file.
+ * @param dir_fnode
  */
-int search_name_in_directory(char *name, struct fnode* dir_fnode, struct fnode *result_fnode) {
-    uint8_t *buffer = object_alloc(dir_fnode->size);
+static int dir_header_size(const struct fnode *dir_fnode) {
+    if (dir_fnode->flags & FNODE_FLAG_HASHED_DIR)
+        return sizeof(struct dir_info_hashed);
+    return sizeof(struct dir_info);
+}
+
+/**
+ * @brief Get the first dir_entry of a directory's content (as read in by
+ * read_dir_content).
+ *
+ * @param dir_fnode
+ * @param content
+ */
+static struct dir_entry *dir_first_entry(const struct fnode *dir_fnode, uint8_t *content) {
+    return (struct dir_entry *) (content + dir_header_size(dir_fnode));
+}
+
+/**
+ * @brief Read or write len bytes at byte offset within a directory's content,
+ * going through the buffer cache one sector at a time. Only the (at most
+ * two) sectors spanned are touched.
+ *
+ * @param dir_fnode
+ * @param offset
+ * @param buffer
+ * @param len
+ * @param write
+ */
+static int dir_content_io(const struct fnode *dir_fnode, int offset, void *buffer, int len, bool write) {
+    uint8_t sector_buffer[SECTOR_SIZE];
+    uint8_t *bufp = buffer;
+
+    while (len > 0) {
+        const int within = offset & (SECTOR_SIZE - 1);
+        const int chunk = (SECTOR_SIZE - within) < len ? (SECTOR_SIZE - within) : len;
+        fblock_index_t lba;
+
+        if (fnode_get_block(dir_fnode, offset >> SECTOR_SIZE_SHIFT, &lba))
+            return -1;
+        if (bcache_read(lba, SECTOR_SIZE, sector_buffer))
+            return -1;
+
+        if (write) {
+            memcpy((char *) &sector_buffer[within], (char *) bufp, chunk);
+            if (bcache_write(lba, SECTOR_SIZE, sector_buffer))
+                return -1;
+        } else {
+            memcpy((char *) bufp, (char *) &sector_buffer[within], chunk);
+        }
+
+        offset += chunk;
+        bufp += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+static int get_dir_hash_header(const struct fnode *dir_fnode, struct dir_info_hashed *hdr) {
+    return dir_content_io(dir_fnode, 0, hdr, sizeof(*hdr), false);
+}
+
+static int put_dir_hash_header(const struct fnode *dir_fnode, struct dir_info_hashed *hdr) {
+    return dir_content_io(dir_fnode, 0, hdr, sizeof(*hdr), true);
+}
+
+static int dir_entry_io(const struct fnode *dir_fnode, int index, struct dir_entry *entry, bool write) {
+    const int offset = dir_header_size(dir_fnode) + index * sizeof(struct dir_entry);
+
+    return dir_content_io(dir_fnode, offset, entry, sizeof(*entry), write);
+}
+
+/**
+ * @brief Update slot number slot of a hashed directory's table.
+ *
+ * @param hdr
+ * @param slot
+ * @param hash
+ * @param entry 1 + index of the dir_entry, or DIR_SLOT_*.
+ */
+static int dir_hash_set_slot(const struct dir_info_hashed *hdr, int slot, uint32_t hash, uint32_t entry) {
+    struct dir_hash_slot slots[DIR_SLOTS_PER_SECTOR];
+    const fblock_index_t lba = hdr->bucket_sectors[slot / DIR_SLOTS_PER_SECTOR];
+
+    if (bcache_read(lba, SECTOR_SIZE, slots))
+        return -1;
+
+    slots[slot % DIR_SLOTS_PER_SECTOR].hash = hash;
+    slots[slot % DIR_SLOTS_PER_SECTOR].entry = entry;
+
+    return bcache_write(lba, SECTOR_SIZE, slots);
+}
+
+static int clear_dir_bucket_sector(fblock_index_t lba) {
+    uint8_t *zeroes = object_alloc(SECTOR_SIZE);
+    int error;
+
+    if (!zeroes)
+        return -1;
+
+    clear_buffer(zeroes, SECTOR_SIZE);
+    error = bcache_write(lba, SECTOR_SIZE, zeroes);
+    object_free(zeroes);
+
+    return error;
+}
+
+/**
+ * @brief Walk the probe sequence for name in a hashed directory's table.
+ *
+ * If want_index is negative, the entry whose name matches is looked for (and
+ * read into entry, if entry is not NULL). Otherwise the slot which points at
+ * dir_entry number want_index is looked for; name must then be that entry's
+ * name.
+ *
+ * @param dir_fnode
+ * @param hdr
+ * @param name
+ * @param want_index
+ * @param entry
+ * @param slot_out if not NULL, set to the matching slot.
+ * @return index of the matching dir_entry, -1 if there is none or -2 on error.
+ */
+static int dir_hash_probe(const struct fnode *dir_fnode, const struct dir_info_hashed *hdr,
+                          const char *name, int want_index, struct dir_entry *entry, int *slot_out) {
+    struct dir_hash_slot slots[DIR_SLOTS_PER_SECTOR];
+    const int num_slots = hdr->num_bucket_sectors * DIR_SLOTS_PER_SECTOR;
+    const uint32_t hash = dir_name_hash(name);
+    const int name_len = strlen((char *) name);
+    int slot, loaded = -1;
+
+    if (!num_slots)
+        return -1;
+
+    slot = hash % num_slots;
+    for (int probes = 0; probes < num_slots; probes++, slot = (slot + 1) % num_slots) {
+        struct dir_entry candidate;
+        struct dir_hash_slot *s;
+        int index;
+
+        if (slot / DIR_SLOTS_PER_SECTOR != loaded) {
+            loaded = slot / DIR_SLOTS_PER_SECTOR;
+            if (bcache_read(hdr->bucket_sectors[loaded], SECTOR_SIZE, slots)) {
+                print_string("Error: failed to read directory bucket sector.\n");
+                return -2;
+            }
+        }
+
+        s = &slots[slot % DIR_SLOTS_PER_SECTOR];
+        if (s->entry == DIR_SLOT_EMPTY)
+            break;
+        if (s->entry == DIR_SLOT_DELETED || s->hash != hash)
+            continue;
+
+        index = s->entry - 1;
+        if (want_index >= 0) {
+            if (index != want_index)
+                continue;
+        } else {
+            if (dir_entry_io(dir_fnode, index, &candidate, false)) {
+                print_string("Error: failed to read hashed dir_entry.\n");
+                return -2;
+            }
+            if (strlen(candidate.name) != name_len ||
+                !strmatchn(candidate.name, (char *) name, name_len))
+                continue;
+            if (entry)
+                *entry = candidate;
+        }
+
+        if (slot_out)
+            *slot_out = slot;
+        return index;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Look for the dir_entry named name in a hashed directory.
+ *
+ * @param dir_fnode (MUST HAVE FNODE_FLAG_HASHED_DIR)
+ * @param name
+ * @param entry
+ * @return 0 if found, 1 if there is no such entry, -1 on error.
+ */
+static int hashed_dir_lookup(const struct fnode *dir_fnode, const char *name, struct dir_entry *entry) {
+    struct dir_info_hashed hdr;
+    int index;
+
+    if (get_dir_hash_header(dir_fnode, &hdr)) {
+        print_string("Error: failed to read hashed dir_info.\n");
+        return -1;
+    }
+
+    index = dir_hash_probe(dir_fnode, &hdr, name, -1, entry, NULL);
+    if (index == -1)
+        return 1;
+
+    return index < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Call fn on each of the bucket sectors of a hashed directory (fnodes
+ * of other kinds have none).
+ *
+ * @param fnode
+ * @param fn
+ */
+static void for_each_dir_bucket_sector(const struct fnode *fnode, void (*fn)(uint32_t, uint64_t)) {
+    struct dir_info_hashed hdr;
+
+    if (fnode->type != FOLDER || !(fnode->flags & FNODE_FLAG_HASHED_DIR))
+        return;
+
+    if (get_dir_hash_header(fnode, &hdr))
+        return;
+
+    for (int i = 0; i < hdr.num_bucket_sectors && i < DIR_MAX_BUCKET_SECTORS; i++)
+        fn(hdr.bucket_sectors[i], 1);
+}
+
+/**
+ * @brief Scan the content of a (non-hashed) directory for the dir_entry
+ * named name.
+ *
+ * @param dir_fnode
+ * @param name
+ * @param result
+ * @return 0 if found, 1 if there is no such entry, -1 on error.
+ */
+static int linear_dir_lookup(const struct fnode *dir_fnode, char *name, struct dir_entry *result) {
     const int name_len = strlen(name);
     struct dir_entry *dir_entry;
     struct dir_info *dir_info;
-    bool target_found = false;
+    int found = 1;
+    uint8_t *buffer;
 
+    buffer = object_alloc(dir_fnode->size);
     if (!buffer) {
         print_string("Error: alloc failed in name search.\n");
         return -1;
@@ -311,11 +597,12 @@ int search_name_in_directory(char *name, struct fnode* dir_fnode, struct fnode *
 
     if (read_dir_content(dir_fnode, buffer) < 0) {
         print_string("Error during name search. read_dir_content_failed.\n");
+        object_free(buffer);
         return -1;
     }
 
     dir_info = (struct dir_info *) buffer;
-    dir_entry = (struct dir_entry *) (((char *) dir_info) + sizeof(struct dir_info));
+    dir_entry = dir_first_entry(dir_fnode, buffer);
     for (int i = 0; i < dir_info->num_entries; i++, dir_entry++) {
         const int entry_name_len = strlen(dir_entry->name);
 
@@ -323,17 +610,72 @@ int search_name_in_directory(char *name, struct fnode* dir_fnode, struct fnode *
             continue;
 
         if (strmatchn(dir_entry->name, name, entry_name_len)) {
-            get_fnode(dir_entry, result_fnode);
-            target_found = true;
+            memcpy((char *) result, (char *) dir_entry, sizeof(*result));
+            found = 0;
             break;
         }
     }
     object_free(buffer);
 
-    if (target_found)
+    return found;
+}
+
+/**
+ * @brief Look up the dir_entry named name in a directory, consulting the
+ * dentry cache first and recording the outcome (found or not) in it.
+ *
+ * @param dir_fnode
+ * @param name
+ * @param result
+ * @return 0 if found, 1 if there is no such entry, -1 on error.
+ */
+static int lookup_dir_entry(const struct fnode *dir_fnode, char *name, struct dir_entry *result) {
+    struct dcache_entry cached;
+    int found;
+
+    if (!dcache_lookup(dir_fnode->id, name, &cached)) {
+        if (cached.negative)
+            return 1;
+
+        clear_buffer((uint8_t *) result, sizeof(*result));
+        memcpy(result->name, cached.name, sizeof(result->name));
+        result->type = cached.type;
+        result->fnode_location = cached.location;
+        result->id = cached.id;
         return 0;
+    }
 
-    return -1;
+    // Directories from before hashing was introduced are searched linearly.
+    if (dir_fnode->flags & FNODE_FLAG_HASHED_DIR)
+        found = hashed_dir_lookup(dir_fnode, name, result);
+    else
+        found = linear_dir_lookup(dir_fnode, name, result);
+
+    if (found >= 0)
+        dcache_insert(dir_fnode->id, name, found ? NULL : result);
+
+    return found;
+}
+
+/**
+ * @brief Look for a file or folder named name within the
+ * directory represented by dir_fnode.
+ *
+ * If found, put the fnode information of the file/folder in result_fnode.
+ *
+ * @param name - name of the file/folder being searched for.
+ * @param dir_fnode - fnode of the folder where we should search for the
+ *        file/folder.
+ * @param result_fnode - if file/folder named name is found, this points to an fnode
+ *        containing information about this file.
+ */
+int search_name_in_directory(char *name, struct fnode* dir_fnode, struct fnode *result_fnode) {
+    struct dir_entry entry;
+
+    if (lookup_dir_entry(dir_fnode, name, &entry))
+        return -1;
+
+    return get_fnode(&entry, result_fnode);
 }
 
 /**
@@ -365,11 +707,30 @@ int validate_directory_chain(struct directory_chain *chain, struct fnode *tail_d
         chain_valid = true; // A chain of just the root directory is valid.
 
     while (chainp) {
-        uint8_t *buffer = object_alloc(curr_fnode.size);
-        struct dir_entry *curr_dir_entry;
+        struct dir_entry *curr_dir_entry, named_entry;
         struct dir_info *curr_dir_info;
         bool found_match = false;
+        uint8_t *buffer;
 
+        // Links are normally found by name (through the dentry cache). The
+        // linear scan by id below remains the fallback.
+        if (!lookup_dir_entry(&curr_fnode, chainp->name, &named_entry) &&
+            named_entry.id == chainp->id) {
+            struct fnode curr_entry_fnode;
+
+            if (!get_fnode(&named_entry, &curr_entry_fnode) &&
+                curr_entry_fnode.id == chainp->id) {
+                curr_fnode = curr_entry_fnode;
+                curr_fnode_location = named_entry.fnode_location;
+
+                if (chainp->next == NULL)
+                    chain_valid = true;
+                chainp = chainp->next;
+                continue;
+            }
+        }
+
+        buffer = object_alloc(curr_fnode.size);
         if (!buffer) {
             print_string("Error during chain validation: mem alloc failure.\n");
             return -1;
@@ -382,8 +743,7 @@ int validate_directory_chain(struct directory_chain *chain, struct fnode *tail_d
         }
 
         curr_dir_info = (struct dir_info *) buffer;
-        curr_dir_entry = (struct dir_entry *)
-                         (((char *) curr_dir_info) + sizeof(struct dir_info));
+        curr_dir_entry = dir_first_entry(&curr_fnode, buffer);
         for (int i = 0; i < curr_dir_info->num_entries; i++, curr_dir_entry++) {
             struct fnode curr_entry_fnode;
 
@@ -393,6 +753,7 @@ int validate_directory_chain(struct directory_chain *chain, struct fnode *tail_d
                 return -1;
             }
             if (curr_entry_fnode.id == chainp->id) {
+                dcache_insert(curr_fnode.id, curr_dir_entry->name, curr_dir_entry);
                 curr_fnode = curr_entry_fnode;
                 curr_fnode_location = curr_dir_entry->fnode_location;
                 found_match = true;
@@ -484,16 +845,10 @@ next_name_idx_and_len:
         pop_directory_chain_link(chain);
         curr_path_depth--;
 
-        // We don't really need to validate here, we just want the fnode
-        // of the grandparent directory and this is currently the simplest way
-        // to get it.
-        // TODO: Create a function that's a simpler way to get the grandparent
-        // fnode.
-        if (validate_directory_chain(chain,
-                                     &curr_dir_parent_fnode,
-                                     &curr_dir_parent_fnode_location)) {
-             print_string("Error: although this validation isn't needed, "
-                          "there's no reason for it to fail.\n");
+        // The chain was validated on the way down, so the grandparent's fnode
+        // can be read directly by id.
+        if (get_fnode_by_id(chain->tail->id, &curr_dir_parent_fnode)) {
+             print_string("Error: failed to get parent fnode for '..'.\n");
              goto revert_chain_changes;
         }
         curr_dir_name_start_idx_in_path = curr_dir_name_end_idx_in_path;
@@ -531,860 +886,2699 @@ revert_chain_changes:
 }
 
 /**
- * @brief Set num_bits bits within a disk sector.
+ * @brief Get a pointer to the byte of an in-memory bitmap holding bit n, and
+ * the offset of bit n relative to that byte's chunk.
  *
- * @param start_bit
- * @param num_bits
- * @param start_sector
+ * @param bitmap
+ * @param n
+ * @param bit_in_chunk output, bit n's offset within its chunk.
  */
-void set_sector_bits(uint32_t start_bit, uint64_t num_bits, uint32_t start_sector) {
-    const int BITS_PER_SECTOR = 8 * SECTOR_SIZE;
-    int bits_to_do = num_bits, bit_offset;
-    uint8_t sector_buffer[SECTOR_SIZE];
-    int sector_offset;
-
-    sector_offset = start_bit / BITS_PER_SECTOR;
-    bit_offset = start_bit % BITS_PER_SECTOR;
+static uint8_t *bitmap_chunk_for_bit(struct fs_bitmap *bitmap, uint32_t n, uint32_t *bit_in_chunk) {
+    const uint32_t chunk_bits_shift = bitmap->chunk_shift + 3;
+    const uint32_t chunk = n >> chunk_bits_shift;
 
-    while (bits_to_do) {
-        int batchsize = ((bit_offset + bits_to_do) > BITS_PER_SECTOR)
-                        ? BITS_PER_SECTOR - bit_offset
-                        : bits_to_do;
-        bits_to_do -= batchsize;
+    *bit_in_chunk = n & ((1U << chunk_bits_shift) - 1);
 
-        read_from_storage_disk(start_sector + sector_offset, SECTOR_SIZE, sector_buffer);
-        while (batchsize--)
-            set_bit((uint8_t*)sector_buffer, bit_offset++);
-        write_to_storage_disk(start_sector + sector_offset++, SECTOR_SIZE, sector_buffer);
-
-        // If we move on to the next sector, we want to start at the first (0th) bit in that sector.
-        bit_offset = 0;
-    }
+    return (uint8_t *) bitmap->chunks[chunk]->addr;
 }
 
 /**
- * @brief Unset num_bit bits on disk starting from start_sector);
+ * @brief Record that the bitmap sectors holding bits [start_bit, start_bit + num_bits)
+ * need to be written back to disk.
  *
+ * @param bitmap
  * @param start_bit
  * @param num_bits
- * @param start_sector
  */
-void unset_sector_bits(uint32_t start_bit, uint64_t num_bits, uint32_t start_sector) {
+static void bitmap_mark_dirty(struct fs_bitmap *bitmap, uint32_t start_bit, uint32_t num_bits) {
     const int BITS_PER_SECTOR = BITS_PER_BYTE * SECTOR_SIZE;
-    int sector_offset = start_bit / BITS_PER_SECTOR;
-    int bit_offset = start_bit % BITS_PER_SECTOR;
-    uint8_t sector_buffer[SECTOR_SIZE];
-    int sector;
+    uint32_t first_sector = start_bit / BITS_PER_SECTOR;
+    uint32_t last_sector = (start_bit + num_bits - 1) / BITS_PER_SECTOR;
 
-    while (num_bits) {
-        sector = start_sector + sector_offset;
-
-        read_from_storage_disk(sector, SECTOR_SIZE, sector_buffer);
-        while (num_bits && bit_offset < BITS_PER_SECTOR) {
-            clear_bit(sector_buffer, bit_offset++);
-            num_bits--;
-        }
-        write_to_storage_disk(sector, SECTOR_SIZE, sector_buffer);
+    for (uint32_t s = first_sector; s <= last_sector; s++) {
+        if (get_bit(bitmap->dirty_sectors, s))
+            continue;
 
-        bit_offset = 0;
-        sector_offset++;
+        set_bit(bitmap->dirty_sectors, s);
+        bitmap->num_dirty++;
     }
 }
 
 /**
- * @brief set bit n in the fnode bitmap.
+ * @brief Find the first bit in [start, end) of an in-memory bitmap which is
+ * set (if set is true) or clear (if set is false). Each chunk is searched a
+ * word at a time with find_next_set_bit/find_next_zero_bit.
  *
- * TODO: when we're reading the structures into memory, this will be as simple as:
- * set_bit(fnode_bitmap, n) but for now, we have to work only on-disk.
+ * @return the bit found, or end if there is none.
  */
-void fnode_bitmap_set(uint32_t start_bit, uint64_t num_bits) {
-    set_sector_bits(start_bit, num_bits, master_record.fnode_bitmap_start_sector);
-}
+static uint32_t bitmap_find_next(struct fs_bitmap *bitmap, uint32_t start, uint32_t end, bool set) {
+    const uint32_t chunk_bits = 1U << (bitmap->chunk_shift + 3);
 
-void fnode_bitmap_unset(uint32_t start_bit, uint64_t num_bits) {
-    unset_sector_bits(start_bit, num_bits, master_record.fnode_bitmap_start_sector);
+    while (start < end) {
+        uint32_t bit_in_chunk, chunk_start, limit;
+        uint8_t *chunk = bitmap_chunk_for_bit(bitmap, start, &bit_in_chunk);
+        int found;
+
+        chunk_start = start - bit_in_chunk;
+        limit = (end - chunk_start < chunk_bits) ? end - chunk_start : chunk_bits;
+
+        if (set)
+            found = find_next_set_bit(chunk, limit, bit_in_chunk);
+        else
+            found = find_next_zero_bit(chunk, limit, bit_in_chunk);
+        if (found < limit)
+            return chunk_start + found;
+
+        start = chunk_start + chunk_bits;
+    }
+
+    return end;
 }
 
 /**
- * @brief set bit n in the sector bitmap.
+ * @brief Find the first 0 bit in [start, end) of an in-memory bitmap,
+ * skipping regions which have no free bits without looking at them.
  *
- * TODO: when we're reading the structures into memory, this will be as simple as:
- * set_bit(fnode_bitmap, n) but for now, we have to work only on disk.
+ * @return the bit found, or end if there is none.
  */
-void sector_bitmap_set(uint32_t start_bit, uint64_t num_bits) {
-    set_sector_bits(start_bit, num_bits, master_record.sector_bitmap_start_sector);
-}
+static uint32_t bitmap_find_free(struct fs_bitmap *bitmap, uint32_t start, uint32_t end) {
+    while (start < end) {
+        const uint32_t region = start >> bitmap->region_shift;
+        uint32_t region_end = (region + 1) << bitmap->region_shift;
 
-void sector_bitmap_unset(uint32_t start_bit, uint64_t num_bits) {
-    unset_sector_bits(start_bit, num_bits, master_record.sector_bitmap_start_sector);
+        if (region_end > end || region_end == 0)
+            region_end = end;
+
+        if (bitmap->region_free[region]) {
+            uint32_t found = bitmap_find_next(bitmap, start, region_end, false);
+
+            if (found < region_end)
+                return found;
+        }
+
+        start = region_end;
+    }
+
+    return end;
 }
 
 /**
- * @brief List out the files and folders in the innermost directory
- * in the given directory_chain.
+ * @brief Recompute the free bit count of every region of an in-memory bitmap
+ * (after it has been rebuilt).
  *
- * @param chain - directory path representation.
- * @param path
+ * @param bitmap
  */
-int list_dir_content(struct fs_context *ctx, char *path) {
-    struct fnode_location_t tail_dir_fnode_location;
-    struct directory_chain *new_chain = NULL;
-    struct fnode tail_dir_fnode;
-
-    if (path) {
-        new_chain = create_chain_from_path(ctx, path);
-        if (!new_chain) {
-            print_string("Error list_dir_content: create_chain_from_path.\n");
-            return -1;
-        }
-    } else {
-        new_chain = ctx->working_directory_chain;
-    }
+static void bitmap_count_regions(struct fs_bitmap *bitmap) {
+    const uint32_t total = bitmap->size * BITS_PER_BYTE;
+    uint32_t bit = 0;
 
-    if (validate_directory_chain(new_chain, &tail_dir_fnode, &tail_dir_fnode_location)) {
-        print_string("Error: dir show failed on chain validation.\n");
-        return -1;
-    }
+    clear_buffer((uint8_t *) bitmap->region_free, sizeof(bitmap->region_free));
 
-    show_dir_content(&tail_dir_fnode);
+    while ((bit = bitmap_find_next(bitmap, bit, total, false)) < total) {
+        const uint32_t region = bit >> bitmap->region_shift;
+        uint32_t region_end = (region + 1) << bitmap->region_shift;
+        uint32_t run_end;
 
-    if (path)
-        destroy_directory_chain(new_chain);
+        if (region_end > total || region_end == 0)
+            region_end = total;
 
-    return 0;
+        run_end = bitmap_find_next(bitmap, bit, region_end, true);
+        bitmap->region_free[region] += run_end - bit;
+        bit = run_end;
+    }
 }
 
 /**
- * @brief Search for a file/folder in the innermost folder of a directory_chain.
- *
- * Although the logic seems to apply to both files and folders, the description
- * is targeted at folders because this function was initially written for the
- * purpose of handling a change-directory command where we would be looking for
- * target directory in the chain'd innermost directory.
+ * @brief Set num_bits bits of an in-memory bitmap, starting at start_bit.
  *
- * @param chain
- * @param target_dir_name
- * @param result_fnode
+ * @param bitmap
+ * @param start_bit
+ * @param num_bits
  */
-int fs_search(struct directory_chain *chain, char* target_dir_name, struct fnode *result_fnode) {
-    struct fnode_location_t tail_dir_fnode_location;
-    struct fnode tail_dir_fnode;
+static void bitmap_set_bits(struct fs_bitmap *bitmap, uint32_t start_bit, uint64_t num_bits) {
+    if (!num_bits)
+        return;
 
-    if (validate_directory_chain(chain, &tail_dir_fnode, &tail_dir_fnode_location)) {
-        print_string("Error: Invalid directory_chain.\n");
-        return -1;
+    for (uint64_t i = 0; i < num_bits; i++) {
+        uint32_t bit_in_chunk;
+        uint8_t *chunk = bitmap_chunk_for_bit(bitmap, start_bit + i, &bit_in_chunk);
+
+        if (get_bit(chunk, bit_in_chunk))
+            continue;
+        set_bit(chunk, bit_in_chunk);
+        bitmap->region_free[(start_bit + i) >> bitmap->region_shift]--;
     }
 
-    if (search_name_in_directory(target_dir_name, &tail_dir_fnode, result_fnode)) {
-        print_string("Error: could not find "); print_string(target_dir_name); print_string(" in chain provided.\n");
-        return -1;
+    bitmap_mark_dirty(bitmap, start_bit, num_bits);
+}
+
+/**
+ * @brief Unset num_bits bits of an in-memory bitmap, starting at start_bit.
+ *
+ * @param bitmap
+ * @param start_bit
+ * @param num_bits
+ */
+static void bitmap_clear_bits(struct fs_bitmap *bitmap, uint32_t start_bit, uint64_t num_bits) {
+    if (!num_bits)
+        return;
+
+    for (uint64_t i = 0; i < num_bits; i++) {
+        uint32_t bit_in_chunk;
+        uint8_t *chunk = bitmap_chunk_for_bit(bitmap, start_bit + i, &bit_in_chunk);
+
+        if (!get_bit(chunk, bit_in_chunk))
+            continue;
+        clear_bit(chunk, bit_in_chunk);
+        bitmap->region_free[(start_bit + i) >> bitmap->region_shift]++;
     }
 
-    return 0;
+    bitmap_mark_dirty(bitmap, start_bit, num_bits);
 }
 
-/** @brief Search for num_fnodes free fnodes.
+/**
+ * @brief Get where a next-fit search of an in-memory bitmap should start.
  *
- * This amounts to looking for the num_fnodes unset bits within the fnode bitmap
- * and is made complicated by the fact that the fnode_bitmap (for now) resides on
- * disk.
+ * @param bitmap
+ */
+static uint32_t bitmap_cursor(struct fs_bitmap *bitmap) {
+    if (bitmap->cursor < bitmap->base || bitmap->cursor >= bitmap->size * BITS_PER_BYTE)
+        return bitmap->base;
+    return bitmap->cursor;
+}
+
+/**
+ * @brief The first bit of block group number group of an in-memory bitmap.
  *
- * @param num_fnodes
- * @Param fnode_indexes an output array of the indexes of the free fnodes found.
+ * @param bitmap
+ * @param group
  */
-int query_free_fnodes(int num_fnodes, struct fnode_location_t *fnode_indexes) {
-    int visit_count = 0, free_count = 0, fnode_bitmap_current_sector_offset = 0;
-    const int fnode_bitmap_start_sector = master_record.fnode_bitmap_start_sector;
-    const int fnode_total = master_record.fnode_bitmap_size * BITS_PER_BYTE;
-    const int fnodes_per_sector = SECTOR_SIZE / sizeof(struct fnode);
-    const int block_size = ORDER_SIZE(5);
-    const int bits_per_block = block_size * BITS_PER_BYTE;
-    const int sector_skip = block_size / SECTOR_SIZE;
-    struct mem_block *block = zone_alloc(block_size);
-    uint8_t *block_buffer = (uint8_t*) block->addr;
-    int error = 0;
+static uint32_t bitmap_group_start(const struct fs_bitmap *bitmap, int group) {
+    return bitmap->group_base + group * bitmap->group_bits;
+}
 
-    block = zone_alloc(block_size);
-    if (!block) {
-        print_string("Failed to allocate block while querying fnodes.\n");
-        error = -1;
-        goto exit_with_alloc;
-    }
-    block_buffer = (uint8_t*) block->addr;
+/**
+ * @brief One past the last bit of block group number group of an in-memory
+ * bitmap.
+ *
+ * @param bitmap
+ * @param group
+ */
+static uint32_t bitmap_group_end(const struct fs_bitmap *bitmap, int group) {
+    const uint32_t total = bitmap->size * BITS_PER_BYTE;
+    const uint32_t end = bitmap_group_start(bitmap, group) + bitmap->group_bits;
+
+    return (end > total || group == FS_NUM_GROUPS - 1) ? total : end;
+}
 
-    while (visit_count < fnode_total && free_count != num_fnodes) {
-        int idx = fnode_bitmap_start_sector + fnode_bitmap_current_sector_offset;
+/**
+ * @brief Claim one free bit in [start, end) of an in-memory bitmap, searching
+ * from *cursor to end and then wrapping around from start, and move *cursor
+ * past it.
+ *
+ * @return the bit claimed, or -1 if there is no free bit in the range.
+ */
+static int bitmap_claim_range(struct fs_bitmap *bitmap, uint32_t start, uint32_t end, uint32_t *cursor) {
+    const uint32_t from = (*cursor < start || *cursor >= end) ? start : *cursor;
+    uint32_t bit = bitmap_find_free(bitmap, from, end);
 
-        if (read_from_storage_disk(idx, block_size, block_buffer)) {
-            print_string("Read failed in fnode search!\n");
-            goto exit_reset_bitmap;
+    if (bit >= end) {
+        bit = bitmap_find_free(bitmap, start, from);
+        if (bit >= from)
             return -1;
-        }
+    }
 
-        for (int i = 0; i < bits_per_block; i++, visit_count++) {
-            int offset_within_sector, bit_offset, fnode_sector_index;
+    bitmap_set_bits(bitmap, bit, 1);
+    *cursor = bit + 1;
 
-            if (get_bit(block_buffer, i))
-                continue;
+    return bit;
+}
+
+/**
+ * @brief Claim one free bit of an in-memory bitmap: from the goal block group
+ * if one is set and it has any, otherwise next-fit from the bitmap's cursor.
+ *
+ * @return the bit claimed, or -1 if the bitmap is full.
+ */
+static int bitmap_claim_free(struct fs_bitmap *bitmap) {
+    const uint32_t total = bitmap->size * BITS_PER_BYTE;
+
+    if (bitmap->goal >= 0) {
+        int bit = bitmap_claim_range(bitmap, bitmap_group_start(bitmap, bitmap->goal),
+                                     bitmap_group_end(bitmap, bitmap->goal),
+                                     &bitmap->group_cursor[bitmap->goal]);
 
-            bit_offset = fnode_bitmap_current_sector_offset * SECTOR_SIZE * BITS_PER_BYTE + i;
-            fnode_sector_index = master_record.fnode_table_start_sector + bit_offset / fnodes_per_sector;
-            offset_within_sector = (i % fnodes_per_sector) * sizeof(struct fnode);
+        if (bit >= 0)
+            return bit;
+    }
 
-            fnode_bitmap_set(bit_offset, 1);
-            fnode_indexes[free_count++] = (struct fnode_location_t) {
-                                            .fnode_table_index = bit_offset,
-                                            .fnode_sector_index = fnode_sector_index,
-                                            .offset_within_sector = offset_within_sector
-                                          };
+    return bitmap_claim_range(bitmap, bitmap->base, total, &bitmap->cursor);
+}
 
-            if (free_count == num_fnodes)
-                break;
+/**
+ * @brief Write the dirty sectors of an in-memory bitmap back to disk.
+ *
+ * Runs of adjacent dirty sectors are written with a single disk command
+ * (capped at FS_BITMAP_IO_SECTORS sectors and at chunk boundaries, since
+ * chunks are not contiguous in memory).
+ *
+ * @param bitmap
+ */
+static int flush_bitmap(struct fs_bitmap *bitmap) {
+    const uint32_t sectors_per_chunk = 1U << (bitmap->chunk_shift - SECTOR_SIZE_SHIFT);
+    const uint32_t num_sectors = bitmap->size >> SECTOR_SIZE_SHIFT;
+    uint32_t s = 0;
+    int error = 0;
+
+    while (bitmap->num_dirty && s < num_sectors) {
+        uint32_t run = 0, chunk_end;
+        uint8_t *data;
+
+        if (!get_bit(bitmap->dirty_sectors, s)) {
+            s++;
+            continue;
         }
 
-        fnode_bitmap_current_sector_offset += sector_skip;
-    }
+        chunk_end = (s & ~(sectors_per_chunk - 1)) + sectors_per_chunk;
+        while (s + run < chunk_end && s + run < num_sectors &&
+               run < FS_BITMAP_IO_SECTORS &&
+               get_bit(bitmap->dirty_sectors, s + run)) {
+            clear_bit(bitmap->dirty_sectors, s + run);
+            bitmap->num_dirty--;
+            run++;
+        }
 
-    if (free_count == num_fnodes)
-        goto exit_with_alloc;
+        data = (uint8_t *) bitmap->chunks[s / sectors_per_chunk]->addr +
+               ((s & (sectors_per_chunk - 1)) << SECTOR_SIZE_SHIFT);
+        if (write_to_storage_disk(bitmap->start_sector + s, run << SECTOR_SIZE_SHIFT, data)) {
+            print_string("Error flushing bitmap sectors.\n");
+            error = -1;
+        }
 
-exit_reset_bitmap:
-    print_string("Undoing changes to fnode_bitmap.\n");
-    for (int i = 0; i < free_count; i++) {
-        fnode_bitmap_unset(fnode_indexes[i].fnode_table_index, 1);
-        fnode_indexes[i] = (struct fnode_location_t) { 0, 0, 0 };
+        s += run;
     }
 
-exit_with_alloc:
-    zone_free(block);
-
     return error;
 }
 
 /**
- * @brief Search for unused sectors.
+ * @brief Read an on-disk bitmap into memory.
  *
- * Find num_sectors unused sectors. This amounts to a search for num_sectors unset bits
- * in the sector_bitmap and is complicated by the fact sector_bitmap is on-disk.
- *
- * @param num_sectors
- * @param sector_indexes output array of indexes of free sectors.
+ * @param bitmap
+ * @param start_sector first sector of the bitmap on disk.
+ * @param size size of the bitmap in bytes.
  */
-int query_free_sectors(int num_sectors, int *sector_indexes) {
-    int bitmap_sector = (master_record.data_blocks_start_sector / BITS_PER_BYTE) >> SECTOR_SIZE_SHIFT;
-    const int sector_total = master_record.sector_bitmap_size * BITS_PER_BYTE;
-    const int block_size = ORDER_SIZE(5);
-    struct mem_block *block = zone_alloc(block_size);
-    const int bits_per_block = block_size * BITS_PER_BYTE;
-    const int sector_skip = block_size / SECTOR_SIZE;
-    int error = 0, visit_count = 0, free_count = 0;
-    uint8_t *block_buffer;
-
-    if (!block) {
-        print_string("Unable to allocate block for sector query.\n");
-        error = -1;
-        goto exit_with_alloc;
+static int load_bitmap(struct fs_bitmap *bitmap, uint32_t start_sector, uint32_t size) {
+    extern int _highest_initialized_zone_order;
+    int chunk_order = FS_BITMAP_CHUNK_ORDER;
+    uint32_t chunk_size, dirty_map_size;
+
+    if (chunk_order > _highest_initialized_zone_order)
+        chunk_order = _highest_initialized_zone_order;
+
+    clear_buffer((uint8_t *) bitmap, sizeof(struct fs_bitmap));
+    bitmap->start_sector = start_sector;
+    bitmap->size = size;
+    bitmap->chunk_shift = PAGE_SIZE_SHIFT + chunk_order;
+
+    while (((uint64_t) FS_BITMAP_REGIONS << bitmap->region_shift) < (uint64_t) size * BITS_PER_BYTE)
+        bitmap->region_shift++;
+
+    chunk_size = 1U << bitmap->chunk_shift;
+    bitmap->num_chunks = (size + chunk_size - 1) >> bitmap->chunk_shift;
+    if (bitmap->num_chunks > FS_BITMAP_MAX_CHUNKS) {
+        print_string("Error: bitmap too big to keep in memory.\n");
+        return -1;
     }
-    block_buffer = (uint8_t *) block->addr;
 
-    while (visit_count < sector_total && free_count != num_sectors) {
-        int idx = master_record.sector_bitmap_start_sector + bitmap_sector;
+    dirty_map_size = ((size >> SECTOR_SIZE_SHIFT) + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+    bitmap->dirty_block = zone_alloc(dirty_map_size);
+    if (!bitmap->dirty_block) {
+        print_string("Error: unable to allocate bitmap dirty map.\n");
+        return -1;
+    }
+    bitmap->dirty_sectors = (uint8_t *) bitmap->dirty_block->addr;
+    clear_buffer(bitmap->dirty_sectors, dirty_map_size);
 
-        if (read_from_storage_disk(idx, block_size, block_buffer)) {
-            print_string("Failed read in sector search!\n");
-            error = -1;
-            goto exit_bitmap_reset;
-        }
+    for (uint32_t c = 0; c < bitmap->num_chunks; c++) {
+        uint32_t chunk_bytes = (c == bitmap->num_chunks - 1) ? size - (c << bitmap->chunk_shift) : chunk_size;
+        uint32_t chunk_sector = start_sector + ((c << bitmap->chunk_shift) >> SECTOR_SIZE_SHIFT);
+        uint8_t *data;
 
-        for (int i = 0; i < bits_per_block; i++, visit_count++) {
-            int bit_index = bitmap_sector * SECTOR_SIZE * BITS_PER_BYTE + i;
+        bitmap->chunks[c] = zone_alloc(chunk_size);
+        if (!bitmap->chunks[c]) {
+            print_string("Error: unable to allocate bitmap chunk.\n");
+            return -1;
+        }
+        data = (uint8_t *) bitmap->chunks[c]->addr;
 
-            if (get_bit(block_buffer, i))
-                continue;
+        for (uint32_t done = 0; done < chunk_bytes; ) {
+            uint32_t io = chunk_bytes - done;
 
-            sector_bitmap_set(bit_index, 1);
-            sector_indexes[free_count++] = bit_index;
+            if (io > FS_BITMAP_IO_SECTORS * SECTOR_SIZE)
+                io = FS_BITMAP_IO_SECTORS * SECTOR_SIZE;
 
-            if (free_count == num_sectors)
-                break;
+            if (read_from_storage_disk(chunk_sector + (done >> SECTOR_SIZE_SHIFT), io, data + done)) {
+                print_string("Error: failed to read in bitmap.\n");
+                return -1;
+            }
+            done += io;
         }
-
-        bitmap_sector += sector_skip;
     }
 
-    if (free_count == num_sectors)
-        goto exit_with_alloc;
+    return 0;
+}
 
-exit_bitmap_reset:
-    print_string("Undoing changes to sector_bitmap.\n");
-    for (int i = 0; i < free_count; i++) {
-        sector_bitmap_unset(sector_indexes[i], 1);
-        sector_indexes[i] = 0;
-    }
+/**
+ * @brief Write back the dirty sectors of both allocation bitmaps.
+ */
+int flush_usage_bits(void) {
+    int error = 0;
 
-exit_with_alloc:
-    zone_free(block);
+    error |= flush_bitmap(&fnode_bitmap);
+    error |= flush_bitmap(&sector_bitmap);
 
     return error;
 }
 
 /**
- * @brief Save the contents of the firl described by file_info to disk.
+ * @brief Unset num_bits bits of an in-memory bitmap once the pending
+ * operations have been committed (right away if there are none).
  *
- * @param fnode fnode of the file to be saved to disk.
- * @param file_info
+ * @param bitmap
+ * @param start_bit
+ * @param num_bits
  */
-int save_file(struct fnode *fnode, struct file_creation_info *file_info) {
-    int error = 0, written = 0, to_write, sectors_written = 0;
-    uint8_t *data = file_info->file_content;
-    const int sz = file_info->file_size;
+static void bitmap_defer_clear(struct fs_bitmap *bitmap, uint32_t start_bit, uint64_t num_bits) {
+    struct fs_deferred_free *last = num_deferred_frees ? &deferred_frees[num_deferred_frees - 1] : NULL;
 
-    // Write to disk one sector at a time because fnode->sector_indexes
-    // might not be contiguous.
-    while (written < sz) {
-        int idx = fnode->sector_indexes[sectors_written];
+    if (!fs_ops_pending || !num_bits) {
+        bitmap_clear_bits(bitmap, start_bit, num_bits);
+        return;
+    }
 
-        to_write = (sz - written) < SECTOR_SIZE ? (sz - written) : SECTOR_SIZE;
-        if (write_to_storage_disk(idx, to_write, data)) {
-            print_string("Failed to write file content to disk.\n");
-            return -1;
-        }
+    if (last && last->bitmap == bitmap &&
+        last->start_bit + last->num_bits == start_bit) {
+        last->num_bits += num_bits;
+        return;
+    }
 
-        sectors_written++;
-        written += to_write;
-        data += written;
+    if (num_deferred_frees == FS_MAX_DEFERRED_FREES) {
+        print_string("Warning: too many frees in one transaction, freeing now.\n");
+        bitmap_clear_bits(bitmap, start_bit, num_bits);
+        return;
     }
 
-    return error;
+    deferred_frees[num_deferred_frees++] = (struct fs_deferred_free) {
+        bitmap, start_bit, num_bits
+    };
 }
 
 /**
- * @brief Save the content of the folder described by fnode to disk.
- *
- * @param fnode
- * @param folder_info
+ * @brief Unset the bits freed by the (now committed) pending operations.
  */
-int save_folder(struct fnode *fnode, struct folder_creation_info *folder_info) {
-    int error = 0, written = 0, to_write, sectors_written = 0;
-    const int sz = folder_info->size;
-    uint8_t *data = folder_info->data;
+static void apply_deferred_frees(void) {
+    for (int i = 0; i < num_deferred_frees; i++)
+        bitmap_clear_bits(deferred_frees[i].bitmap, deferred_frees[i].start_bit,
+                          deferred_frees[i].num_bits);
 
-    // Write to disk one sector at a time because fnode->sector_indexes
-    // might not be contiguous.
-    while (written < sz) {
-        int idx = fnode->sector_indexes[sectors_written];
+    num_deferred_frees = 0;
+}
 
-        to_write = (sz - written) < SECTOR_SIZE ? (sz - written) : SECTOR_SIZE;
-        if (write_to_storage_disk(idx, to_write, data)) {
-            print_string("Failed to write file content to disk.\n");
-            return -1;
-        }
+/**
+ * @brief Write the in-memory master record to its sector. This goes straight
+ * to the disk since its ordering relative to the other writes matters.
+ */
+static int write_master_record(void) {
+    uint8_t *buffer = object_alloc(SECTOR_SIZE);
+    int error;
 
-        sectors_written++;
-        written += to_write;
-        data += written;
+    if (!buffer) {
+        print_string("Error: alloc failed writing master record.\n");
+        return -1;
     }
 
+    // Bring the allocation summaries up to date.
+    master_record.fnode_cursor = fnode_bitmap.cursor;
+    master_record.sector_cursor = sector_bitmap.cursor;
+    memcpy((char *) master_record.fnode_region_free, (char *) fnode_bitmap.region_free,
+           sizeof(master_record.fnode_region_free));
+    memcpy((char *) master_record.sector_region_free, (char *) sector_bitmap.region_free,
+           sizeof(master_record.sector_region_free));
+
+    clear_buffer(buffer, SECTOR_SIZE);
+    memcpy((char *) buffer, (char *) &master_record, sizeof(master_record));
+
+    bcache_invalidate(0, 1);
+    error = write_sectors_to_storage_disk(0, 1, buffer);
+    object_free(buffer);
+
     return error;
 }
 
 /**
- * @brief Write an fnode to disk.
- *
- * @param location on-disk location wher the fnode whould be written.
- * @param fnode the fnode to be written.
+ * @brief Write all modified filesystem state (allocation bitmaps and cached
+ * metadata/content sectors) back to disk.
  */
-int save_fnode(struct fnode_location_t *location, struct fnode *fnode) {
-    uint8_t *sector_buffer;
+int fs_sync(void) {
     int error = 0;
 
-    sector_buffer = object_alloc(SECTOR_SIZE);
-    if (!sector_buffer)
-       return -1;
-    clear_buffer(sector_buffer, SECTOR_SIZE);
-
-    if (read_from_storage_disk(location->fnode_sector_index, SECTOR_SIZE, sector_buffer)) {
-        print_string("Failed to read sector where new fnode should be written.\n");
-        error = -1;
-        goto exit_with_alloc;
+    if (fs_ops_pending) {
+        fs_ops_pending = false;
+        error |= journal_end();
+        apply_deferred_frees();
     }
 
-    *((struct fnode*)&sector_buffer[location->offset_within_sector]) = *fnode;
+    error |= flush_usage_bits();
+    error |= journal_checkpoint();
 
-    if (write_to_storage_disk(location->fnode_sector_index, SECTOR_SIZE, sector_buffer)) {
-        print_string("Failed to write sector where new fnode should be written.\n");
-        error = -1;
+    // Everything is on disk, so the bitmaps can be trusted at the next mount.
+    if (!error && master_record.state != FS_STATE_CLEAN) {
+        master_record.state = FS_STATE_CLEAN;
+        error |= write_master_record();
     }
 
-exit_with_alloc:
-    object_free(sector_buffer);
-
     return error;
 }
 
-void unsave_fnode(struct fnode_location_t location) {
-    // TODO.
+/**
+ * @brief Record on disk that the volume is being modified, before the first
+ * change made since it was last synced. If the system goes down before the
+ * next fs_sync, the next mount sees the volume as unclean and rebuilds the
+ * allocation bitmaps from the directory tree.
+ */
+static int fs_mark_dirty(void) {
+    if (master_record.state != FS_STATE_CLEAN)
+        return 0;
+
+    master_record.state = FS_STATE_DIRTY;
+    if (write_master_record()) {
+        print_string("Error: failed to mark filesystem dirty.\n");
+        master_record.state = FS_STATE_CLEAN;
+        return -1;
+    }
+
+    return 0;
 }
 
 /**
- * @brief Extend a directory fnode's content (on-disk) by one dir_entry.
+ * @brief Start a metadata changing operation (create_file, delete_folder,
+ * etc.).
  *
- * @param dir_fnode_location
- * @param dir_fnode
- * @param new_entry
+ * Operations are group committed: the first one after a sync opens a
+ * journal transaction which the following ones join, and their metadata
+ * sectors accumulate (pinned) in the buffer cache. fs_sync() commits and
+ * writes them all back together. It is called when FS_SYNC_INTERVAL_TICKS
+ * have passed (see fs_sync_if_due), when the waiting sectors pin
+ * FS_SYNC_PINNED_BUFFERS buffers, or explicitly (the shell's sync command).
+ * The sectors and fnodes the operations free are only released after the
+ * commit.
  */
-int add_dir_entry(struct fnode_location_t *dir_fnode_location, struct fnode *dir_fnode, struct dir_entry *new_entry) {
-    uint8_t *sector_buffer, *sector_buffer_backup, *dir_info_buffer_backup = NULL;
-    int last_sector_idx, used_in_last_sector, space_in_last_sector;
-    int maybe_new_sector_index, error = 0;
-    struct dir_info *dir_info;
-    bool need_new_sector;
-
-    // Might need to validate this trick but it seems like subtracting 1 here
-    // helps avoid the case where fnode->size is a multiple of SECTOR_SIZE
-    // causing last_sector_idx to be off-by-1 (+1).
-    last_sector_idx = (dir_fnode->size - 1) / SECTOR_SIZE;
-    used_in_last_sector = dir_fnode->size % SECTOR_SIZE ;
-    used_in_last_sector = used_in_last_sector ? used_in_last_sector : SECTOR_SIZE;
-    space_in_last_sector = ((last_sector_idx + 1) * SECTOR_SIZE) - dir_fnode->size;
+static int fs_begin_op(void) {
+    // Commit what is waiting first if this operation might not fit, in the
+    // buffer cache or in the queue of deferred frees.
+    if (fs_ops_pending && (bcache_num_pinned_buffers() >= FS_SYNC_PINNED_BUFFERS ||
+                           num_deferred_frees >= FS_MAX_DEFERRED_FREES / 2) && fs_sync())
+        return -1;
 
-    need_new_sector = space_in_last_sector < sizeof(struct dir_entry);
+    if (fs_mark_dirty())
+        return -1;
 
-    // Allocate space large enough for 2 sectors in case there is not enough
-    // space in the last sector to hold the data being added.
-    sector_buffer = object_alloc(2 * SECTOR_SIZE);
-    if (!sector_buffer) {
-        print_string("Buffer alloc failed while add_dir_entry.\n");
-        error = -1;
-        goto exit;
-    }
-    sector_buffer_backup = object_alloc(2 * SECTOR_SIZE);
-    if (!sector_buffer_backup) {
-        print_string("Buffer alloc for backup failed while add_dir_entry.\n");
-        error = -1;
-        goto exit;
+    if (!fs_ops_pending) {
+        journal_begin();
+        fs_ops_pending = true;
+        fs_pending_since = mark_time();
     }
-    clear_buffer(sector_buffer, 2 * SECTOR_SIZE);
-    clear_buffer(sector_buffer_backup, 2 * SECTOR_SIZE);
 
-    if (read_from_storage_disk(dir_fnode->sector_indexes[last_sector_idx], SECTOR_SIZE, sector_buffer)) {
-        print_string("Failed to read in directory content");
-        error = 1;
-        goto exit_with_alloc;
-    }
-    // Backup the original dir content (i.e. dir_info and dir_entry) in case
-    // we have a failure along the way.
-    memcpy((char *) sector_buffer_backup, (char *) sector_buffer, SECTOR_SIZE);
+    return 0;
+}
 
-    // *((struct dir_entry *)&sector_buffer[used_in_last_sector]) = *new_entry;
-    memcpy((char *) &sector_buffer[used_in_last_sector], (char *) new_entry, sizeof(*new_entry));
+/**
+ * @brief Finish a metadata changing operation, syncing if enough dirty
+ * metadata has accumulated.
+ */
+static int fs_end_op(void) {
+    if (bcache_num_pinned_buffers() >= FS_SYNC_PINNED_BUFFERS)
+        return fs_sync();
 
-    if (need_new_sector && query_free_sectors(1, &maybe_new_sector_index)) {
-        print_string("Error getting new sector, can't add new dir_entry.\n");
-        error = -1;
-        goto exit_with_alloc;
-    }
+    return 0;
+}
 
-    dir_info = (struct dir_info*)sector_buffer;
-    // If we are using fnode->sector_indexes[0], we know that dir_info lives
-    // there so we can update dir_info.num_entries and avoid an additional
-    // disk read/write to update dir_info.
-    if (last_sector_idx == 0)
-        dir_info->num_entries++;
+/**
+ * @brief Sync if the oldest unsynced operation is FS_SYNC_INTERVAL_TICKS
+ * old. Meant to be polled from an idle loop (it does disk I/O, so it cannot
+ * run from the timer interrupt itself).
+ */
+int fs_sync_if_due(void) {
+    if (!fs_ops_pending || mark_time() - fs_pending_since < FS_SYNC_INTERVAL_TICKS)
+        return 0;
 
-    if (write_to_storage_disk(dir_fnode->sector_indexes[last_sector_idx], SECTOR_SIZE, sector_buffer)) {
-        print_string("Failed to update last sector.\n");
-        goto free_sector;
-    } else if (need_new_sector) {
-        if (write_to_storage_disk(maybe_new_sector_index, SECTOR_SIZE, sector_buffer + SECTOR_SIZE)) {
-            print_string("Failed to write new sector.\n");
-            error = -1;
-            goto undo_last_sector_change;
-        } else {
-            dir_fnode->sector_indexes[last_sector_idx + 1] = maybe_new_sector_index;
-        }
-    }
+    return fs_sync();
+}
 
-    if (last_sector_idx == 0)
-        goto size_inc;
+/**
+ * @brief set bits in the (in-memory) fnode bitmap.
+ *
+ * The change reaches the disk on the next flush_usage_bits().
+ */
+void fnode_bitmap_set(uint32_t start_bit, uint64_t num_bits) {
+    bitmap_set_bits(&fnode_bitmap, start_bit, num_bits);
+}
 
-    // The purpose of this read/write to disk is to update the fnode's dir_info
-    // which is the first thing in the fnode's content, i.e. contained in
-    // sector_indexes[0].
-    if (read_from_storage_disk(dir_fnode->sector_indexes[0], SECTOR_SIZE, sector_buffer)) {
-        print_string("Failed to read in directory content's 1st sector.\n");
-        error = -1;
+void fnode_bitmap_unset(uint32_t start_bit, uint64_t num_bits) {
+    bitmap_defer_clear(&fnode_bitmap, start_bit, num_bits);
+}
+
+/**
+ * @brief set bits in the (in-memory) sector bitmap.
+ *
+ * The change reaches the disk on the next flush_usage_bits().
+ */
+void sector_bitmap_set(uint32_t start_bit, uint64_t num_bits) {
+    bitmap_set_bits(&sector_bitmap, start_bit, num_bits);
+}
+
+void sector_bitmap_unset(uint32_t start_bit, uint64_t num_bits) {
+    bitmap_defer_clear(&sector_bitmap, start_bit, num_bits);
+}
+
+/**
+ * @brief The block group an fnode belongs to (by its fnode table index).
+ *
+ * @param id
+ */
+static int fnode_group(fnode_id_t id) {
+    const int group = (id - fnode_bitmap.group_base) / fnode_bitmap.group_bits;
+
+    return group < FS_NUM_GROUPS ? group : FS_NUM_GROUPS - 1;
+}
+
+/**
+ * @brief Make fnode and sector allocations come from block group number
+ * group (where it has room) until the goal is changed again.
+ *
+ * @param group the goal block group, or -1 for none.
+ */
+static void fs_set_alloc_group(int group) {
+    fnode_bitmap.goal = group;
+    sector_bitmap.goal = group;
+}
+
+/**
+ * @brief Choose the block group for a new folder in parent_fnode.
+ *
+ * Folders go in their parent's group like files do, except those created at
+ * the top level, which are spread out over the groups (the one with the most
+ * free fnodes is picked) so that unrelated trees don't compete for the same
+ * group.
+ *
+ * @param parent_fnode
+ */
+static int choose_folder_group(const struct fnode *parent_fnode) {
+    int best = 0;
+
+    if (parent_fnode->id != root_fnode.id)
+        return fnode_group(parent_fnode->id);
+
+    // fnode groups coincide with the fnode bitmap's regions, so region_free
+    // is the number of free fnodes in each group.
+    for (int group = 1; group < FS_NUM_GROUPS; group++) {
+        if (fnode_bitmap.region_free[group] > fnode_bitmap.region_free[best])
+            best = group;
+    }
+
+    return best;
+}
+
+/**
+ * @brief List out the files and folders in the innermost directory
+ * in the given directory_chain.
+ *
+ * @param chain - directory path representation.
+ * @param path
+ */
+int list_dir_content(struct fs_context *ctx, char *path) {
+    struct fnode_location_t tail_dir_fnode_location;
+    struct directory_chain *new_chain = NULL;
+    struct fnode tail_dir_fnode;
+
+    if (path) {
+        new_chain = create_chain_from_path(ctx, path);
+        if (!new_chain) {
+            print_string("Error list_dir_content: create_chain_from_path.\n");
+            return -1;
+        }
+    } else {
+        new_chain = ctx->working_directory_chain;
+    }
+
+    if (validate_directory_chain(new_chain, &tail_dir_fnode, &tail_dir_fnode_location)) {
+        print_string("Error: dir show failed on chain validation.\n");
+        return -1;
+    }
+
+    show_dir_content(&tail_dir_fnode);
+
+    if (path)
+        destroy_directory_chain(new_chain);
+
+    return 0;
+}
+
+/**
+ * @brief Search for a file/folder in the innermost folder of a directory_chain.
+ *
+ * Although the logic seems to apply to both files and folders, the description
+ * is targeted at folders because this function was initially written for the
+ * purpose of handling a change-directory command where we would be looking for
+ * target directory in the chain'd innermost directory.
+ *
+ * @param chain
+ * @param target_dir_name
+ * @param result_fnode
+ */
+int fs_search(struct directory_chain *chain, char* target_dir_name, struct fnode *result_fnode) {
+    struct fnode_location_t tail_dir_fnode_location;
+    struct fnode tail_dir_fnode;
+
+    if (validate_directory_chain(chain, &tail_dir_fnode, &tail_dir_fnode_location)) {
+        print_string("Error: Invalid directory_chain.\n");
+        return -1;
+    }
+
+    if (search_name_in_directory(target_dir_name, &tail_dir_fnode, result_fnode)) {
+        print_string("Error: could not find "); print_string(target_dir_name); print_string(" in chain provided.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Compute the location of the fnode at index in the fnode table.
+ *
+ * @param index
+ * @param location
+ */
+void fnode_location_from_index(uint32_t index, struct fnode_location_t *location) {
+    const int fnodes_per_sector = SECTOR_SIZE / sizeof(struct fnode);
+
+    *location = (struct fnode_location_t) {
+        .fnode_table_index = index,
+        .fnode_sector_index = master_record.fnode_table_start_sector + index / fnodes_per_sector,
+        .offset_within_sector = (index % fnodes_per_sector) * sizeof(struct fnode)
+    };
+}
+
+/** @brief Search for num_fnodes free fnodes.
+ *
+ * This amounts to looking for the num_fnodes unset bits within the (in-memory)
+ * fnode bitmap. The bits found are set before returning.
+ *
+ * @param num_fnodes
+ * @Param fnode_indexes an output array of the indexes of the free fnodes found.
+ */
+int query_free_fnodes(int num_fnodes, struct fnode_location_t *fnode_indexes) {
+    int free_count = 0;
+
+    while (free_count != num_fnodes) {
+        int bit = bitmap_claim_free(&fnode_bitmap);
+
+        if (bit < 0)
+            break;
+
+        fnode_location_from_index(bit, &fnode_indexes[free_count++]);
+    }
+
+    if (free_count == num_fnodes)
+        return 0;
+
+    print_string("Undoing changes to fnode_bitmap.\n");
+    for (int i = 0; i < free_count; i++) {
+        fnode_bitmap_unset(fnode_indexes[i].fnode_table_index, 1);
+        fnode_indexes[i] = (struct fnode_location_t) { 0, 0, 0 };
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Search for unused sectors.
+ *
+ * Find num_sectors unused sectors. This amounts to a (next-fit) search for
+ * num_sectors unset bits in the (in-memory) sector_bitmap. The bits found are
+ * set before returning.
+ *
+ * @param num_sectors
+ * @param sector_indexes output array of indexes of free sectors.
+ */
+int query_free_sectors(int num_sectors, int *sector_indexes) {
+    int free_count = 0;
+
+    while (free_count != num_sectors) {
+        int bit = bitmap_claim_free(&sector_bitmap);
+
+        if (bit < 0)
+            break;
+
+        sector_indexes[free_count++] = bit;
+    }
+
+    if (free_count == num_sectors)
+        return 0;
+
+    print_string("Undoing changes to sector_bitmap.\n");
+    for (int i = 0; i < free_count; i++) {
+        sector_bitmap_unset(sector_indexes[i], 1);
+        sector_indexes[i] = 0;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Find num_sectors free sectors in [start, end) of the sector bitmap
+ * as at most max_extents runs of contiguous sectors, without claiming them.
+ *
+ * A single run long enough for the whole request is preferred. If there is
+ * none, the first free runs found are used, in order. The search is
+ * next-fit: it starts at cursor and wraps around to start.
+ *
+ * @param start
+ * @param end
+ * @param cursor
+ * @param num_sectors
+ * @param extents output array of at least max_extents extents.
+ * @param max_extents
+ * @return the number of extents used, or -1 if there isn't enough (contiguous
+ * enough) free space in the range.
+ */
+static int find_free_extents(uint32_t start, uint32_t end, uint32_t cursor, int num_sectors,
+                             struct fnode_extent *extents, int max_extents) {
+    uint32_t run_start = 0, run_length = 0;
+    int num_runs = 0, collected = 0;
+
+    if (cursor < start || cursor >= end)
+        cursor = start;
+
+    // Search from the cursor to the end of the range, then wrap around.
+    for (int pass = 0; pass < 2 && run_length != num_sectors; pass++) {
+        uint32_t bit = pass ? start : cursor;
+        const uint32_t pass_end = pass ? cursor : end;
+
+        run_length = 0;
+        while (bit < pass_end) {
+            uint32_t limit;
+
+            run_start = bitmap_find_free(&sector_bitmap, bit, pass_end);
+            if (run_start >= pass_end)
+                break;
+
+            limit = (pass_end - run_start < num_sectors) ? pass_end : run_start + num_sectors;
+            bit = bitmap_find_next(&sector_bitmap, run_start, limit, true);
+            run_length = bit - run_start;
+            if (run_length == num_sectors)
+                break;
+
+            // A free run too short for the whole request. Remember it in case
+            // no single run is long enough.
+            if (collected < num_sectors && num_runs < max_extents) {
+                uint32_t take = run_length;
+
+                if (take > num_sectors - collected)
+                    take = num_sectors - collected;
+
+                extents[num_runs++] = (struct fnode_extent) { .start = run_start, .length = take };
+                collected += take;
+            }
+            run_length = 0;
+        }
+    }
+
+    if (run_length == num_sectors) {
+        extents[0] = (struct fnode_extent) { .start = run_start, .length = num_sectors };
+        return 1;
+    }
+
+    return collected < num_sectors ? -1 : num_runs;
+}
+
+/**
+ * @brief Allocate num_sectors free sectors as at most max_extents runs of
+ * contiguous sectors.
+ *
+ * The sector bitmap's goal block group is searched first, if one is set,
+ * and then the whole data region (next-fit from the bitmap's cursor). See
+ * find_free_extents. The sectors allocated are marked used in the sector
+ * bitmap.
+ *
+ * @param num_sectors
+ * @param extents output array of at least max_extents extents.
+ * @param max_extents
+ * @return the number of extents used, or -1 if there isn't enough (contiguous
+ * enough) free space.
+ */
+int query_free_extents(int num_sectors, struct fnode_extent *extents, int max_extents) {
+    const uint32_t sector_total = master_record.sector_bitmap_size * BITS_PER_BYTE;
+    const int goal = sector_bitmap.goal;
+    uint32_t *cursor = &sector_bitmap.cursor;
+    int num_runs = -1;
+
+    if (num_sectors <= 0 || max_extents <= 0)
+        return -1;
+
+    if (goal >= 0) {
+        cursor = &sector_bitmap.group_cursor[goal];
+        num_runs = find_free_extents(bitmap_group_start(&sector_bitmap, goal),
+                                     bitmap_group_end(&sector_bitmap, goal),
+                                     *cursor, num_sectors, extents, max_extents);
+    }
+
+    if (num_runs < 0) {
+        cursor = &sector_bitmap.cursor;
+        num_runs = find_free_extents(sector_bitmap.base, sector_total, bitmap_cursor(&sector_bitmap),
+                                     num_sectors, extents, max_extents);
+        if (num_runs < 0)
+            return -1;
+    }
+
+    for (int i = 0; i < num_runs; i++)
+        sector_bitmap_set(extents[i].start, extents[i].length);
+    *cursor = extents[num_runs - 1].start + extents[num_runs - 1].length;
+
+    return num_runs;
+}
+
+/**
+ * @brief The number of sectors holding an fnode's content.
+ *
+ * @param fnode
+ */
+int fnode_num_sectors(const struct fnode *fnode) {
+    return (fnode->size + SECTOR_SIZE - 1) >> SECTOR_SIZE_SHIFT;
+}
+
+/**
+ * A small cache of indirect blocks, so that walking the content of a large
+ * block-mapped fnode doesn't re-read the same index sector for every content
+ * sector. Entries are replaced round-robin. Updates are written through to
+ * the buffer cache.
+ */
+struct indirect_block {
+    fblock_index_t lba;
+    bool valid;
+    fblock_index_t entries[FNODE_INDEXES_PER_BLOCK];
+};
+
+static struct indirect_block indirect_cache[INDIRECT_CACHE_SIZE];
+static int indirect_cache_next = 0;
+
+static struct indirect_block *__indirect_cache_slot(fblock_index_t lba) {
+    struct indirect_block *block = &indirect_cache[indirect_cache_next];
+
+    indirect_cache_next = (indirect_cache_next + 1) % INDIRECT_CACHE_SIZE;
+    block->lba = lba;
+    block->valid = false;
+
+    return block;
+}
+
+/**
+ * @brief Get the content of an indirect block.
+ *
+ * The returned pointer is only good until the next indirect block is loaded.
+ *
+ * @param lba
+ */
+static struct indirect_block *get_indirect_block(fblock_index_t lba) {
+    struct indirect_block *block;
+
+    for (int i = 0; i < INDIRECT_CACHE_SIZE; i++) {
+        if (indirect_cache[i].valid && indirect_cache[i].lba == lba)
+            return &indirect_cache[i];
+    }
+
+    block = __indirect_cache_slot(lba);
+    if (bcache_read(lba, SECTOR_SIZE, (uint8_t *) block->entries)) {
+        print_string("Failed to read indirect block.\n");
+        return NULL;
+    }
+    block->valid = true;
+
+    return block;
+}
+
+static int set_indirect_entry(fblock_index_t lba, int index, fblock_index_t value) {
+    struct indirect_block *block = get_indirect_block(lba);
+
+    if (!block)
+        return -1;
+
+    block->entries[index] = value;
+
+    return bcache_write(lba, SECTOR_SIZE, (uint8_t *) block->entries);
+}
+
+/**
+ * @brief Allocate and zero a new indirect block.
+ *
+ * @param lba output, the sector allocated.
+ */
+static int new_indirect_block(fblock_index_t *lba) {
+    struct indirect_block *block;
+    int sector;
+
+    if (query_free_sectors(1, &sector))
+        return -1;
+
+    block = __indirect_cache_slot(sector);
+    clear_buffer((uint8_t *) block->entries, SECTOR_SIZE);
+    if (bcache_write(sector, SECTOR_SIZE, (uint8_t *) block->entries)) {
+        sector_bitmap_unset(sector, 1);
+        return -1;
+    }
+    block->valid = true;
+
+    *lba = sector;
+    return 0;
+}
+
+/**
+ * @brief Free an indirect block, forgetting any cached copy of it.
+ */
+static void drop_indirect_block(uint32_t lba, uint64_t num_blocks) {
+    for (int i = 0; i < INDIRECT_CACHE_SIZE; i++) {
+        if (indirect_cache[i].lba == lba)
+            indirect_cache[i].valid = false;
+    }
+
+    sector_bitmap_unset(lba, num_blocks);
+}
+
+/**
+ * @brief Look up the on-disk sector holding sector n of a block-mapped fnode's
+ * content, following indirect blocks as needed.
+ *
+ * @param fnode
+ * @param n
+ * @param lba output.
+ * @return 0 on success, -1 if sector n isn't mapped.
+ */
+int fnode_get_block(const struct fnode *fnode, int n, fblock_index_t *lba) {
+    struct indirect_block *block;
+    fblock_index_t l1;
+
+    if (n < 0)
+        return -1;
+
+    if (n < FNODE_NUM_DIRECT) {
+        *lba = fnode->sector_indexes[n];
+        return 0;
+    }
+    n -= FNODE_NUM_DIRECT;
+
+    if (n < FNODE_INDEXES_PER_BLOCK) {
+        if (!fnode->sector_indexes[FNODE_SINGLE_INDIRECT] ||
+            !(block = get_indirect_block(fnode->sector_indexes[FNODE_SINGLE_INDIRECT])))
+            return -1;
+
+        *lba = block->entries[n];
+        return 0;
+    }
+    n -= FNODE_INDEXES_PER_BLOCK;
+
+    if (n >= FNODE_INDEXES_PER_BLOCK * FNODE_INDEXES_PER_BLOCK ||
+        !fnode->sector_indexes[FNODE_DOUBLE_INDIRECT] ||
+        !(block = get_indirect_block(fnode->sector_indexes[FNODE_DOUBLE_INDIRECT])))
+        return -1;
+
+    l1 = block->entries[n / FNODE_INDEXES_PER_BLOCK];
+    if (!l1 || !(block = get_indirect_block(l1)))
+        return -1;
+
+    *lba = block->entries[n % FNODE_INDEXES_PER_BLOCK];
+    return 0;
+}
+
+/**
+ * @brief Point sector n of a block-mapped fnode's content at lba, allocating
+ * indirect blocks as needed.
+ *
+ * The fnode itself is only modified in memory; the caller saves it.
+ *
+ * @param fnode
+ * @param n
+ * @param lba
+ */
+int fnode_set_block(struct fnode *fnode, int n, fblock_index_t lba) {
+    struct indirect_block *block;
+    fblock_index_t l1;
+
+    if (n < 0)
+        return -1;
+
+    if (n < FNODE_NUM_DIRECT) {
+        fnode->sector_indexes[n] = lba;
+        return 0;
+    }
+    n -= FNODE_NUM_DIRECT;
+
+    if (n < FNODE_INDEXES_PER_BLOCK) {
+        if (!fnode->sector_indexes[FNODE_SINGLE_INDIRECT]) {
+            if (new_indirect_block(&l1))
+                return -1;
+            fnode->sector_indexes[FNODE_SINGLE_INDIRECT] = l1;
+        }
+
+        return set_indirect_entry(fnode->sector_indexes[FNODE_SINGLE_INDIRECT], n, lba);
+    }
+    n -= FNODE_INDEXES_PER_BLOCK;
+
+    if (n >= FNODE_INDEXES_PER_BLOCK * FNODE_INDEXES_PER_BLOCK) {
+        print_string("fnode_set_block: beyond the largest block-mapped fnode.\n");
+        return -1;
+    }
+
+    if (!fnode->sector_indexes[FNODE_DOUBLE_INDIRECT]) {
+        if (new_indirect_block(&l1))
+            return -1;
+        fnode->sector_indexes[FNODE_DOUBLE_INDIRECT] = l1;
+    }
+
+    block = get_indirect_block(fnode->sector_indexes[FNODE_DOUBLE_INDIRECT]);
+    if (!block)
+        return -1;
+
+    l1 = block->entries[n / FNODE_INDEXES_PER_BLOCK];
+    if (!l1) {
+        if (new_indirect_block(&l1))
+            return -1;
+        if (set_indirect_entry(fnode->sector_indexes[FNODE_DOUBLE_INDIRECT], n / FNODE_INDEXES_PER_BLOCK, l1)) {
+            drop_indirect_block(l1, 1);
+            return -1;
+        }
+    }
+
+    return set_indirect_entry(l1, n % FNODE_INDEXES_PER_BLOCK, lba);
+}
+
+/**
+ * @brief Call fn(lba, 1) on each indirect block used by a block-mapped fnode.
+ *
+ * @param fnode
+ * @param fn
+ */
+static void for_each_fnode_index_block(const struct fnode *fnode, void (*fn)(uint32_t, uint64_t)) {
+    const int num_sectors = fnode_num_sectors(fnode);
+    const fblock_index_t single = fnode->sector_indexes[FNODE_SINGLE_INDIRECT];
+    const fblock_index_t dbl = fnode->sector_indexes[FNODE_DOUBLE_INDIRECT];
+
+    if (fnode->flags & FNODE_FLAG_EXTENTS)
+        return;
+
+    if (single && num_sectors > FNODE_NUM_DIRECT)
+        fn(single, 1);
+
+    if (dbl && num_sectors > FNODE_NUM_DIRECT + FNODE_INDEXES_PER_BLOCK) {
+        for (int i = 0; i < FNODE_INDEXES_PER_BLOCK; i++) {
+            struct indirect_block *block = get_indirect_block(dbl);
+
+            if (!block)
+                break;
+            if (block->entries[i])
+                fn(block->entries[i], 1);
+        }
+        fn(dbl, 1);
+    }
+}
+
+/**
+ * @brief Free the content sectors [new_sectors, old_sectors) of a block-mapped
+ * fnode, along with any indirect blocks no longer needed.
+ *
+ * @param fnode
+ * @param old_sectors
+ * @param new_sectors
+ */
+static void fnode_truncate_blocks(struct fnode *fnode, int old_sectors, int new_sectors) {
+    const int double_start = FNODE_NUM_DIRECT + FNODE_INDEXES_PER_BLOCK;
+
+    for (int n = new_sectors; n < old_sectors; n++) {
+        fblock_index_t lba;
+
+        if (!fnode_get_block(fnode, n, &lba) && lba)
+            sector_bitmap_unset(lba, 1);
+    }
+
+    if (old_sectors > FNODE_NUM_DIRECT && new_sectors <= FNODE_NUM_DIRECT &&
+        fnode->sector_indexes[FNODE_SINGLE_INDIRECT]) {
+        drop_indirect_block(fnode->sector_indexes[FNODE_SINGLE_INDIRECT], 1);
+        fnode->sector_indexes[FNODE_SINGLE_INDIRECT] = 0;
+    }
+
+    if (old_sectors > double_start && fnode->sector_indexes[FNODE_DOUBLE_INDIRECT]) {
+        const fblock_index_t dbl = fnode->sector_indexes[FNODE_DOUBLE_INDIRECT];
+        const bool drop_double = new_sectors <= double_start;
+        int first = drop_double ? 0 : (new_sectors - double_start + FNODE_INDEXES_PER_BLOCK - 1) / FNODE_INDEXES_PER_BLOCK;
+
+        for (int i = first; i < FNODE_INDEXES_PER_BLOCK; i++) {
+            struct indirect_block *block = get_indirect_block(dbl);
+            fblock_index_t l1;
+
+            if (!block)
+                break;
+            if (!(l1 = block->entries[i]))
+                continue;
+
+            drop_indirect_block(l1, 1);
+            if (!drop_double)
+                set_indirect_entry(dbl, i, 0);
+        }
+
+        if (drop_double) {
+            drop_indirect_block(dbl, 1);
+            fnode->sector_indexes[FNODE_DOUBLE_INDIRECT] = 0;
+        }
+    }
+}
+
+/**
+ * @brief Allocate count content sectors, one at a time, for a block-mapped
+ * fnode starting at content sector first. Used when the space left is too
+ * fragmented for extents.
+ *
+ * On failure everything allocated here is freed again.
+ *
+ * @param fnode
+ * @param first
+ * @param count
+ */
+static int alloc_fnode_blocks(struct fnode *fnode, int first, int count) {
+    int n;
+
+    for (n = first; n < first + count; n++) {
+        int sector;
+
+        if (query_free_sectors(1, &sector))
+            goto undo;
+
+        if (fnode_set_block(fnode, n, sector)) {
+            sector_bitmap_unset(sector, 1);
+            goto undo;
+        }
+    }
+
+    return 0;
+
+undo:
+    fnode_truncate_blocks(fnode, n, first);
+    return -1;
+}
+
+/**
+ * @brief Map a sector of an fnode's content to its on-disk sector.
+ *
+ * Works for both extent-mapped and block-mapped fnodes.
+ *
+ * @param fnode
+ * @param file_sector index of the sector within the content.
+ * @param lba output, the on-disk sector holding file_sector.
+ * @return the number of sectors from file_sector on that are contiguous on
+ * disk (at least 1), or 0 if file_sector isn't mapped.
+ */
+int fnode_map_run(const struct fnode *fnode, int file_sector, fblock_index_t *lba) {
+    if (fnode->flags & FNODE_FLAG_EXTENTS) {
+        for (int i = 0; i < fnode->num_extents && i < FNODE_MAX_EXTENTS; i++) {
+            const struct fnode_extent *extent = &fnode->extents[i];
+
+            if (file_sector < extent->length) {
+                *lba = extent->start + file_sector;
+                return extent->length - file_sector;
+            }
+            file_sector -= extent->length;
+        }
+
+        return 0;
+    } else {
+        int num_sectors = fnode_num_sectors(fnode), run = 1;
+        fblock_index_t next;
+
+        if (num_sectors > FNODE_MAX_BLOCKS)
+            num_sectors = FNODE_MAX_BLOCKS;
+
+        if (file_sector >= num_sectors || fnode_get_block(fnode, file_sector, lba))
+            return 0;
+
+        while (file_sector + run < num_sectors &&
+               !fnode_get_block(fnode, file_sector + run, &next) &&
+               next == *lba + run)
+            run++;
+
+        return run;
+    }
+}
+
+/**
+ * @brief Call fn(start, length) on each run of contiguous sectors allocated to
+ * an fnode's content.
+ *
+ * For extent-mapped fnodes this is every extent (including any sectors
+ * allocated past size), for block-mapped fnodes the sectors covering size.
+ *
+ * @param fnode
+ * @param fn
+ */
+static void for_each_fnode_run(const struct fnode *fnode, void (*fn)(uint32_t, uint64_t)) {
+    fblock_index_t lba;
+    int sector = 0, run;
+
+    if (fnode->flags & FNODE_FLAG_EXTENTS) {
+        for (int i = 0; i < fnode->num_extents && i < FNODE_MAX_EXTENTS; i++)
+            fn(fnode->extents[i].start, fnode->extents[i].length);
+        return;
+    }
+
+    while ((run = fnode_map_run(fnode, sector, &lba))) {
+        fn(lba, run);
+        sector += run;
+    }
+}
+
+/**
+ * @brief Mark free in the sector bitmap the sectors of an fnode's content,
+ * including any indirect blocks and directory bucket sectors.
+ *
+ * @param fnode
+ */
+static void free_fnode_sectors(const struct fnode *fnode) {
+    for_each_dir_bucket_sector(fnode, sector_bitmap_unset);
+    for_each_fnode_run(fnode, sector_bitmap_unset);
+    for_each_fnode_index_block(fnode, drop_indirect_block);
+}
+
+/**
+ * @brief Write size bytes of content to the sectors mapped by an fnode.
+ *
+ * Each run of contiguous sectors (an extent, or consecutive sector indexes)
+ * is written with a single disk command. The data is passed to the disk as
+ * whole sectors, with the final partial sector (if any) zero-padded in a
+ * separate buffer, so nothing has to be read back from disk first. Cached
+ * copies of the sectors written are dropped.
+ *
+ * @param fnode
+ * @param data
+ * @param size
+ */
+static int write_fnode_content(struct fnode *fnode, uint8_t *data, int size) {
+    const int full_sectors = size >> SECTOR_SIZE_SHIFT;
+    const int rem = size & (SECTOR_SIZE - 1);
+    const int num_sectors = full_sectors + (rem ? 1 : 0);
+    uint8_t *pad_buffer = NULL;
+    int error = 0, i = 0;
+
+    if (rem) {
+        pad_buffer = object_alloc(SECTOR_SIZE);
+        if (!pad_buffer) {
+            print_string("Failed to allocate pad buffer for content write.\n");
+            return -1;
+        }
+        clear_buffer(pad_buffer, SECTOR_SIZE);
+        memcpy((char *) pad_buffer, (char *) data + full_sectors * SECTOR_SIZE, rem);
+    }
+
+    while (i < num_sectors) {
+        struct disk_sg_entry sg[2];
+        int run, sg_count = 0, run_full;
+        fblock_index_t lba;
+
+        run = fnode_map_run(fnode, i, &lba);
+        if (!run) {
+            print_string("Content write past the sectors allocated to fnode.\n");
+            error = -1;
+            break;
+        }
+        if (run > num_sectors - i)
+            run = num_sectors - i;
+
+        run_full = (i + run > full_sectors) ? full_sectors - i : run;
+        if (run_full > 0)
+            sg[sg_count++] = (struct disk_sg_entry) {
+                .buffer = data + i * SECTOR_SIZE,
+                .n_sectors = run_full,
+            };
+        if (run_full < run)
+            sg[sg_count++] = (struct disk_sg_entry) {
+                .buffer = pad_buffer,
+                .n_sectors = 1,
+            };
+
+        bcache_invalidate(lba, run);
+        if (write_sg_to_storage_disk(lba, sg, sg_count)) {
+            print_string("Failed to write file content to disk.\n");
+            error = -1;
+            break;
+        }
+
+        i += run;
+    }
+
+    if (pad_buffer)
+        object_free(pad_buffer);
+
+    return error;
+}
+
+/**
+ * @brief Save the contents of the firl described by file_info to disk.
+ *
+ * @param fnode fnode of the file to be saved to disk.
+ * @param file_info
+ */
+int save_file(struct fnode *fnode, struct file_creation_info *file_info) {
+    return write_fnode_content(fnode, file_info->file_content, file_info->file_size);
+}
+
+/**
+ * @brief Save the content of the folder described by fnode to disk.
+ *
+ * @param fnode
+ * @param folder_info
+ */
+int save_folder(struct fnode *fnode, struct folder_creation_info *folder_info) {
+    return write_fnode_content(fnode, folder_info->data, folder_info->size);
+}
+
+/**
+ * @brief Write an fnode to disk.
+ *
+ * @param location on-disk location wher the fnode whould be written.
+ * @param fnode the fnode to be written.
+ */
+int save_fnode(struct fnode_location_t *location, struct fnode *fnode) {
+    uint8_t *sector_buffer;
+    int error = 0;
+
+    sector_buffer = object_alloc(SECTOR_SIZE);
+    if (!sector_buffer)
+       return -1;
+    clear_buffer(sector_buffer, SECTOR_SIZE);
+
+    if (bcache_read(location->fnode_sector_index, SECTOR_SIZE, sector_buffer)) {
+        print_string("Failed to read sector where new fnode should be written.\n");
+        error = -1;
+        goto exit_with_alloc;
+    }
+
+    *((struct fnode*)&sector_buffer[location->offset_within_sector]) = *fnode;
+
+    if (bcache_write(location->fnode_sector_index, SECTOR_SIZE, sector_buffer)) {
+        print_string("Failed to write sector where new fnode should be written.\n");
+        error = -1;
+    }
+
+exit_with_alloc:
+    object_free(sector_buffer);
+
+    return error;
+}
+
+/**
+ * @brief Clear the on-disk copy of an fnode which is being given up (the
+ * caller frees its fnode bitmap bit).
+ *
+ * @param location
+ */
+void unsave_fnode(struct fnode_location_t location) {
+    struct fnode empty;
+
+    clear_buffer((uint8_t *) &empty, sizeof(empty));
+    if (save_fnode(&location, &empty))
+        print_string("Error: unsave_fnode: save_fnode failed.\n");
+}
+
+/**
+ * @brief Rebuild a hashed directory's table over num_bucket_sectors bucket
+ * sectors, allocating any extra sectors needed. Rebuilding also drops the
+ * DIR_SLOT_DELETED slots left behind by removals.
+ *
+ * @param dir_fnode
+ * @param hdr updated (in memory and on disk) to describe the new table.
+ * @param num_bucket_sectors
+ */
+static int dir_hash_rebuild(const struct fnode *dir_fnode, struct dir_info_hashed *hdr, int num_bucket_sectors) {
+    const int old_bucket_sectors = hdr->num_bucket_sectors;
+    int new_sectors[DIR_MAX_BUCKET_SECTORS];
+    int num_slots;
+
+    if (num_bucket_sectors > old_bucket_sectors &&
+        query_free_sectors(num_bucket_sectors - old_bucket_sectors, new_sectors)) {
+        print_string("Error: no space to grow directory hash table.\n");
+        return -1;
+    }
+
+    for (int i = old_bucket_sectors; i < num_bucket_sectors; i++)
+        hdr->bucket_sectors[i] = new_sectors[i - old_bucket_sectors];
+    hdr->num_bucket_sectors = num_bucket_sectors;
+    num_slots = num_bucket_sectors * DIR_SLOTS_PER_SECTOR;
+
+    for (int i = 0; i < num_bucket_sectors; i++) {
+        if (clear_dir_bucket_sector(hdr->bucket_sectors[i]))
+            goto error;
+    }
+
+    for (int i = 0; i < hdr->info.num_entries; i++) {
+        struct dir_hash_slot slots[DIR_SLOTS_PER_SECTOR];
+        struct dir_entry entry;
+        int slot, loaded = -1, probes = 0;
+        uint32_t hash;
+
+        if (dir_entry_io(dir_fnode, i, &entry, false))
+            goto error;
+
+        hash = dir_name_hash(entry.name);
+        slot = hash % num_slots;
+        for (;;) {
+            if (probes++ == num_slots)
+                goto error;
+            if (slot / DIR_SLOTS_PER_SECTOR != loaded) {
+                loaded = slot / DIR_SLOTS_PER_SECTOR;
+                if (bcache_read(hdr->bucket_sectors[loaded], SECTOR_SIZE, slots))
+                    goto error;
+            }
+            if (slots[slot % DIR_SLOTS_PER_SECTOR].entry == DIR_SLOT_EMPTY)
+                break;
+            slot = (slot + 1) % num_slots;
+        }
+
+        if (dir_hash_set_slot(hdr, slot, hash, i + 1))
+            goto error;
+    }
+
+    return put_dir_hash_header(dir_fnode, hdr);
+
+error:
+    print_string("Error: failed rebuilding directory hash table.\n");
+    return -1;
+}
+
+/**
+ * @brief Add a slot for a new dir_entry named name to a hashed directory's
+ * table. The entry is expected to be appended at index num_entries.
+ *
+ * The table is grown (up to DIR_MAX_BUCKET_SECTORS) once it is 3/4 full.
+ *
+ * @param dir_fnode
+ * @param name
+ * @return the slot used, or -1 on error.
+ */
+static int dir_hash_insert(const struct fnode *dir_fnode, const char *name) {
+    struct dir_hash_slot slots[DIR_SLOTS_PER_SECTOR];
+    const uint32_t hash = dir_name_hash(name);
+    struct dir_info_hashed hdr;
+    int num_slots, slot, loaded = -1;
+
+    if (get_dir_hash_header(dir_fnode, &hdr)) {
+        print_string("Error: failed to read hashed dir_info.\n");
+        return -1;
+    }
+
+    num_slots = hdr.num_bucket_sectors * DIR_SLOTS_PER_SECTOR;
+    if ((hdr.info.num_entries + 1) * 4 > num_slots * 3 &&
+        hdr.num_bucket_sectors < DIR_MAX_BUCKET_SECTORS) {
+        int grow_to = hdr.num_bucket_sectors * 2;
+
+        if (grow_to > DIR_MAX_BUCKET_SECTORS)
+            grow_to = DIR_MAX_BUCKET_SECTORS;
+        if (grow_to && dir_hash_rebuild(dir_fnode, &hdr, grow_to))
+            return -1;
+        num_slots = hdr.num_bucket_sectors * DIR_SLOTS_PER_SECTOR;
+    }
+
+    if (!num_slots)
+        return -1;
+
+    slot = hash % num_slots;
+    for (int probes = 0; probes < num_slots; probes++, slot = (slot + 1) % num_slots) {
+        uint32_t entry;
+
+        if (slot / DIR_SLOTS_PER_SECTOR != loaded) {
+            loaded = slot / DIR_SLOTS_PER_SECTOR;
+            if (bcache_read(hdr.bucket_sectors[loaded], SECTOR_SIZE, slots))
+                return -1;
+        }
+
+        entry = slots[slot % DIR_SLOTS_PER_SECTOR].entry;
+        if (entry != DIR_SLOT_EMPTY && entry != DIR_SLOT_DELETED)
+            continue;
+
+        if (dir_hash_set_slot(&hdr, slot, hash, hdr.info.num_entries + 1))
+            return -1;
+        return slot;
+    }
+
+    print_string("Error: directory hash table is full.\n");
+    return -1;
+}
+
+/**
+ * @brief Undo a dir_hash_insert.
+ *
+ * @param dir_fnode
+ * @param slot
+ */
+static void dir_hash_uninsert(const struct fnode *dir_fnode, int slot) {
+    struct dir_info_hashed hdr;
+
+    if (!get_dir_hash_header(dir_fnode, &hdr))
+        dir_hash_set_slot(&hdr, slot, 0, DIR_SLOT_DELETED);
+}
+
+/**
+ * @brief Extend a directory fnode's content (on-disk) by one dir_entry.
+ *
+ * @param dir_fnode_location
+ * @param dir_fnode
+ * @param new_entry
+ */
+int add_dir_entry(struct fnode_location_t *dir_fnode_location, struct fnode *dir_fnode, struct dir_entry *new_entry) {
+    uint8_t *sector_buffer, *sector_buffer_backup, *dir_info_buffer_backup = NULL;
+    int last_sector_idx, used_in_last_sector, space_in_last_sector;
+    int maybe_new_sector_index, error = 0;
+    fblock_index_t last_sector_lba;
+    struct dir_info *dir_info;
+    int hash_slot = -1;
+    bool need_new_sector;
+
+    // Might need to validate this trick but it seems like subtracting 1 here
+    // helps avoid the case where fnode->size is a multiple of SECTOR_SIZE
+    // causing last_sector_idx to be off-by-1 (+1).
+    last_sector_idx = (dir_fnode->size - 1) / SECTOR_SIZE;
+    used_in_last_sector = dir_fnode->size % SECTOR_SIZE ;
+    used_in_last_sector = used_in_last_sector ? used_in_last_sector : SECTOR_SIZE;
+    space_in_last_sector = ((last_sector_idx + 1) * SECTOR_SIZE) - dir_fnode->size;
+
+    need_new_sector = space_in_last_sector < sizeof(struct dir_entry);
+
+    dcache_invalidate(dir_fnode->id, new_entry->name);
+
+    // Index the new entry first, so that a failure here leaves the directory
+    // untouched. The slot is released again if appending the entry fails.
+    if (dir_fnode->flags & FNODE_FLAG_HASHED_DIR) {
+        hash_slot = dir_hash_insert(dir_fnode, new_entry->name);
+        if (hash_slot < 0) {
+            print_string("Failed to index new dir_entry.\n");
+            error = -1;
+            goto exit;
+        }
+    }
+
+    if (fnode_get_block(dir_fnode, last_sector_idx, &last_sector_lba)) {
+        print_string("Failed to find directory's last sector.\n");
+        error = -1;
+        goto exit;
+    }
+
+    // Allocate space large enough for 2 sectors in case there is not enough
+    // space in the last sector to hold the data being added.
+    sector_buffer = object_alloc(2 * SECTOR_SIZE);
+    if (!sector_buffer) {
+        print_string("Buffer alloc failed while add_dir_entry.\n");
+        error = -1;
+        goto exit;
+    }
+    sector_buffer_backup = object_alloc(2 * SECTOR_SIZE);
+    if (!sector_buffer_backup) {
+        print_string("Buffer alloc for backup failed while add_dir_entry.\n");
+        error = -1;
+        goto exit;
+    }
+    clear_buffer(sector_buffer, 2 * SECTOR_SIZE);
+    clear_buffer(sector_buffer_backup, 2 * SECTOR_SIZE);
+
+    if (bcache_read(last_sector_lba, SECTOR_SIZE, sector_buffer)) {
+        print_string("Failed to read in directory content");
+        error = 1;
+        goto exit_with_alloc;
+    }
+    // Backup the original dir content (i.e. dir_info and dir_entry) in case
+    // we have a failure along the way.
+    memcpy((char *) sector_buffer_backup, (char *) sector_buffer, SECTOR_SIZE);
+
+    // *((struct dir_entry *)&sector_buffer[used_in_last_sector]) = *new_entry;
+    memcpy((char *) &sector_buffer[used_in_last_sector], (char *) new_entry, sizeof(*new_entry));
+
+    if (need_new_sector && query_free_sectors(1, &maybe_new_sector_index)) {
+        print_string("Error getting new sector, can't add new dir_entry.\n");
+        error = -1;
+        goto exit_with_alloc;
+    }
+
+    dir_info = (struct dir_info*)sector_buffer;
+    // If we are using fnode->sector_indexes[0], we know that dir_info lives
+    // there so we can update dir_info.num_entries and avoid an additional
+    // disk read/write to update dir_info.
+    if (last_sector_idx == 0)
+        dir_info->num_entries++;
+
+    if (bcache_write(last_sector_lba, SECTOR_SIZE, sector_buffer)) {
+        print_string("Failed to update last sector.\n");
+        error = -1;
+        goto free_sector;
+    } else if (need_new_sector) {
+        if (bcache_write(maybe_new_sector_index, SECTOR_SIZE, sector_buffer + SECTOR_SIZE)) {
+            print_string("Failed to write new sector.\n");
+            error = -1;
+            goto undo_last_sector_change;
+        } else if (fnode_set_block(dir_fnode, last_sector_idx + 1, maybe_new_sector_index)) {
+            print_string("Failed to map new sector.\n");
+            error = -1;
+            goto undo_last_sector_change;
+        }
+    }
+
+    if (last_sector_idx == 0)
+        goto size_inc;
+
+    // The purpose of this read/write to disk is to update the fnode's dir_info
+    // which is the first thing in the fnode's content, i.e. contained in
+    // sector_indexes[0].
+    if (bcache_read(dir_fnode->sector_indexes[0], SECTOR_SIZE, sector_buffer)) {
+        print_string("Failed to read in directory content's 1st sector.\n");
+        error = -1;
+        goto undo_new_sector_change;
+    }
+
+    // Keep a backup of the dir_info sector in case we have to abandon the change(s).
+    dir_info_buffer_backup = object_alloc(SECTOR_SIZE);
+    memcpy((char *) dir_info_buffer_backup, (char *) sector_buffer, SECTOR_SIZE);
+
+    dir_info->num_entries++;
+    if (bcache_write(dir_fnode->sector_indexes[0], SECTOR_SIZE, sector_buffer)) {
+        print_string("Failed to update dir_info sector.\n");
+        error = -1;
         goto undo_new_sector_change;
     }
 
-    // Keep a backup of the dir_info sector in case we have to abandon the change(s).
-    dir_info_buffer_backup = object_alloc(SECTOR_SIZE);
-    memcpy((char *) dir_info_buffer_backup, (char *) sector_buffer, SECTOR_SIZE);
+size_inc:
+    dir_fnode->size += sizeof(struct dir_entry);
+    if (save_fnode(dir_fnode_location, dir_fnode)) {
+        if (last_sector_idx == 0)
+            goto undo_new_sector_change;
+        goto undo_dir_info_sector_change;
+    }
+
+    goto exit_with_alloc;
+
+undo_dir_info_sector_change:
+    dir_fnode->size -= sizeof(struct dir_entry);
+    bcache_write(dir_fnode->sector_indexes[0], SECTOR_SIZE, dir_info_buffer_backup);
+
+undo_new_sector_change:
+    // When undoing the change to a new sector, we don't need to bother about
+    // a write we may have done to the new sector. We only need to mark
+    // the sector as free again, which we'll do in free_sector.
+    if (need_new_sector)
+        fnode_truncate_blocks(dir_fnode, last_sector_idx + 2, last_sector_idx + 1);
+
+undo_last_sector_change:
+    bcache_write(last_sector_lba, SECTOR_SIZE, sector_buffer_backup);
+
+free_sector:
+    if (need_new_sector)
+        sector_bitmap_unset(maybe_new_sector_index, 1);
+
+exit_with_alloc:
+    object_free(sector_buffer);
+    object_free(sector_buffer_backup);
+    if (dir_info_buffer_backup)
+        object_free(dir_info_buffer_backup);
+
+exit:
+    if (error && hash_slot >= 0)
+        dir_hash_uninsert(dir_fnode, hash_slot);
+    return error;
+}
+
+/**
+ * @brief Remove a directory entry from a hashed directory.
+ *
+ * Rather than shifting every later entry down, the last entry is moved into
+ * the hole, so only the sectors holding those two entries, the dir_info and
+ * the affected bucket sectors are written.
+ *
+ * @param dir_fnode
+ * @param name
+ */
+static int remove_hashed_dir_entry(struct fnode *dir_fnode, char *name) {
+    struct fnode_location_t dir_fnode_location;
+    int num_sectors_new, num_sectors_old;
+    int index, slot, last, last_slot;
+    struct dir_info_hashed hdr;
+    struct dir_entry last_entry;
+    int new_size;
+
+    if (get_fnode_location(dir_fnode->id, &dir_fnode_location)) {
+        print_string("Error removing dir_entry: get_fnode_location failed.\n");
+        return -1;
+    }
+
+    if (get_dir_hash_header(dir_fnode, &hdr)) {
+        print_string("Error removing dir_entry: failed to read dir_info.\n");
+        return -1;
+    }
+
+    index = dir_hash_probe(dir_fnode, &hdr, name, -1, NULL, &slot);
+    if (index < 0) {
+        print_string("Error removing entry: couldn't find name.\n");
+        return -1;
+    }
+
+    last = hdr.info.num_entries - 1;
+    if (index != last) {
+        if (dir_entry_io(dir_fnode, last, &last_entry, false) ||
+            dir_hash_probe(dir_fnode, &hdr, last_entry.name, last, NULL, &last_slot) < 0) {
+            print_string("Error removing entry: couldn't find last entry.\n");
+            return -1;
+        }
+
+        if (dir_entry_io(dir_fnode, index, &last_entry, true) ||
+            dir_hash_set_slot(&hdr, last_slot, dir_name_hash(last_entry.name), index + 1)) {
+            print_string("Error removing entry: failed to move last entry.\n");
+            return -1;
+        }
+    }
+
+    if (dir_hash_set_slot(&hdr, slot, 0, DIR_SLOT_DELETED)) {
+        print_string("Error removing entry: failed to update bucket.\n");
+        return -1;
+    }
+
+    hdr.info.num_entries--;
+    if (put_dir_hash_header(dir_fnode, &hdr)) {
+        print_string("Error removing entry: failed to update dir_info.\n");
+        return -1;
+    }
+
+    new_size = dir_fnode->size - sizeof(struct dir_entry);
+    num_sectors_old = (dir_fnode->size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    num_sectors_new = (new_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (num_sectors_old != num_sectors_new)
+        fnode_truncate_blocks(dir_fnode, num_sectors_old, num_sectors_new);
+
+    dir_fnode->size = new_size;
+    if (save_fnode(&dir_fnode_location, dir_fnode)) {
+        print_string("Error: remove_dir_entry: save_fnode.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Remove a directory entry from a directory's content
+ *
+ * @param dir_fnode
+ * @param name
+ */
+int remove_dir_entry(struct fnode *dir_fnode, char *name) {
+    struct fnode_location_t dir_fnode_location;
+    int num_sectors_new, num_sectors_old, diff;
+    const int name_len = strlen(name);
+    struct dir_entry *dir_entry;
+    struct dir_info *dir_info;
+    int num_entries_to_shift;
+    int error = 0, i;
+    uint8_t *buffer;
+
+    dcache_invalidate(dir_fnode->id, name);
+
+    if (dir_fnode->flags & FNODE_FLAG_HASHED_DIR)
+        return remove_hashed_dir_entry(dir_fnode, name);
+
+    buffer = object_alloc(dir_fnode->size);
+    if (!buffer) {
+        print_string("Error: object alloc failed in remove_dir_entry.\n");
+        error = -1;
+        goto return_error;
+    }
+
+    if (get_fnode_location(dir_fnode->id, &dir_fnode_location)) {
+        print_string("Error removing dir_entry: get_fnode_location failed.\n");
+        error = -1;
+        goto free_buffer;
+    }
+
+    if (read_dir_content(dir_fnode, buffer) < 0) {
+        print_string("Error removing dir_entry: failed read_dir_content.\n");
+        error = -1;
+        goto free_buffer;
+    }
+
+    dir_info = (struct dir_info*) buffer;
+    dir_entry = dir_first_entry(dir_fnode, buffer);
+
+    for (i = 0; i < dir_info->num_entries; i++, dir_entry++) {
+        const int entry_name_len = strlen(dir_entry->name);
+
+        if (entry_name_len == name_len &&
+            strmatchn(name, dir_entry->name, name_len))
+            break;
+    }
+
+    if (i == dir_info->num_entries) {
+        print_string("Error removing entry: couldn't find name.\n");
+        error = -1;
+        goto free_buffer;
+    }
+
+    num_entries_to_shift = dir_info->num_entries - (i + 1);
+    while (num_entries_to_shift--) {
+        // *dir_entry = *(dir_entry + 1);
+        memcpy((char *) dir_entry, (char *) (dir_entry + 1), sizeof(*dir_entry));
+        dir_entry++;
+    }
 
-    dir_info->num_entries++;
-    if (write_to_storage_disk(dir_fnode->sector_indexes[0], SECTOR_SIZE, sector_buffer)) {
-        print_string("Failed to update dir_info sector.\n");
+    dir_info->num_entries--;
+
+    const int new_size = (uint8_t *) dir_entry - (uint8_t *) dir_info;
+    if (overwrite_dir_content(dir_fnode, buffer, new_size)) {
+        print_string("Error adding dir_entry: overwrite_dir_content failed.\n");
         error = -1;
-        goto undo_new_sector_change;
+        goto free_buffer;
     }
 
-size_inc:
-    dir_fnode->size += sizeof(struct dir_entry);
-    if (save_fnode(dir_fnode_location, dir_fnode)) {
-        if (last_sector_idx == 0)
-            goto undo_new_sector_change;
-        goto undo_dir_info_sector_change;
+    num_sectors_old = (dir_fnode->size / SECTOR_SIZE) +
+                      ((dir_fnode->size % SECTOR_SIZE) ? 1 : 0);
+    num_sectors_new = (new_size / SECTOR_SIZE) +
+                      ((new_size % SECTOR_SIZE) ? 1 : 0);
+
+    if ((diff = num_sectors_old - num_sectors_new))
+        fnode_truncate_blocks(dir_fnode, num_sectors_old, num_sectors_new);
+
+    dir_fnode->size = new_size;
+    if (save_fnode(&dir_fnode_location, dir_fnode)) {
+        print_string("Error: remove_dir_entry: save_fnode.\n");
+        error = -1;
     }
 
-    goto exit_with_alloc;
+free_buffer:
+    object_free(buffer);
 
-undo_dir_info_sector_change:
-    dir_fnode->size -= sizeof(struct dir_entry);
-    write_to_storage_disk(dir_fnode->sector_indexes[0], SECTOR_SIZE, dir_info_buffer_backup);
+return_error:
+    return error;
+}
 
-undo_new_sector_change:
-    // When undoing the change to a new sector, we don't need to bother about
-    // a write we may have done to the new sector. We only need to mark
-    // the sector as free again, which we'll do in free_sector.
-    dir_fnode->sector_indexes[last_sector_idx + 1] = 0;
+char *extract_filename_from_path(char *path) {
+    int path_len = strlen(path);
+    int i;
 
-undo_last_sector_change:
-    write_to_storage_disk(dir_fnode->sector_indexes[last_sector_idx], SECTOR_SIZE, sector_buffer_backup);
+    if (path_len <= 0)
+        return NULL;
 
-free_sector:
-    sector_bitmap_unset(maybe_new_sector_index, 1);
+    i = path_len - 1;
+
+    if (path[i] == '/') {
+        print_string("Error: filenames should not end with '/'.\n");
+        return NULL;
+    }
+
+    // Skip past non '/'s.
+    while(i && path[i] != '/')
+        i--;
+
+    if (path[i] == '/')
+        i++;
+
+    return &path[i];
+}
+
+/**
+ * @brief Create a new file within the innermost directory of the directory chain
+ * of the supplied filesystem context.
+ *
+ * @param ctx
+ * @param file_info
+ */
+int create_file(struct fs_context *ctx, struct file_creation_info *file_info) {
+    struct fnode_location_t parent_fnode_location, new_fnode_location;
+    int sz = file_info->file_size, sz_sectors = 1;
+    struct fnode_extent extents[FNODE_MAX_EXTENTS];
+    struct fnode parent_fnode, new_fnode;
+    struct dir_entry new_dir_entry;
+    struct directory_chain *chain;
+    int num_extents = 0;
+    char *filename;
+    int time, err;
+
+    while ((sz_sectors << SECTOR_SIZE_SHIFT) < sz)
+        sz_sectors++;
+
+    if (sz_sectors > MAX_FILE_CHUNKS)
+        return -1; // Unsupported file size.
+
+    filename = extract_filename_from_path(file_info->path);
+    if (!filename) {
+        print_string("Error create_file: extract_filename_from_path.\n");
+        return -1;
+    }
+
+    if (filename != file_info->path) {
+        char c = *(filename -1);
+
+        *(filename - 1) = '\0';
+        chain = create_chain_from_path(ctx, file_info->path);
+        *(filename - 1) = c;
+    } else {
+        chain = ctx->working_directory_chain;
+    }
+
+    if (!chain) {
+        print_string("Error create_file: create_chain_from_path");
+        return -1;
+    }
+
+    // We get the parent_fnode (and location) by this validation process. It
+    // is needed up front to place the new file in its parent's block group.
+    if (validate_directory_chain(chain, &parent_fnode, &parent_fnode_location)) {
+        print_string("Error creating file: failed chain validation.\n");
+        goto destroy_chain;
+    }
+
+    if (fs_begin_op())
+        goto destroy_chain;
+
+    // Not really necesary, but just to avoid saving garbage from the stack.
+    clear_buffer((uint8_t *) &new_fnode, sizeof(struct fnode));
+    clear_buffer((uint8_t *) &new_dir_entry, sizeof(struct dir_entry));
+    clear_buffer((uint8_t *) &new_fnode_location, sizeof(struct fnode_location_t));
+
+    new_fnode.size = sz;
+    new_fnode.type = FILE;
+
+    fs_set_alloc_group(fnode_group(parent_fnode.id));
+
+    time_op(query_free_extents(sz_sectors, extents, FNODE_MAX_EXTENTS), time, num_extents);
+    print_string("query_free_extents took "); print_int32(time); print_string(" ticks.\n");
+    if (num_extents >= 0) {
+        new_fnode.flags = FNODE_FLAG_EXTENTS;
+        new_fnode.num_extents = num_extents;
+        for (int i = 0; i < num_extents; i++)
+            new_fnode.extents[i] = extents[i];
+    } else if (alloc_fnode_blocks(&new_fnode, 0, sz_sectors)) {
+        // Free space is too fragmented for extents, and there isn't enough of
+        // it even one sector at a time.
+        print_string("Error create_file: not enough disk space.\n");
+        goto end_transaction;
+    }
+
+    time_op(query_free_fnodes(1, &new_fnode_location), time, err);
+    print_string("query_free_fnodes took "); print_int32(time); print_string(" ticks.\n");
+    if (err)
+        goto free_sectors; // Not enough fnodes.
+
+    new_fnode.id = new_fnode_location.fnode_table_index;
+
+    if (save_fnode(&new_fnode_location, &new_fnode))
+        goto free_fnode;
+
+    if (save_file(&new_fnode, file_info))
+        goto unsave_new_fnode;
+
+    memcpy(new_dir_entry.name, (char *)filename, strlen(filename));
+    new_dir_entry.size = sz; // Unnecessary as size field is obsolete but leave for now.
+    new_dir_entry.type = FILE;
+    new_dir_entry.fnode_location = new_fnode_location;
+    new_dir_entry.id = new_fnode.id;
+
+    if (add_dir_entry(&parent_fnode_location, &parent_fnode, &new_dir_entry))
+        goto unsave_new_fnode;
+
+    fs_set_alloc_group(-1);
+    if (chain != ctx->working_directory_chain)
+        destroy_directory_chain(chain);
+
+    return fs_end_op();
+
+unsave_new_fnode:
+    unsave_fnode(new_fnode_location);
+
+free_fnode:
+    fnode_bitmap_unset(new_fnode_location.fnode_table_index, 1);
+
+free_sectors:
+    free_fnode_sectors(&new_fnode);
+
+end_transaction:
+    fs_set_alloc_group(-1);
+    fs_end_op();
+
+destroy_chain:
+    if (chain != ctx->working_directory_chain)
+        destroy_directory_chain(chain);
+
+    return -1;
+}
+
+int __delete_file(struct directory_chain *chain, char *deletion_target_name) {
+    struct fnode_location_t enclosing_fnode_location, file_fnode_location;
+    struct fnode enclosing_fnode, file_fnode;
+
+    if (validate_directory_chain(chain,
+                                 &enclosing_fnode,
+                                 &enclosing_fnode_location)) {
+        print_string("Error deleting file: couldn't validate chain.\n");
+        return -1;
+    }
+
+    // Verify that target file is present in working directory.
+    if (search_name_in_directory(deletion_target_name, &enclosing_fnode, &file_fnode)) {
+        print_string("Error deleting file: couldn't find file in wd.\n");
+        return -1;
+    }
+
+    // Free the sectors occupied by the file.
+    free_fnode_sectors(&file_fnode);
+
+    // Free the fnode used by the file.
+    if (get_fnode_location(file_fnode.id, &file_fnode_location)) {
+        print_string("Error during delete: failed getting fnode location.\n");
+        return -1;
+    }
+
+    fnode_bitmap_unset(file_fnode_location.fnode_table_index, 1);
+
+    remove_dir_entry(&enclosing_fnode, deletion_target_name);
+
+    return 0;
+}
+
+/**
+ * @brief Delete a file from the current directory of an fs_context.
+ *
+ * @param ctx
+ * @param folder_info
+ */
+int delete_file(struct fs_context *ctx, char *path) {
+    char deletion_target_name[MAX_FILENAME_LENGTH];
+    struct directory_chain *chain;
+    int path_len = strlen(path);
+    int i, j, error = 0;
+    char c;
+
+    if (path_len <= 0)
+        return -1;
+
+    i = path_len - 1;
+
+    if (path[i] == '/') {
+        print_string("Error: filenames should not end with (or have) '/'\n");
+        return -1;
+    }
+
+    // Skip past non '/'s.
+    j = i;
+    while (i && path[i] != '/')
+        i--;
+
+    if (path[i] == '/')
+        i++;
+
+    clear_buffer((uint8_t *) deletion_target_name, MAX_FILENAME_LENGTH);
+
+    memcpy(deletion_target_name, &path[i], j - i + 1);
+
+    // Mark end of enclosing path so it can be used to create a chain.
+    c = path[i];
+    path[i] = '\0';
+
+    if (fs_begin_op()) {
+        path[i] = c;
+        return -1;
+    }
+
+    chain = create_chain_from_path(ctx, path);
+    if (!chain) {
+        print_string("Error: delete_file: create_chain_from_path.\n");
+        error = -1;
+    }
+    path[i] = c;
+
+    if (!error && __delete_file(chain, deletion_target_name)) {
+        print_string("Error: delete_file: __delete_file.\n");
+        error = -1;
+    }
+
+    if (chain)
+        destroy_directory_chain(chain);
 
-exit_with_alloc:
-    object_free(sector_buffer);
-    object_free(sector_buffer_backup);
-    if (dir_info_buffer_backup)
-        object_free(dir_info_buffer_backup);
+    if (fs_end_op())
+        error = -1;
 
-exit:
     return error;
 }
 
 /**
- * @brief Remove a directory entry from a directory's content
+ * @brief The number of sectors allocated to an fnode. For extent-mapped
+ * fnodes this can be more than the size calls for.
  *
- * @param dir_fnode
- * @param name
+ * @param fnode
  */
-int remove_dir_entry(struct fnode *dir_fnode, char *name) {
-    uint8_t *buffer = object_alloc(dir_fnode->size);
-    struct fnode_location_t dir_fnode_location;
-    int num_sectors_new, num_sectors_old, diff;
-    const int name_len = strlen(name);
-    struct dir_entry *dir_entry;
-    struct dir_info *dir_info;
-    int num_entries_to_shift;
-    int error = 0, i;
+static int fnode_allocated_sectors(const struct fnode *fnode) {
+    int sectors = 0;
 
-    if (!buffer) {
-        print_string("Error: object alloc failed in remove_dir_entry.\n");
-        error = -1;
-        goto return_error;
-    }
+    if (!(fnode->flags & FNODE_FLAG_EXTENTS))
+        return fnode_num_sectors(fnode);
 
-    if (get_fnode_location(dir_fnode->id, &dir_fnode_location)) {
-        print_string("Error removing dir_entry: get_fnode_location failed.\n");
-        error = -1;
-        goto free_buffer;
-    }
+    for (int i = 0; i < fnode->num_extents && i < FNODE_MAX_EXTENTS; i++)
+        sectors += fnode->extents[i].length;
 
-    if (read_dir_content(dir_fnode, buffer) < 0) {
-        print_string("Error removing dir_entry: failed read_dir_content.\n");
-        error = -1;
-        goto free_buffer;
-    }
+    return sectors;
+}
 
-    dir_info = (struct dir_info*) buffer;
-    dir_entry = (struct dir_entry*) (dir_info + 1);
+/**
+ * @brief Convert an extent-mapped fnode to block mapping, pointing its first
+ * num_sectors content sectors at the sectors of its extents (allocating
+ * indirect blocks as needed).
+ *
+ * On failure the fnode is left as it was.
+ *
+ * @param fnode
+ * @param num_sectors the number of sectors in its extents.
+ */
+static int fnode_extents_to_blocks(struct fnode *fnode, int num_sectors) {
+    const struct fnode extent_fnode = *fnode;
+    int n = 0;
 
-    for (i = 0; i < dir_info->num_entries; i++, dir_entry++) {
-        const int entry_name_len = strlen(dir_entry->name);
+    if (num_sectors > FNODE_MAX_BLOCKS)
+        return -1;
 
-        if (entry_name_len == name_len &&
-            strmatchn(name, dir_entry->name, name_len))
-            break;
-    }
+    fnode->flags &= ~FNODE_FLAG_EXTENTS;
+    clear_buffer((uint8_t *) fnode->sector_indexes, sizeof(fnode->sector_indexes));
 
-    if (i == dir_info->num_entries) {
-        print_string("Error removing entry: couldn't find name.\n");
-        error = -1;
-        goto free_buffer;
+    for (int i = 0; i < extent_fnode.num_extents && i < FNODE_MAX_EXTENTS; i++) {
+        for (uint32_t s = 0; s < extent_fnode.extents[i].length; s++, n++) {
+            if (fnode_set_block(fnode, n, extent_fnode.extents[i].start + s))
+                goto undo;
+        }
     }
 
-    num_entries_to_shift = dir_info->num_entries - (i + 1);
-    while (num_entries_to_shift--) {
-        // *dir_entry = *(dir_entry + 1);
-        memcpy((char *) dir_entry, (char *) (dir_entry + 1), sizeof(*dir_entry));
-        dir_entry++;
-    }
+    return 0;
 
-    dir_info->num_entries--;
+undo:
+    // Only the indirect blocks are new (including any allocated for sector
+    // n); the content sectors stay with the extents.
+    fnode->size = (n + 1) << SECTOR_SIZE_SHIFT;
+    for_each_fnode_index_block(fnode, drop_indirect_block);
+    *fnode = extent_fnode;
+    return -1;
+}
 
-    const int new_size = (uint8_t *) dir_entry - (uint8_t *) dir_info;
-    if (overwrite_dir_content(dir_fnode, buffer, new_size)) {
-        print_string("Error adding dir_entry: overwrite_dir_content failed.\n");
-        error = -1;
-        goto free_buffer;
-    }
+/**
+ * @brief Allocate sectors old_sectors to new_sectors - 1 of an fnode's
+ * content. Extent-mapped fnodes get new extents (merged with the last one
+ * where they are contiguous with it), block-mapped ones new blocks.
+ *
+ * An extent-mapped fnode whose remaining extents can't hold the new sectors
+ * (it has few left, or free space is fragmented) is converted to block
+ * mapping first.
+ *
+ * @param fnode
+ * @param old_sectors
+ * @param new_sectors
+ */
+static int fnode_grow(struct fnode *fnode, int old_sectors, int new_sectors) {
+    const int count = new_sectors - old_sectors;
+    const int free_slots = FNODE_MAX_EXTENTS - fnode->num_extents;
+    struct fnode_extent extents[FNODE_MAX_EXTENTS];
+    struct fnode extent_fnode;
+    int num_extents = -1;
+
+    if (count <= 0)
+        return 0;
 
-    num_sectors_old = (dir_fnode->size / SECTOR_SIZE) +
-                      ((dir_fnode->size % SECTOR_SIZE) ? 1 : 0);
-    num_sectors_new = (new_size / SECTOR_SIZE) +
-                      ((new_size % SECTOR_SIZE) ? 1 : 0);
+    if (!(fnode->flags & FNODE_FLAG_EXTENTS))
+        return alloc_fnode_blocks(fnode, old_sectors, count);
 
-    if ((diff = num_sectors_old - num_sectors_new)) {
-        for (int i = 0; i < diff; i++)
-            sector_bitmap_unset(dir_fnode->sector_indexes[num_sectors_new + i], 1);
-    }
+    if (free_slots > 0)
+        num_extents = query_free_extents(count, extents, free_slots);
 
-    dir_fnode->size = new_size;
-    if (save_fnode(&dir_fnode_location, dir_fnode)) {
-        print_string("Error: remove_dir_entry: save_fnode.\n");
-        error = -1;
+    if (num_extents < 0) {
+        extent_fnode = *fnode;
+        if (fnode_extents_to_blocks(fnode, old_sectors))
+            return -1;
+
+        if (alloc_fnode_blocks(fnode, old_sectors, count)) {
+            fnode->size = old_sectors << SECTOR_SIZE_SHIFT;
+            for_each_fnode_index_block(fnode, drop_indirect_block);
+            *fnode = extent_fnode;
+            return -1;
+        }
+
+        return 0;
     }
 
-free_buffer:
-    object_free(buffer);
+    for (int i = 0; i < num_extents; i++) {
+        struct fnode_extent *last = fnode->num_extents ? &fnode->extents[fnode->num_extents - 1] : NULL;
 
-return_error:
-    return error;
+        if (last && last->start + last->length == extents[i].start)
+            last->length += extents[i].length;
+        else
+            fnode->extents[fnode->num_extents++] = extents[i];
+    }
+
+    return 0;
 }
 
-char *extract_filename_from_path(char *path) {
-    int path_len = strlen(path);
-    int i;
+static struct file_handle *__file_open(const struct fnode *fnode) {
+    struct file_handle *file;
 
-    if (path_len <= 0)
+    if (fnode->type != FILE) {
+        print_string("Error: file_open: not a file.\n");
         return NULL;
+    }
 
-    i = path_len - 1;
-
-    if (path[i] == '/') {
-        print_string("Error: filenames should not end with '/'.\n");
+    file = fs_cache_alloc(file_handle_cache, sizeof(struct file_handle));
+    if (!file) {
+        print_string("Error: file_open: object_alloc.\n");
         return NULL;
     }
+    clear_buffer((uint8_t *) file, sizeof(struct file_handle));
 
-    // Skip past non '/'s.
-    while(i && path[i] != '/')
-        i--;
+    file->readahead = true;
+    file->ra_prev = (uint32_t) -1;
+    file->ra_size = FILE_RA_MIN_SECTORS;
 
-    if (path[i] == '/')
-        i++;
+    file->fnode = *fnode;
+    if (get_fnode_location(fnode->id, &file->location)) {
+        file_close(file);
+        return NULL;
+    }
 
-    return &path[i];
+    return file;
 }
 
 /**
- * @brief Create a new file within the innermost directory of the directory chain
- * of the supplied filesystem context.
+ * @brief Open the file at path (relative to ctx's working directory unless
+ * it starts with '/') for reading and writing, positioned at its start.
  *
  * @param ctx
- * @param file_info
+ * @param path
+ * @return a handle to pass to file_read() etc. and finally file_close(), or
+ * NULL on error.
  */
-int create_file(struct fs_context *ctx, struct file_creation_info *file_info) {
-    struct fnode_location_t parent_fnode_location, new_fnode_location;
-    int sz = file_info->file_size, sz_sectors = 1;
-    // TODO: We're allocating this on the stack because it'll probably be greater
-    // than 2k which is that max dynamic object allocation allows, when we dynamic
-    // allocation supports greater than 2k, we should use than instead of this
-    // stack-allocation.
-    int sector_indexes_buffer[MAX_FILE_CHUNKS];
-    struct fnode parent_fnode, new_fnode;
-    struct dir_entry new_dir_entry;
+struct file_handle *file_open(struct fs_context *ctx, char *path) {
+    char dir_path[MAX_FILENAME_LENGTH + 1];
     struct directory_chain *chain;
+    struct file_handle *file = NULL;
+    struct fnode fnode;
     char *filename;
-    int time, err;
-
-    while ((sz_sectors << SECTOR_SIZE_SHIFT) < sz)
-        sz_sectors++;
+    int len = strlen(path);
 
-    if (sz_sectors > MAX_FILE_CHUNKS)
-        return -1; // Unsupported file size.
-
-    // Not really necesary, but just to avoid saving garbage from the stack.
-    clear_buffer((uint8_t *) &new_fnode, sizeof(struct fnode));
-    clear_buffer((uint8_t *) &new_dir_entry, sizeof(struct dir_entry));
-    clear_buffer((uint8_t *) &new_fnode_location, sizeof(struct fnode_location_t));
-
-    time_op(query_free_sectors(sz_sectors, sector_indexes_buffer), time, err);
-    print_string("query_free_sectors took "); print_int32(time); print_string(" ticks.\n");
-    if (err)
-        return -1; // Not enough disk space.
-
-    time_op(query_free_fnodes(1, &new_fnode_location), time, err);
-    print_string("query_free_fnodes took "); print_int32(time); print_string(" ticks.\n");
-    if (err)
-        goto free_sectors; // Not enough fnodes.
-
-    new_fnode.size = sz;
-    new_fnode.type = FILE;
-    new_fnode.id = NEXT_FNODE_ID++;
-    for (int i = 0; i < sz_sectors; i++)
-        new_fnode.sector_indexes[i] = sector_indexes_buffer[i];
-
-    if (save_fnode(&new_fnode_location, &new_fnode))
-        goto free_fnode;
+    if (len <= 0 || len > MAX_FILENAME_LENGTH)
+        return NULL;
 
-    if (save_file(&new_fnode, file_info))
-        goto unsave_new_fnode;
+    clear_buffer((uint8_t *) dir_path, sizeof(dir_path));
+    memcpy(dir_path, path, len);
 
-    filename = extract_filename_from_path(file_info->path);
+    filename = extract_filename_from_path(dir_path);
     if (!filename) {
-        print_string("Error create_file: extract_filename_from_path.\n");
-        goto unsave_new_fnode;
+        print_string("Error: file_open: extract_filename_from_path.\n");
+        return NULL;
     }
 
-    memcpy(new_dir_entry.name, (char *)filename, strlen(filename));
-    new_dir_entry.size = sz; // Unnecessary as size field is obsolete but leave for now.
-    new_dir_entry.type = FILE;
-    new_dir_entry.fnode_location = new_fnode_location;
-    new_dir_entry.id = new_fnode.id;
-
-    if (filename != file_info->path) {
-        char c = *(filename -1);
+    if (filename != dir_path) {
+        char c = *(filename - 1);
 
         *(filename - 1) = '\0';
-        chain = create_chain_from_path(ctx, file_info->path);
+        chain = create_chain_from_path(ctx, dir_path);
         *(filename - 1) = c;
     } else {
         chain = ctx->working_directory_chain;
     }
 
     if (!chain) {
-        print_string("Error create_file: create_chain_from_path");
-        goto unsave_new_fnode;
-    }
-
-    // We get the parent_fnode (and location) by this validation process.
-    if (validate_directory_chain(chain, &parent_fnode, &parent_fnode_location)) {
-        print_string("Error creating file: failed chain validation.\n");
-        if (chain != ctx->working_directory_chain)
-            destroy_directory_chain(chain);
-        goto unsave_new_fnode;
+        print_string("Error: file_open: create_chain_from_path.\n");
+        return NULL;
     }
 
-    if (add_dir_entry(&parent_fnode_location, &parent_fnode, &new_dir_entry))
-        goto unsave_new_fnode;
+    if (!fs_search(chain, filename, &fnode))
+        file = __file_open(&fnode);
 
     if (chain != ctx->working_directory_chain)
         destroy_directory_chain(chain);
 
-    return 0;
+    return file;
+}
 
-    // It's not really necessary to unsave a new fnode. We only need to mark the
-    // bit free in the fnode bitmap.
-unsave_new_fnode:
-    unsave_fnode(new_fnode_location);
+/**
+ * @brief Open the file with the given fnode id. See file_open().
+ *
+ * @param id
+ */
+struct file_handle *file_open_fnode(fnode_id_t id) {
+    struct fnode fnode;
 
-free_fnode:
-    fnode_bitmap_unset(new_fnode_location.fnode_table_index, 1);
+    if (get_fnode_by_id(id, &fnode))
+        return NULL;
 
-free_sectors:
-    for (int i = 0; i < sz_sectors; i++)
-        sector_bitmap_unset(sector_indexes_buffer[i], 1);
+    return __file_open(&fnode);
+}
 
-    return -1;
+/**
+ * @brief Start reading n_sectors sectors of a file, from file sector start
+ * on, into the buffer cache in the background.
+ *
+ * @param fnode
+ * @param start
+ * @param n_sectors
+ */
+static void fnode_prefetch(const struct fnode *fnode, uint32_t start, uint32_t n_sectors) {
+    const uint32_t file_sectors = fnode_num_sectors(fnode);
+    const uint32_t end = start + n_sectors < file_sectors ? start + n_sectors : file_sectors;
+
+    while (start < end) {
+        fblock_index_t lba;
+        uint32_t run = fnode_map_run(fnode, start, &lba);
+
+        if (!run)
+            return;
+
+        if (run > end - start)
+            run = end - start;
+
+        bcache_prefetch(lba, run);
+        start += run;
+    }
 }
 
-int __delete_file(struct directory_chain *chain, char *deletion_target_name) {
-    struct fnode_location_t enclosing_fnode_location, file_fnode_location;
-    struct fnode enclosing_fnode, file_fnode;
-    int to_delete, sector_idx;
+/**
+ * @brief Read ahead for a read of a file starting at file sector sector.
+ *
+ * A read that continues where the previous one left off is sequential. Once
+ * the reader is within half a window of the end of what has been read ahead,
+ * the next window is prefetched and the window doubles, so the disk stays
+ * busy while the caller consumes the data. Any other read starts over with
+ * the smallest window.
+ *
+ * @param file
+ * @param sector
+ */
+static void __file_readahead(struct file_handle *file, uint32_t sector) {
+    if (sector != file->ra_prev && sector != file->ra_prev + 1) {
+        file->ra_size = FILE_RA_MIN_SECTORS;
+        file->ra_next = sector;
+    } else if (file->ra_next >= sector + file->ra_size / 2) {
+        return;
+    }
 
-    if (validate_directory_chain(chain,
-                                 &enclosing_fnode,
-                                 &enclosing_fnode_location)) {
-        print_string("Error deleting file: couldn't validate chain.\n");
-        return -1;
+    if (file->ra_next < sector)
+        file->ra_next = sector;
+
+    fnode_prefetch(&file->fnode, file->ra_next, file->ra_size);
+    file->ra_next += file->ra_size;
+
+    if (file->ra_size < FILE_RA_MAX_SECTORS)
+        file->ra_size *= 2;
+}
+
+/**
+ * @brief Read up to n bytes from a file at its handle's position, advancing
+ * the position.
+ *
+ * Reads go through the buffer cache, read ahead when sequential (see
+ * __file_readahead). Reads of at least FILE_RA_MAX_SECTORS whole sectors go
+ * straight into buffer.
+ *
+ * @param file
+ * @param buffer
+ * @param n
+ * @return the number of bytes read (0 at the end of the file), or -1 on
+ * error.
+ */
+int file_read(struct file_handle *file, void *buffer, int n) {
+    uint8_t sector_buffer[SECTOR_SIZE];
+    uint8_t *out = (uint8_t *) buffer;
+    int done = 0;
+
+    if (n <= 0 || file->pos >= file->fnode.size)
+        return 0;
+
+    if (n > file->fnode.size - file->pos)
+        n = file->fnode.size - file->pos;
+
+    while (done < n) {
+        const uint32_t sector = file->pos >> SECTOR_SIZE_SHIFT;
+        const uint32_t within = file->pos & (SECTOR_SIZE - 1);
+        fblock_index_t lba;
+        int run = fnode_map_run(&file->fnode, sector, &lba);
+        int chunk;
+
+        if (!run)
+            return -1;
+
+        if (!within && n - done >= FILE_RA_MAX_SECTORS * SECTOR_SIZE) {
+            if (run > (n - done) >> SECTOR_SIZE_SHIFT)
+                run = (n - done) >> SECTOR_SIZE_SHIFT;
+
+            chunk = run * SECTOR_SIZE;
+            if (read_from_storage_disk(lba, chunk, out + done))
+                return -1;
+        } else {
+            if (file->readahead)
+                __file_readahead(file, sector);
+
+            if (within || n - done < SECTOR_SIZE) {
+                chunk = SECTOR_SIZE - within;
+                if (chunk > n - done)
+                    chunk = n - done;
+
+                if (bcache_read(lba, SECTOR_SIZE, sector_buffer))
+                    return -1;
+                memcpy((char *) out + done, (char *) sector_buffer + within, chunk);
+            } else {
+                if (run > (n - done) >> SECTOR_SIZE_SHIFT)
+                    run = (n - done) >> SECTOR_SIZE_SHIFT;
+
+                chunk = run * SECTOR_SIZE;
+                if (bcache_read(lba, chunk, out + done))
+                    return -1;
+            }
+        }
+
+        done += chunk;
+        file->pos += chunk;
+        file->ra_prev = (file->pos - 1) >> SECTOR_SIZE_SHIFT;
     }
 
-    // Verify that target file is present in working directory.
-    if (search_name_in_directory(deletion_target_name, &enclosing_fnode, &file_fnode)) {
-        print_string("Error deleting file: couldn't find file in wd.\n");
+    return done;
+}
+
+/**
+ * @brief Read n bytes of a file, starting at byte offset (a multiple of
+ * SECTOR_SIZE), straight from the disk into buffer: no buffer cache and no
+ * bounce buffer in between. Only whole sectors are transferred, so buffer
+ * must have room for n rounded up to a multiple of SECTOR_SIZE; whatever
+ * lies past n (or past the end of the file) in the last sector is zeroed.
+ * The handle's position is left alone.
+ *
+ * @param file
+ * @param offset
+ * @param buffer
+ * @param n
+ * @return the number of bytes read (0 at or past the end of the file), or
+ * -1 on error.
+ */
+int file_read_direct(struct file_handle *file, uint32_t offset, void *buffer, int n) {
+    const uint32_t sector = offset >> SECTOR_SIZE_SHIFT;
+    uint8_t *out = (uint8_t *) buffer;
+    int n_sectors, done = 0;
+
+    if (offset & (SECTOR_SIZE - 1))
         return -1;
-    }
 
-    // Free the sectors occupied by the file.
-    to_delete = file_fnode.size;
-    sector_idx = 0;
-    while (to_delete) {
-        int delete_size = to_delete > SECTOR_SIZE ? SECTOR_SIZE : to_delete;
-        sector_bitmap_unset(file_fnode.sector_indexes[sector_idx++], 1ULL);
-        to_delete -= delete_size;
-    }
+    if (n <= 0 || offset >= file->fnode.size)
+        return 0;
+
+    if (n > file->fnode.size - offset)
+        n = file->fnode.size - offset;
+    n_sectors = (n + SECTOR_SIZE - 1) >> SECTOR_SIZE_SHIFT;
+
+    while (done < n_sectors) {
+        fblock_index_t lba;
+        int run = fnode_map_run(&file->fnode, sector + done, &lba);
+
+        if (!run)
+            return -1;
 
-    // Free the fnode used by the file.
-    if (get_fnode_location(file_fnode.id, &file_fnode_location)) {
-        print_string("Error during delete: failed getting fnode location.\n");
-        return -1;
-    }
+        if (run > n_sectors - done)
+            run = n_sectors - done;
 
-    fnode_bitmap_unset(file_fnode_location.fnode_table_index, 1);
+        if (read_from_storage_disk(lba, run * SECTOR_SIZE, out + done * SECTOR_SIZE))
+            return -1;
 
-    remove_dir_entry(&enclosing_fnode, deletion_target_name);
+        done += run;
+    }
 
-    return 0;
+    clear_buffer(out + n, n_sectors * SECTOR_SIZE - n);
+
+    return n;
 }
 
 /**
- * @brief Delete a file from the current directory of an fs_context.
+ * @brief Write n bytes to a file at its handle's position, advancing the
+ * position and growing the file if the write goes past its end.
  *
- * @param ctx
- * @param folder_info
+ * File content goes straight to disk; only the fnode (when the file grows)
+ * goes through the journal.
+ *
+ * @param file
+ * @param buffer
+ * @param n
+ * @return n, or -1 on error.
  */
-int delete_file(struct fs_context *ctx, char *path) {
-    char deletion_target_name[MAX_FILENAME_LENGTH];
-    struct directory_chain *chain;
-    int path_len = strlen(path);
-    int i, j, error = 0;
-    char c;
+int file_write(struct file_handle *file, const void *buffer, int n) {
+    const uint8_t *in = (const uint8_t *) buffer;
+    const uint32_t end = file->pos + n;
+    uint8_t *sector_buffer = NULL;
+    int done = 0, error = 0;
 
-    if (path_len <= 0)
+    if (n <= 0)
+        return 0;
+
+    if (end > MAX_FILE_SIZE) {
+        print_string("Error: file_write: file too big.\n");
         return -1;
+    }
 
-    i = path_len - 1;
+    if (end > file->fnode.size) {
+        const int have = fnode_allocated_sectors(&file->fnode);
+        const int need = (end + SECTOR_SIZE - 1) >> SECTOR_SIZE_SHIFT;
 
-    if (path[i] == '/') {
-        print_string("Error: filenames should not end with (or have) '/'\n");
-        return -1;
+        if (fs_begin_op())
+            return -1;
+
+        fs_set_alloc_group(fnode_group(file->fnode.id));
+        error = fnode_grow(&file->fnode, have, need);
+        fs_set_alloc_group(-1);
+        if (error) {
+            print_string("Error: file_write: not enough disk space.\n");
+            fs_end_op();
+            return -1;
+        }
+
+        file->fnode.size = end;
+        error = save_fnode(&file->location, &file->fnode);
+        error |= fs_end_op();
+        if (error)
+            return -1;
     }
 
-    // Skip past non '/'s.
-    j = i;
-    while (i && path[i] != '/')
-        i--;
+    while (done < n) {
+        const uint32_t sector = file->pos >> SECTOR_SIZE_SHIFT;
+        const uint32_t within = file->pos & (SECTOR_SIZE - 1);
+        fblock_index_t lba;
+        int run = fnode_map_run(&file->fnode, sector, &lba);
+        int chunk;
 
-    if (path[i] == '/')
-        i++;
+        if (!run) {
+            error = -1;
+            break;
+        }
 
-    clear_buffer((uint8_t *) deletion_target_name, MAX_FILENAME_LENGTH);
+        if (within || n - done < SECTOR_SIZE) {
+            // A partial sector: read, modify, write.
+            if (!sector_buffer && !(sector_buffer = object_alloc(SECTOR_SIZE))) {
+                error = -1;
+                break;
+            }
 
-    memcpy(deletion_target_name, &path[i], j - i + 1);
+            chunk = SECTOR_SIZE - within;
+            if (chunk > n - done)
+                chunk = n - done;
 
-    // Mark end of enclosing path so it can be used to create a chain.
-    c = path[i];
-    path[i] = '\0';
+            bcache_invalidate(lba, 1);
+            if (read_from_storage_disk(lba, SECTOR_SIZE, sector_buffer)) {
+                error = -1;
+                break;
+            }
+            memcpy((char *) sector_buffer + within, (char *) in + done, chunk);
+            if (write_sectors_to_storage_disk(lba, 1, sector_buffer)) {
+                error = -1;
+                break;
+            }
+        } else {
+            if (run > (n - done) >> SECTOR_SIZE_SHIFT)
+                run = (n - done) >> SECTOR_SIZE_SHIFT;
 
-    chain = create_chain_from_path(ctx, path);
-    if (!chain) {
-        print_string("Error: delete_file: create_chain_from_path.\n");
-        error = -1;
+            chunk = run * SECTOR_SIZE;
+            bcache_invalidate(lba, run);
+            if (write_sectors_to_storage_disk(lba, run, (void *) (in + done))) {
+                error = -1;
+                break;
+            }
+        }
+
+        done += chunk;
+        file->pos += chunk;
     }
-    path[i] = c;
 
-    if (!error && __delete_file(chain, deletion_target_name)) {
-        print_string("Error: delete_file: __delete_file.\n");
-        error = -1;
+    if (sector_buffer)
+        object_free(sector_buffer);
+
+    if (error) {
+        print_string("Error: file_write: failed to write file content.\n");
+        return -1;
     }
 
-    if (chain)
-        destroy_directory_chain(chain);
+    return n;
+}
 
-    return error;
+/**
+ * @brief Move a file handle's position.
+ *
+ * @param file
+ * @param offset
+ * @param whence what offset is relative to.
+ * @return the new position, or -1 if it would be before the start or past
+ * the end of the file.
+ */
+int file_seek(struct file_handle *file, int offset, enum file_seek_whence whence) {
+    int pos;
+
+    switch (whence) {
+    case FILE_SEEK_SET:
+        pos = offset;
+        break;
+    case FILE_SEEK_CUR:
+        pos = file->pos + offset;
+        break;
+    case FILE_SEEK_END:
+        pos = file->fnode.size + offset;
+        break;
+    default:
+        return -1;
+    }
+
+    if (pos < 0 || pos > file->fnode.size)
+        return -1;
+
+    file->pos = pos;
+
+    return pos;
+}
+
+/**
+ * @brief Release a file handle.
+ *
+ * @param file
+ */
+int file_close(struct file_handle *file) {
+    if (!file)
+        return -1;
+
+    fs_cache_free(file_handle_cache, file);
+
+    return 0;
 }
 
 static int free_dir_content_sectors(struct fnode *__fnode) {
@@ -1403,10 +3597,9 @@ static int free_dir_content_sectors(struct fnode *__fnode) {
     }
 
     dir_info = (struct dir_info *) buffer;
-    dir_entry = (struct dir_entry *) (dir_info + 1);
+    dir_entry = dir_first_entry(__fnode, buffer);
 
     for (int i = 0; i < dir_info->num_entries; i++, dir_entry++) {
-        int to_delete, sector_idx;
         struct fnode fnode;
 
         if (get_fnode_by_location(&dir_entry->fnode_location, &fnode)) {
@@ -1419,12 +3612,10 @@ static int free_dir_content_sectors(struct fnode *__fnode) {
                 print_string("Error free_dir_content_sectors(fnode).\n");
                 return -1;
             }
+            dcache_invalidate_dir(fnode.id);
         }
 
-        for (sector_idx = 0, to_delete = fnode.size; to_delete > 0; sector_idx++) {
-            sector_bitmap_unset(fnode.sector_indexes[sector_idx], 1);
-            to_delete -= to_delete > SECTOR_SIZE ? SECTOR_SIZE : to_delete;
-        }
+        free_fnode_sectors(&fnode);
 
         fnode_bitmap_unset(dir_entry->fnode_location.fnode_table_index, 1);
     }
@@ -1475,17 +3666,14 @@ char *extract_foldername_from_path(char *path) {
  */
 int create_folder(struct fs_context *ctx, struct folder_creation_info *folder_info) {
     struct fnode_location_t parent_fnode_location, new_fnode_location;
-    int sz = sizeof(struct dir_info), sz_sectors = 1;
-    // TODO: We're allocating this on the stack because it'll probably be greater
-    // than 2k which is that max dynamic object allocation allows, when we dynamic
-    // allocation supports greater than 2k, we should use than instead of this
-    // stack-allocation.
-    int sector_indexes_buffer[MAX_FILE_CHUNKS];
+    int sz = sizeof(struct dir_info_hashed), sz_sectors = 1;
+    int *sector_indexes_buffer = NULL;
     struct fnode parent_fnode, new_fnode;
     struct dir_entry new_dir_entry;
-    struct dir_info *new_dir_info;
+    struct dir_info_hashed *new_dir_info;
     struct directory_chain *chain;
     int folderpath_len;
+    int bucket_sector;
     char *foldername;
     int time, err;
 
@@ -1495,39 +3683,15 @@ int create_folder(struct fs_context *ctx, struct folder_creation_info *folder_in
     if (sz_sectors > MAX_FILE_CHUNKS)
         return -1; // Unsupported file size.
 
-    // Not really necesary, but just to avoid saving garbage from the stack.
-    clear_buffer((uint8_t *) &new_fnode, sizeof(struct fnode));
-    clear_buffer((uint8_t *) &new_dir_entry, sizeof(struct dir_entry));
-    clear_buffer((uint8_t *) &new_fnode_location, sizeof(struct fnode_location_t));
-
-    time_op(query_free_sectors(sz_sectors, sector_indexes_buffer), time, err);
-    print_string("query_free_sectors took "); print_int32(time); print_string(" ticks.\n");
-    if (err)
-        return -1; // Not enough disk space.
-
-    time_op(query_free_fnodes(1, &new_fnode_location), time, err);
-    print_string("query_free_fnodes took "); print_int32(time); print_string(" ticks.\n");
-    if (err)
-        goto free_sectors; // Not enough fnodes.
-
-    new_fnode.size = sizeof(struct dir_info);
-    new_fnode.type = FOLDER;
-    new_fnode.id = NEXT_FNODE_ID++;
-    for (int i = 0; i < sz_sectors; i++)
-        new_fnode.sector_indexes[i] = sector_indexes_buffer[i];
-
-    if (save_fnode(&new_fnode_location, &new_fnode))
-        goto free_fnode;
-
     foldername = extract_foldername_from_path(folder_info->path);
     if (!foldername) {
         print_string("Error create_folder: bad path?\n");
-        goto free_fnode;
+        return -1;
     }
 
     if (validate_new_folder_name(foldername)) {
         print_string("Error create_folder: invalid new folder name.\n");
-        goto free_fnode;
+        return -1;
     }
 
     // The 2 if/else blocks that follow are a little esoteric, so here's an
@@ -1589,18 +3753,70 @@ int create_folder(struct fs_context *ctx, struct folder_creation_info *folder_in
 
     if (!chain) {
        print_string("Error: create_folder: NULL chain?\n");
-       goto free_fnode;
+       return -1;
+    }
+
+    // We get the parent_fnode (and location) by this validation process. It
+    // is needed up front to choose the new folder's block group.
+    if (validate_directory_chain(chain, &parent_fnode, &parent_fnode_location)) {
+        print_string("Error creating folder: failed chain validation.\n");
+        goto destroy_chain;
+    }
+
+    sector_indexes_buffer = (int *) object_alloc(sz_sectors * sizeof(int));
+    if (!sector_indexes_buffer) {
+        print_string("Error: create_folder: object_alloc.\n");
+        goto destroy_chain;
     }
 
+    if (fs_begin_op())
+        goto destroy_chain;
+
+    // Not really necesary, but just to avoid saving garbage from the stack.
+    clear_buffer((uint8_t *) &new_fnode, sizeof(struct fnode));
+    clear_buffer((uint8_t *) &new_dir_entry, sizeof(struct dir_entry));
+    clear_buffer((uint8_t *) &new_fnode_location, sizeof(struct fnode_location_t));
+
+    fs_set_alloc_group(choose_folder_group(&parent_fnode));
+
+    time_op(query_free_sectors(sz_sectors, sector_indexes_buffer), time, err);
+    print_string("query_free_sectors took "); print_int32(time); print_string(" ticks.\n");
+    if (err)
+        goto end_transaction; // Not enough disk space.
+
+    // New folders are hashed, starting with a single bucket sector.
+    if (query_free_sectors(1, &bucket_sector))
+        goto free_sectors;
+    if (clear_dir_bucket_sector(bucket_sector))
+        goto free_bucket_sector;
+
+    time_op(query_free_fnodes(1, &new_fnode_location), time, err);
+    print_string("query_free_fnodes took "); print_int32(time); print_string(" ticks.\n");
+    if (err)
+        goto free_bucket_sector; // Not enough fnodes.
+
+    new_fnode.size = sizeof(struct dir_info_hashed);
+    new_fnode.type = FOLDER;
+    new_fnode.flags = FNODE_FLAG_HASHED_DIR;
+    new_fnode.id = new_fnode_location.fnode_table_index;
+    for (int i = 0; i < sz_sectors; i++)
+        new_fnode.sector_indexes[i] = sector_indexes_buffer[i];
+
+    if (save_fnode(&new_fnode_location, &new_fnode))
+        goto free_fnode;
+
     // Prepare the folder info so we can save it. This writes the dir_info data
     // which begins every folder's content.
-    folder_info->data = object_alloc(sizeof(struct dir_info));
-    clear_buffer((uint8_t *) folder_info->data, sizeof(struct dir_info));
-    folder_info->size = sizeof(struct dir_info);
+    folder_info->data = object_alloc(sizeof(struct dir_info_hashed));
+    clear_buffer((uint8_t *) folder_info->data, sizeof(struct dir_info_hashed));
+    folder_info->size = sizeof(struct dir_info_hashed);
 
-    new_dir_info = (struct dir_info*) folder_info->data;
-    new_dir_info->num_entries = 0;
-    memcpy((char *) &new_dir_info->name, (char *)foldername, strlen(foldername));
+    new_dir_info = (struct dir_info_hashed*) folder_info->data;
+    new_dir_info->info.num_entries = 0;
+    memcpy((char *) &new_dir_info->info.name, (char *)foldername, strlen(foldername));
+    new_dir_info->version = DIR_VERSION_HASHED;
+    new_dir_info->num_bucket_sectors = 1;
+    new_dir_info->bucket_sectors[0] = bucket_sector;
 
     // Save the folder (currently containing only a dir_info).
     if (save_folder(&new_fnode, folder_info)) {
@@ -1609,47 +3825,52 @@ int create_folder(struct fs_context *ctx, struct folder_creation_info *folder_in
     }
     object_free(folder_info->data);
 
-    // We get the parent_fnode (and location) by this validation process.
-    if (validate_directory_chain(chain, &parent_fnode, &parent_fnode_location)) {
-        print_string("Error creating folder: failed chain validation.\n");
-        goto unsave_new_fnode;
-    }
-
     // Prepare the dir_entry which will be added to the folder's parent folder.
     memcpy(new_dir_entry.name, (char *)foldername, strlen(foldername));
     new_dir_entry.size = sizeof(struct dir_info); // Unnecessary as size field is obsolete but leave for now.
     new_dir_entry.type = FOLDER;
     new_dir_entry.fnode_location = new_fnode_location;
     new_dir_entry.id = new_fnode.id;
+    // Any growth of the parent folder's content belongs in the parent's group.
+    fs_set_alloc_group(fnode_group(parent_fnode.id));
     if (add_dir_entry(&parent_fnode_location, &parent_fnode, &new_dir_entry))
         goto unsave_new_fnode;
 
+    fs_set_alloc_group(-1);
     if (chain != ctx->working_directory_chain)
         destroy_directory_chain(chain);
-    return 0;
+    object_free((uint8_t *) sector_indexes_buffer);
+
+    return fs_end_op();
 
-    // It's not really necessary to unsave a new fnode. We only need to mark the
-    // bit free in the fnode bitmap.
 unsave_new_fnode:
     unsave_fnode(new_fnode_location);
 
-if (chain != ctx->working_directory_chain)
-        destroy_directory_chain(chain);
-
 free_fnode:
     fnode_bitmap_unset(new_fnode_location.fnode_table_index, 1);
 
+free_bucket_sector:
+    sector_bitmap_unset(bucket_sector, 1);
+
 free_sectors:
     for (int i = 0; i < sz_sectors; i++)
         sector_bitmap_unset(sector_indexes_buffer[i], 1);
 
+end_transaction:
+    fs_set_alloc_group(-1);
+    fs_end_op();
+
+destroy_chain:
+    if (chain != ctx->working_directory_chain)
+        destroy_directory_chain(chain);
+    object_free((uint8_t *) sector_indexes_buffer);
+
     return -1;
 }
 
 static int __delete_folder(struct directory_chain *chain, char *deletion_target_name) {
     struct fnode_location_t enclosing_fnode_location, folder_fnode_location;
     struct fnode enclosing_fnode, folder_fnode;
-    int to_delete, sector_idx;
 
     if (validate_directory_chain(chain,
                                  &enclosing_fnode,
@@ -1669,13 +3890,8 @@ static int __delete_folder(struct directory_chain *chain, char *deletion_target_
     }
 
     // Free the sectors occupied by the folder.
-    to_delete = folder_fnode.size;
-    sector_idx = 0;
-    while (to_delete) {
-        int delete_size = to_delete > SECTOR_SIZE ? SECTOR_SIZE : to_delete;
-        sector_bitmap_unset(folder_fnode.sector_indexes[sector_idx++], 1ULL);
-        to_delete -= delete_size;
-    }
+    free_fnode_sectors(&folder_fnode);
+    dcache_invalidate_dir(folder_fnode.id);
 
     // Free the fnode used by the folder.
     if (get_fnode_location(folder_fnode.id, &folder_fnode_location)) {
@@ -1723,6 +3939,11 @@ int delete_folder(struct fs_context *ctx, char *path) {
     c = path[i];
     path[i] = '\0';
 
+    if (fs_begin_op()) {
+        path[i] = c;
+        return -1;
+    }
+
     chain = create_chain_from_path(ctx, path);
     if (!chain) {
         print_string("Error: delete_file: create_chain_from_path.\n");
@@ -1738,6 +3959,9 @@ int delete_folder(struct fs_context *ctx, char *path) {
     if (chain)
         destroy_directory_chain(chain);
 
+    if (fs_end_op())
+        error = -1;
+
     return error;
 }
 
@@ -1749,17 +3973,31 @@ int delete_folder(struct fs_context *ctx, char *path) {
  * @param buffer
  */
 int read_dir_content(const struct fnode *dir_fnode, uint8_t *buffer) {
-    int buffer_top = 0, amt_read = 0, fnode_sector_idx = 0;
+    int amt_read = 0, fnode_sector_idx = 0, ra_next = 0;
 
     while (amt_read < dir_fnode->size) {
-        int bytes_to_read = ((dir_fnode->size - amt_read) >= SECTOR_SIZE) ? SECTOR_SIZE : (dir_fnode->size - amt_read);
-        int sector_idx = dir_fnode->sector_indexes[fnode_sector_idx++];
+        fblock_index_t lba;
+        int run = fnode_map_run(dir_fnode, fnode_sector_idx, &lba);
+        int bytes_to_read = run * SECTOR_SIZE;
+
+        if (!run)
+            return -1;
+
+        // Keep the next sectors of the directory coming in while this run
+        // is copied out.
+        if (fnode_sector_idx + FILE_RA_MAX_SECTORS / 2 >= ra_next) {
+            fnode_prefetch(dir_fnode, ra_next, FILE_RA_MAX_SECTORS);
+            ra_next += FILE_RA_MAX_SECTORS;
+        }
 
-        if (read_from_storage_disk(sector_idx, bytes_to_read, &buffer[buffer_top]))
+        if (bytes_to_read > dir_fnode->size - amt_read)
+            bytes_to_read = dir_fnode->size - amt_read;
+
+        if (bcache_read(lba, bytes_to_read, &buffer[amt_read]))
             return -1;
 
-        buffer_top += bytes_to_read;
         amt_read += bytes_to_read;
+        fnode_sector_idx += run;
     }
 
     return amt_read;
@@ -1773,26 +4011,29 @@ int read_dir_content(const struct fnode *dir_fnode, uint8_t *buffer) {
  * @param bytes
  */
 int overwrite_dir_content(struct fnode *fnode, uint8_t *buffer, int bytes) {
-    int error = 0, written = 0, to_write, sectors_written = 0;
-    uint8_t *data = buffer;
+    int written = 0, fnode_sector_idx = 0;
 
-    // Write to disk one sector at a time because fnode->sector_indexes
-    // might not be contiguous.
+    // Directory content is metadata, so it goes through the buffer cache
+    // (and so into the journal) rather than straight to disk.
     while (written < bytes) {
-        int idx = fnode->sector_indexes[sectors_written];
+        fblock_index_t lba;
+        int run = fnode_map_run(fnode, fnode_sector_idx, &lba);
+        int bytes_to_write = run * SECTOR_SIZE;
 
-        to_write = (bytes - written) < SECTOR_SIZE ? (bytes - written) : SECTOR_SIZE;
-        if (write_to_storage_disk(idx, to_write, data)) {
-            print_string("Failed to write file content to disk.\n");
+        if (!run)
             return -1;
-        }
 
-        sectors_written++;
-        written += to_write;
-        data += written;
+        if (bytes_to_write > bytes - written)
+            bytes_to_write = bytes - written;
+
+        if (bcache_write(lba, bytes_to_write, &buffer[written]))
+            return -1;
+
+        written += bytes_to_write;
+        fnode_sector_idx += run;
     }
 
-    return error;
+    return 0;
 }
 
 /**
@@ -1838,7 +4079,7 @@ void show_dir_content(const struct fnode *dir_fnode) {
     }
 
     dir_info = (struct dir_info*) buffer;
-    dir_entry = (struct dir_entry *) (buffer + sizeof(struct dir_info));
+    dir_entry = dir_first_entry(dir_fnode, buffer);
     for (int i = 0; i < dir_info->num_entries; i++, dir_entry++) {
         switch (dir_entry->type)
         {
@@ -1867,7 +4108,7 @@ int get_fnode_by_location(struct fnode_location_t *location, struct fnode* fnode
     uint8_t *buffer = object_alloc(SECTOR_SIZE);
 
     // Read fnode in from disk.
-    if (read_from_storage_disk(location->fnode_sector_index, SECTOR_SIZE, buffer))
+    if (bcache_read(location->fnode_sector_index, SECTOR_SIZE, buffer))
         return -1;
 
     *fnodep = *((struct fnode*)(buffer + location->offset_within_sector));
@@ -1886,7 +4127,7 @@ int get_fnode(struct dir_entry *entry, struct fnode* fnode_ptr) {
     uint8_t *buffer = object_alloc(SECTOR_SIZE);
 
     // Read fnode in from disk.
-    if (read_from_storage_disk(entry->fnode_location.fnode_sector_index, SECTOR_SIZE, buffer))
+    if (bcache_read(entry->fnode_location.fnode_sector_index, SECTOR_SIZE, buffer))
         return -1;
     // *fnode_ptr = (struct fnode)(*(struct fnode*)(buffer + entry->fnode_location.offset_within_sector));
     memcpy(fnode_ptr, (char *)(buffer + entry->fnode_location.offset_within_sector), sizeof(struct fnode));
@@ -1897,95 +4138,31 @@ int get_fnode(struct dir_entry *entry, struct fnode* fnode_ptr) {
 }
 
 /**
- * @brief Get the location of fnode with id id within the folder represented by fnode
+ * @brief Get the location of the fnode with id id.
  *
- * CAREFUL! The return value semantics are:
+ * An fnode's id is its index in the fnode table, so the location is computed
+ * directly without touching the disk.
  *
- *  < 0 => an error occurred
- * == 0 => no error occurred but the fnode was not found
- *  > 0 => fnode with the required id was found
- *
- * @param fnode (MUST HAVE type=FOLDER)
  * @param id
  * @param result_fnode_location
  */
-int __get_fnode_location(struct fnode *fnode, fnode_id_t id, struct fnode_location_t *result_fnode_location) {
-    uint8_t *buffer = object_alloc(fnode->size);
-    struct dir_entry *dir_entry;
-    struct dir_info *dir_info;
-    int error = 0, i;
-
-    if (read_dir_content(fnode, buffer) < 0) {
-        print_string("Error: __get_fnode_location: read_dir_content.\n");
-        error = -1;
-        goto free_buffer;
-    }
-
-    dir_info = (struct dir_info *) buffer;
-    dir_entry = (struct dir_entry *) (dir_info + 1);
-
-    for (i = 0; i < dir_info->num_entries; i++, dir_entry++) {
-        if (dir_entry->id == id)
-            break;
-    }
-
-    if (i < dir_info->num_entries) {
-        *result_fnode_location = dir_entry->fnode_location;
-        error = 1;
-        goto free_buffer;
-    }
-
-    // Since we didn't find the id in the current directory, we must recursively search its subdirectories.
-    dir_entry = (struct dir_entry *) (dir_info + 1);
-
-    for (i = 0; i < dir_info->num_entries; i++, dir_entry++) {
-        struct fnode subdir_fnode;
-
-        if (dir_entry->type != FOLDER)
-            continue;
-
-        if (get_fnode(dir_entry, &subdir_fnode)) {
-            print_string("Error __get_fnode_location: get_fnode.\n");
-            error = -1;
-            goto free_buffer;
-        }
-
-        // TODO: Do we really care if a subdirectory search encounters an error?
-        // Such an error is not likely to have downstream effects so at least
-        // for now we can just ignore it.
-        if (__get_fnode_location(&subdir_fnode, id, result_fnode_location) > 0) {
-            error = 1;
-            break;
-        }
-    }
-
-free_buffer:
-    object_free(buffer);
-
-    return error;
-}
-
 int get_fnode_location(fnode_id_t id, struct fnode_location_t *result_fnode_location) {
-    struct fnode root_fnode;
-
-    if (id == root_dir_entry.id) {
-        *result_fnode_location = root_dir_entry.fnode_location;
-        return 0;
-    }
-
-    if (get_fnode(&root_dir_entry, &root_fnode)) {
-        print_string("Error get_fnode_location: get_fnode.\n");
+    if (id >= master_record.fnode_bitmap_size * BITS_PER_BYTE) {
+        print_string("Error get_fnode_location: fnode id out of range.\n");
         return -1;
     }
 
-    if (__get_fnode_location(&root_fnode, id, result_fnode_location) <= 0) {
-        print_string("Error get_fnode_location: __get_fnode_location.\n");
-        return -1;
-    }
+    fnode_location_from_index(id, result_fnode_location);
 
     return 0;
 }
 
+/**
+ * @brief Read in the fnode with id id. This is a single (cached) sector read.
+ *
+ * @param id
+ * @param fnode
+ */
 int get_fnode_by_id(fnode_id_t id, struct fnode *fnode) {
     struct fnode_location_t location;
 
@@ -1999,6 +4176,11 @@ int get_fnode_by_id(fnode_id_t id, struct fnode *fnode) {
         return -1;
     }
 
+    if (fnode->id != id) {
+        print_string("Error: get_fnode: stale fnode id.\n");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -2021,7 +4203,7 @@ int get_dir_info_from_chain(struct directory_chain *chain, struct dir_info *dir_
  * @param output buffer where the struct dir_info is written.
  */
 int get_dir_info(struct fnode *fnode, struct dir_info *dir_info) {
-    return read_from_storage_disk(fnode->sector_indexes[0], sizeof(struct dir_info), (uint8_t *) dir_info);
+    return bcache_read(fnode->sector_indexes[0], sizeof(struct dir_info), (uint8_t *) dir_info);
 }
 
 /**
@@ -2031,14 +4213,9 @@ int get_dir_info(struct fnode *fnode, struct dir_info *dir_info) {
  * @param _fnode
  */
 void record_fnode_sector_bits(const struct fnode *_fnode) {
-    int bytes_tracked = 0, sector_index = 0;
-
-    while (bytes_tracked < _fnode->size) {
-        bytes_tracked += ((_fnode->size - bytes_tracked) >= SECTOR_SIZE)
-                        ? SECTOR_SIZE
-                        : _fnode->size - bytes_tracked;
-        sector_bitmap_set(_fnode->sector_indexes[sector_index++], 1);
-    }
+    for_each_fnode_run(_fnode, sector_bitmap_set);
+    for_each_fnode_index_block(_fnode, sector_bitmap_set);
+    for_each_dir_bucket_sector(_fnode, sector_bitmap_set);
 }
 
 /**
@@ -2059,11 +4236,8 @@ void __init_usage_bits(const struct fnode *_fnode) {
         return;
     }
 
-    if (_fnode->id >= NEXT_FNODE_ID)
-        NEXT_FNODE_ID = _fnode->id + 1;
-
     dir_info = (struct dir_info*) buffer;
-    dir_entry = (struct dir_entry *) (buffer + sizeof(struct dir_info));
+    dir_entry = dir_first_entry(_fnode, buffer);
     for (int i = 0; i < dir_info->num_entries; i++, dir_entry++) {
         char sector_buffer[SECTOR_SIZE];
         struct fnode *__fnode;
@@ -2072,15 +4246,12 @@ void __init_usage_bits(const struct fnode *_fnode) {
         fnode_bitmap_set(dir_entry->fnode_location.fnode_table_index, 1);
 
         // Read in the sector containing the fnode for this dir_entry.
-        read_from_storage_disk(dir_entry->fnode_location.fnode_sector_index, SECTOR_SIZE, &sector_buffer);
+        bcache_read(dir_entry->fnode_location.fnode_sector_index, SECTOR_SIZE, &sector_buffer);
         __fnode = (struct fnode *) &sector_buffer[dir_entry->fnode_location.offset_within_sector];
 
         // Mark the sectors occupied by this dir_entry's content.
         record_fnode_sector_bits(__fnode);
 
-        if (__fnode->id >= NEXT_FNODE_ID)
-            NEXT_FNODE_ID = __fnode->id + 1;
-
         // If it's a directory, recurse, so we can account for its children.
         if (dir_entry->type == FOLDER)
             __init_usage_bits(__fnode);
@@ -2106,13 +4277,53 @@ void init_fnode_bits(void) {
 }
 
 /**
- * @brief Initialize the fnode_bitmap and sector_bitmap.
+ * @brief Read the fnode_bitmap and sector_bitmap into memory, mark the bits
+ * used by the filesystem metadata and existing files, then write back all the
+ * modified bitmap sectors in one batch.
  *
  */
 void init_usage_bits(void) {
     uint32_t start_bit;
     uint64_t num_bits;
 
+    if (load_bitmap(&fnode_bitmap, master_record.fnode_bitmap_start_sector,
+                    master_record.fnode_bitmap_size)) {
+        print_string("init_usage_bits: failed to load fnode_bitmap\n");
+        return;
+    }
+    if (load_bitmap(&sector_bitmap, master_record.sector_bitmap_start_sector,
+                    master_record.sector_bitmap_size)) {
+        print_string("init_usage_bits: failed to load sector_bitmap\n");
+        return;
+    }
+
+    fnode_bitmap.base = 0;
+    sector_bitmap.base = master_record.data_blocks_start_sector;
+
+    // fnode group g is fnode bitmap region g; data group g is the g'th of
+    // FS_NUM_GROUPS equal slices of the data area.
+    fnode_bitmap.group_base = 0;
+    fnode_bitmap.group_bits = 1 << fnode_bitmap.region_shift;
+    sector_bitmap.group_base = sector_bitmap.base;
+    sector_bitmap.group_bits = (sector_bitmap.size * BITS_PER_BYTE - sector_bitmap.base +
+                                FS_NUM_GROUPS - 1) / FS_NUM_GROUPS;
+    fs_set_alloc_group(-1);
+
+    // A cleanly synced volume's bitmaps and allocation summaries are up to
+    // date, so there is nothing to rebuild.
+    if (master_record.state == FS_STATE_CLEAN) {
+        print_string("Clean filesystem, using persisted bitmaps.\n");
+        fnode_bitmap.cursor = master_record.fnode_cursor;
+        sector_bitmap.cursor = master_record.sector_cursor;
+        memcpy((char *) fnode_bitmap.region_free, (char *) master_record.fnode_region_free,
+               sizeof(fnode_bitmap.region_free));
+        memcpy((char *) sector_bitmap.region_free, (char *) master_record.sector_region_free,
+               sizeof(sector_bitmap.region_free));
+        return;
+    }
+
+    print_string("Unclean filesystem, rebuilding bitmaps.\n");
+
     // Set the sector_bitmap bits occupied by master_record.
     num_bits = 1;
     start_bit = 0;
@@ -2138,8 +4349,21 @@ void init_usage_bits(void) {
     start_bit = master_record.fnode_table_start_sector;
     sector_bitmap_set(start_bit, num_bits);
 
+    // Set sector_bitmap bits occupied by the journal.
+    num_bits = master_record.journal_num_sectors;
+    start_bit = master_record.journal_start_sector;
+    sector_bitmap_set(start_bit, num_bits);
+
     // Set fnode_bitmap bits occupied by actual files and folders.
     init_fnode_bits();
+
+    bitmap_count_regions(&fnode_bitmap);
+    bitmap_count_regions(&sector_bitmap);
+
+    // All the bits above were set in memory; write them back in one go (and
+    // mark the volume clean).
+    if (fs_sync())
+        print_string("init_usage_bits: failed to flush bitmaps\n");
     print_string("d_b done\n");
 }
 
@@ -2161,7 +4385,7 @@ void init_root_fnode(void) {
  *
  */
 void init_master_record(void) {
-    read_from_storage_disk(0, sizeof(struct fs_master_record), &master_record);
+    bcache_read(0, sizeof(struct fs_master_record), &master_record);
 }
 
 /**
@@ -2169,8 +4393,23 @@ void init_master_record(void) {
  *
  */
 void init_fs(void) {
+    chain_link_cache = object_cache_create("directory_chain_link", sizeof(struct directory_chain_link), 0, NULL);
+    chain_cache = object_cache_create("directory_chain", sizeof(struct directory_chain), 0, NULL);
+    file_handle_cache = object_cache_create("file_handle", sizeof(struct file_handle), 0, NULL);
+    if (!chain_link_cache || !chain_cache || !file_handle_cache)
+        print_string("init_fs: unable to create object caches, using object_alloc.\n");
+
+    init_bcache();
+    init_dcache();
+
     init_master_record();
 
+    // Committed metadata left in the journal must be home before anything
+    // reads it.
+    init_journal(master_record.journal_start_sector, master_record.journal_num_sectors);
+    if (journal_replay())
+        print_string("init_fs: journal replay failed.\n");
+
     init_root_fnode();
 
     init_usage_bits();
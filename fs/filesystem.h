@@ -26,14 +26,75 @@ struct dir_info {
     uint32_t num_entries;
 };
 
+// Hashed directories (FNODE_FLAG_HASHED_DIR) begin with a dir_info_hashed
+// instead. Their dir_entrys still follow the header as a plain array, but each
+// entry is also indexed by the hash of its name in an open-addressed table of
+// dir_hash_slots which lives in separate bucket sectors. So a lookup only
+// needs to read the bucket sector the hash falls in plus the entry itself.
+#define DIR_VERSION_HASHED 2
+#define DIR_MAX_BUCKET_SECTORS 16
+
+#define DIR_SLOT_EMPTY 0            // Never used; ends a probe sequence.
+#define DIR_SLOT_DELETED 0xFFFFFFFF // Entry removed; probing continues past it.
+
+struct dir_hash_slot {
+    uint32_t hash;
+    uint32_t entry;                 // 1 + index of the dir_entry, or DIR_SLOT_*.
+}__attribute__((packed));
+
+#define DIR_SLOTS_PER_SECTOR ((int) (SECTOR_SIZE / sizeof(struct dir_hash_slot)))
+
+struct dir_info_hashed {
+    struct dir_info info;
+    uint32_t version;               // DIR_VERSION_HASHED.
+    uint32_t num_bucket_sectors;
+    fblock_index_t bucket_sectors[DIR_MAX_BUCKET_SECTORS];
+}__attribute__((packed)); // sizeof = 132 + 4 + 4 + 64 = 204
+
+#define FNODE_NUM_SECTOR_INDEXES 15
+#define FNODE_MAX_EXTENTS 7
+
+// Block-mapped fnodes: sector_indexes[0-12] point at content sectors directly,
+// sector_indexes[13] at a single indirect block (a sector full of content
+// sector indexes) and sector_indexes[14] at a double indirect block (a sector
+// full of single indirect block indexes).
+#define FNODE_NUM_DIRECT 13
+#define FNODE_SINGLE_INDIRECT 13
+#define FNODE_DOUBLE_INDIRECT 14
+#define FNODE_INDEXES_PER_BLOCK ((int) (SECTOR_SIZE / sizeof(fblock_index_t)))
+#define FNODE_MAX_BLOCKS (FNODE_NUM_DIRECT + FNODE_INDEXES_PER_BLOCK + \
+                          FNODE_INDEXES_PER_BLOCK * FNODE_INDEXES_PER_BLOCK)
+
+// Number of indirect blocks kept in memory by the indirect block cache.
+#define INDIRECT_CACHE_SIZE 8
+
+// fnode flags.
+#define FNODE_FLAG_EXTENTS 0x1      // Content is described by extents rather than sector_indexes.
+#define FNODE_FLAG_HASHED_DIR 0x2   // Folder content begins with a dir_info_hashed.
+
+// A run of length contiguous sectors starting at sector start.
+struct fnode_extent {
+    uint32_t start;
+    uint32_t length;
+}__attribute__((packed));
+
 struct fnode {
-    fnode_id_t id;                  // Filesystem-wide id number for this file/folder.
+    fnode_id_t id;                  // Filesystem-wide id number, equal to the fnode's fnode table index.
     uint32_t size;                  // The size of the file or folder.
     enum fnode_type type;           // FILE or FOLDER.
-    uint8_t reserved[56];
-    fblock_index_t sector_indexes[15];     // TODO: Treat 13 and 14 as singly and doubly indirect respectively.
-                                           // For now, singly indirect only -> MAX_FILE_SIZE=7689. (not too bad.)
-}__attribute__((packed));
+    uint32_t flags;                 // FNODE_FLAG_*.
+    uint8_t reserved[52];
+    union {
+        // Block-mapped content (folders and files created before extents).
+        // 13 and 14 are singly and doubly indirect respectively.
+        fblock_index_t sector_indexes[FNODE_NUM_SECTOR_INDEXES];
+        // Extent-mapped content (FNODE_FLAG_EXTENTS).
+        struct {
+            struct fnode_extent extents[FNODE_MAX_EXTENTS];
+            uint32_t num_extents;
+        };
+    };
+}__attribute__((packed)); // sizeof = 4 + 4 + 4 + 4 + 52 + 60 = 128
 
 struct fnode_location_t {
     uint32_t fnode_table_index;     // Index into the global array of fnodes.
@@ -50,6 +111,24 @@ struct dir_entry {
     fnode_id_t id;
  }__attribute__((packed)); // sizeof = 128 + 4 + 4 + 10 + 4 = 150
 
+// fs_master_record.state. A volume is clean once everything has been synced
+// to disk; it is marked dirty (on disk) before the next change is made.
+#define FS_STATE_DIRTY 0
+#define FS_STATE_CLEAN 0x434C4E21
+
+// Each allocation bitmap is divided into this many regions (of a power of 2
+// bits each) with a count of the free bits in each, so that full regions are
+// skipped by free-space searches.
+#define FS_BITMAP_REGIONS 32
+
+// Block groups. The fnode table and the data area are each divided into
+// FS_NUM_GROUPS groups, fnode group g going with data group g. New files and
+// folders are placed in their parent folder's group (new top level folders in
+// the group with the most free fnodes), so a folder's children, their fnodes
+// and their content end up close together on disk. fnode groups coincide with
+// the fnode bitmap's regions.
+#define FS_NUM_GROUPS FS_BITMAP_REGIONS
+
 struct fs_master_record {
     struct fnode_location_t root_dir_fnode_location;  // Index or block containing fnode of root folder.
     uint32_t fnode_bitmap_start_sector;
@@ -58,8 +137,96 @@ struct fs_master_record {
     uint32_t sector_bitmap_start_sector;
     uint32_t sector_bitmap_size;
     uint32_t data_blocks_start_sector;
+    uint32_t state;                                   // FS_STATE_CLEAN or FS_STATE_DIRTY.
+    uint32_t journal_start_sector;                    // First sector of the metadata journal.
+    uint32_t journal_num_sectors;                     // 0 if the volume has no journal.
+    // Allocation summaries, only trusted on a clean volume.
+    uint32_t fnode_cursor;                            // Where the next fnode search starts.
+    uint32_t sector_cursor;                           // Where the next sector search starts.
+    uint32_t fnode_region_free[FS_BITMAP_REGIONS];    // Free fnodes per fnode bitmap region.
+    uint32_t sector_region_free[FS_BITMAP_REGIONS];   // Free sectors per sector bitmap region.
 }__attribute__((packed));
 
+// Group commit. Metadata changes are synced to disk together, at most
+// FS_SYNC_INTERVAL_TICKS after the first of them or once their (pinned)
+// sectors hold FS_SYNC_PINNED_BUFFERS buffer cache buffers, whichever comes
+// first. The rest of the cache is headroom for the operation in progress,
+// since pinned buffers cannot be evicted.
+#define FS_SYNC_INTERVAL_TICKS (DEFAULT_TIMER_FREQUENCY_HZ / 2)
+#define FS_SYNC_PINNED_BUFFERS (BCACHE_NUM_BUFFERS / 2)
+
+// Sector/fnode runs freed by pending operations, which are only released
+// once they are committed (see bitmap_defer_clear).
+#define FS_MAX_DEFERRED_FREES 1024
+
+// The allocation bitmaps are kept in memory in chunks of this many bytes
+// (ORDER_SIZE(order) with order capped by the highest initialized zone).
+#define FS_BITMAP_CHUNK_ORDER 8
+#define FS_BITMAP_MAX_CHUNKS 16
+
+// Upper bound on the number of sectors moved by a single bitmap read/write.
+// The ATA sector count register is only 8 bits wide.
+#define FS_BITMAP_IO_SECTORS 128
+
+/**
+ * In-memory copy of one of the on-disk allocation bitmaps (fnode_bitmap or
+ * sector_bitmap).
+ *
+ * The bitmap is read in once at init and all allocation is done against this
+ * copy. Sectors of the bitmap which are modified are recorded in dirty_sectors
+ * and written back in batches by flush_bitmap().
+ *
+ * Searches for free bits start at cursor (just past the last bits handed out)
+ * and wrap around to base, skipping regions whose region_free count is 0.
+ * If a goal block group is set, it is searched first (next-fit within the
+ * group, from its group_cursor).
+ */
+struct fs_bitmap {
+    uint32_t start_sector;                          // First on-disk sector of the bitmap.
+    uint32_t size;                                  // Size of the bitmap in bytes.
+    uint32_t chunk_shift;                           // log2 of the size of each chunk in bytes.
+    uint32_t num_chunks;
+    struct mem_block *chunks[FS_BITMAP_MAX_CHUNKS]; // Backing memory for the bitmap.
+    struct mem_block *dirty_block;                  // Backing memory for dirty_sectors.
+    uint8_t *dirty_sectors;                         // 1 bit per bitmap sector, set if it needs writing back.
+    uint32_t num_dirty;                             // Number of bits set in dirty_sectors.
+    uint32_t base;                                  // First allocatable bit.
+    uint32_t cursor;                                // Next-fit: searches start here.
+    uint32_t region_shift;                          // log2 of the number of bits per region.
+    uint32_t region_free[FS_BITMAP_REGIONS];        // Number of 0 bits in each region.
+    int goal;                                       // Block group searched first, or -1 for none.
+    uint32_t group_base;                            // First bit of block group 0.
+    uint32_t group_bits;                            // Number of bits per block group.
+    uint32_t group_cursor[FS_NUM_GROUPS];           // Next-fit cursor within each block group.
+};
+
+// Sequential reads through a file_handle are read ahead into the buffer
+// cache, in a window which starts at FILE_RA_MIN_SECTORS and doubles on
+// each readahead up to FILE_RA_MAX_SECTORS. Reads of at least
+// FILE_RA_MAX_SECTORS whole sectors bypass the cache.
+#define FILE_RA_MIN_SECTORS 16
+#define FILE_RA_MAX_SECTORS 256
+
+enum file_seek_whence {
+    FILE_SEEK_SET,
+    FILE_SEEK_CUR,
+    FILE_SEEK_END
+};
+
+/**
+ * An open file (see file_open). Holds a copy of the file's fnode, the
+ * position of the next read or write and the readahead state.
+ */
+struct file_handle {
+    struct fnode fnode;
+    struct fnode_location_t location;
+    uint32_t pos;                       // Byte offset of the next read or write.
+    bool readahead;                     // Set (by default) to read ahead sequential reads.
+    uint32_t ra_prev;                   // Last file sector read, to detect sequential reads.
+    uint32_t ra_next;                   // First file sector not read ahead yet.
+    uint32_t ra_size;                   // Sectors to read ahead next time.
+};
+
 struct file_creation_info {
     char path[MAX_FILENAME_LENGTH];
     uint8_t *file_content;
@@ -111,6 +278,13 @@ int delete_file(struct fs_context *, char *);
 int create_folder(struct fs_context *, struct folder_creation_info *);
 int delete_folder(struct fs_context *, char *);
 int fs_search(struct directory_chain *, char*, struct fnode *);
+struct file_handle *file_open(struct fs_context *, char *);
+struct file_handle *file_open_fnode(fnode_id_t);
+int file_read(struct file_handle *, void *, int);
+int file_read_direct(struct file_handle *, uint32_t, void *, int);
+int file_write(struct file_handle *, const void *, int);
+int file_seek(struct file_handle *, int, enum file_seek_whence);
+int file_close(struct file_handle *);
 int list_dir_content(struct fs_context *, char *);
 int get_dir_info_from_chain(struct directory_chain *, struct dir_info *);
 int get_dir_info(struct fnode *, struct dir_info *);
@@ -118,9 +292,18 @@ int get_fnode_by_id(fnode_id_t, struct fnode*);
 int get_fnode(struct dir_entry *, struct fnode *);
 int get_fnode_by_location(struct fnode_location_t *, struct fnode *);
 int get_fnode_location(fnode_id_t, struct fnode_location_t *);
+void fnode_location_from_index(uint32_t, struct fnode_location_t *);
+uint32_t dir_name_hash(const char *);
+int fnode_num_sectors(const struct fnode *);
+int fnode_map_run(const struct fnode *, int, fblock_index_t *);
+int fnode_get_block(const struct fnode *, int, fblock_index_t *);
+int fnode_set_block(struct fnode *, int, fblock_index_t);
 int read_dir_content(const struct fnode *, uint8_t *);
 int overwrite_dir_content(struct fnode *, uint8_t *, int);
 void show_dir_content(const struct fnode *);
+int flush_usage_bits(void);
+int fs_sync(void);
+int fs_sync_if_due(void);
 void init_fs(void);
 
 #endif
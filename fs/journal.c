@@ -0,0 +1,373 @@
+#include "buffer_cache.h"
+#include "journal.h"
+
+#include <kernel/mm/mm.h>
+#include <kernel/print.h>
+#include <kernel/string.h>
+
+// A descriptor and the data sectors it describes are staged here and written
+// to the journal with a single disk command.
+#define JOURNAL_STAGING_SECTORS (1 + JOURNAL_DESC_MAX_SECTORS)
+
+static lba_t journal_start = 0;
+static uint32_t journal_sectors = 0;    // 0 if the volume has no journal.
+static uint32_t head;                   // Offset of the next free journal sector.
+static uint32_t sequence;               // Sequence number of the next transaction.
+static int depth = 0;                   // Nesting depth of journal_begin().
+
+static uint8_t *staging = NULL;
+
+static struct journal_stats stats;
+
+/**
+ * State of the transaction being written out by journal_end(), threaded
+ * through bcache_for_each_pinned().
+ */
+struct journal_writer {
+    int staged;                         // Data sectors in the staging buffer.
+    uint32_t checksum;
+    uint32_t total;                     // Data sectors written so far.
+};
+
+static inline struct journal_descriptor *__staged_descriptor(void) {
+    return (struct journal_descriptor *) staging;
+}
+
+/**
+ * @brief FNV-1a, continued from hash over len more bytes.
+ */
+static uint32_t __checksum(uint32_t hash, const uint8_t *data, int len) {
+    for (int i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+static int __write_header(void) {
+    uint8_t *buffer = object_alloc(SECTOR_SIZE);
+    struct journal_header *header = (struct journal_header *) buffer;
+    int error;
+
+    if (!buffer)
+        return -1;
+
+    clear_buffer(buffer, SECTOR_SIZE);
+    header->magic = JOURNAL_MAGIC;
+    header->sequence = sequence;
+    error = write_sectors_to_storage_disk(journal_start, 1, buffer);
+    object_free(buffer);
+
+    return error;
+}
+
+/**
+ * @brief Write the staged descriptor and its data sectors at the journal's
+ * head.
+ *
+ * @param writer
+ */
+static int __flush_staged(struct journal_writer *writer) {
+    if (!writer->staged)
+        return 0;
+
+    __staged_descriptor()->num_sectors = writer->staged;
+    if (write_sectors_to_storage_disk(journal_start + head, 1 + writer->staged, staging)) {
+        print_string("journal: failed to write transaction.\n");
+        return -1;
+    }
+
+    head += 1 + writer->staged;
+    writer->staged = 0;
+
+    return 0;
+}
+
+static int __log_sector(lba_t lba, uint8_t *data, void *arg) {
+    struct journal_writer *writer = arg;
+
+    if (!writer->staged) {
+        clear_buffer(staging, SECTOR_SIZE);
+        __staged_descriptor()->magic = JOURNAL_DESC_MAGIC;
+        __staged_descriptor()->sequence = sequence;
+    }
+
+    __staged_descriptor()->lbas[writer->staged] = lba;
+    memcpy((char *) staging + (1 + writer->staged) * SECTOR_SIZE, (char *) data, SECTOR_SIZE);
+    writer->checksum = __checksum(writer->checksum, data, SECTOR_SIZE);
+    writer->staged++;
+    writer->total++;
+
+    if (writer->staged == JOURNAL_DESC_MAX_SECTORS)
+        return __flush_staged(writer);
+
+    return 0;
+}
+
+static int __write_commit(struct journal_writer *writer) {
+    uint8_t *buffer = object_alloc(SECTOR_SIZE);
+    struct journal_commit *commit = (struct journal_commit *) buffer;
+    int error;
+
+    if (!buffer)
+        return -1;
+
+    clear_buffer(buffer, SECTOR_SIZE);
+    commit->magic = JOURNAL_COMMIT_MAGIC;
+    commit->sequence = sequence;
+    commit->num_sectors = writer->total;
+    commit->checksum = writer->checksum;
+    error = write_sectors_to_storage_disk(journal_start + head, 1, buffer);
+    object_free(buffer);
+
+    if (!error)
+        head++;
+
+    return error;
+}
+
+/**
+ * @brief Start (or nest in) a transaction. Sectors written to the buffer
+ * cache from now on are pinned until the outermost journal_end().
+ */
+int journal_begin(void) {
+    if (!journal_sectors)
+        return 0;
+
+    if (!depth++)
+        bcache_pin_writes(true);
+
+    return 0;
+}
+
+/**
+ * @brief End a transaction. Ending the outermost one commits it: all the
+ * sectors it wrote are logged, followed by a commit record, and then
+ * unpinned so that the buffer cache can write them back to their home
+ * locations.
+ */
+int journal_end(void) {
+    struct journal_writer writer = { 0, 2166136261U, 0 };
+    uint32_t needed;
+    int n;
+
+    if (!journal_sectors || !depth || --depth)
+        return 0;
+
+    bcache_pin_writes(false);
+
+    n = bcache_num_pinned();
+    if (!n)
+        return 0;
+
+    needed = n + (n + JOURNAL_DESC_MAX_SECTORS - 1) / JOURNAL_DESC_MAX_SECTORS + 1;
+    if (needed > journal_sectors - 1) {
+        // Can never fit. Write it in place, unprotected.
+        print_string("journal: transaction too big, writing it unjournaled.\n");
+        bcache_unpin_all();
+        return bcache_sync();
+    }
+
+    // Make room by checkpointing the transactions already in the journal.
+    // This writes back everything except the (still pinned) new transaction.
+    if (head + needed > journal_sectors && journal_checkpoint())
+        goto error;
+
+    if (bcache_for_each_pinned(__log_sector, &writer) || __flush_staged(&writer) ||
+        __write_commit(&writer))
+        goto error;
+
+    stats.transactions++;
+    stats.sectors_logged += writer.total;
+    sequence++;
+    bcache_unpin_all();
+
+    return 0;
+
+error:
+    // Leave the sectors in the cache (unpinned) so the changes aren't lost
+    // while the system is up, but they are not crash safe.
+    print_string("journal: commit failed.\n");
+    bcache_unpin_all();
+    return -1;
+}
+
+/**
+ * @brief Write every committed sector back to its home location and empty
+ * the journal. Sectors of an open transaction stay pinned in the cache.
+ */
+int journal_checkpoint(void) {
+    if (bcache_sync())
+        return -1;
+
+    if (!journal_sectors || head == 1)
+        return 0;
+
+    if (__write_header())
+        return -1;
+
+    head = 1;
+    stats.checkpoints++;
+
+    return 0;
+}
+
+/**
+ * @brief Check that the transaction at offset pos of the journal is fully
+ * committed.
+ *
+ * @param pos
+ * @param seq
+ * @param next set to the offset following the transaction's commit record.
+ * @return 0 if it is, -1 if it isn't (or couldn't be read).
+ */
+static int __verify_transaction(uint32_t pos, uint32_t seq, uint32_t *next) {
+    struct journal_descriptor *desc = __staged_descriptor();
+    uint32_t checksum = 2166136261U, total = 0;
+
+    while (pos < journal_sectors) {
+        if (read_from_storage_disk(journal_start + pos, SECTOR_SIZE, staging))
+            return -1;
+
+        if (desc->magic == JOURNAL_COMMIT_MAGIC) {
+            struct journal_commit *commit = (struct journal_commit *) staging;
+
+            if (commit->sequence != seq || commit->num_sectors != total ||
+                commit->checksum != checksum)
+                return -1;
+
+            *next = pos + 1;
+            return 0;
+        }
+
+        if (desc->magic != JOURNAL_DESC_MAGIC || desc->sequence != seq ||
+            !desc->num_sectors || desc->num_sectors > JOURNAL_DESC_MAX_SECTORS ||
+            pos + 1 + desc->num_sectors >= journal_sectors)
+            return -1;
+
+        if (read_from_storage_disk(journal_start + pos + 1, desc->num_sectors * SECTOR_SIZE,
+                                   staging + SECTOR_SIZE))
+            return -1;
+
+        checksum = __checksum(checksum, staging + SECTOR_SIZE, desc->num_sectors * SECTOR_SIZE);
+        total += desc->num_sectors;
+        pos += 1 + desc->num_sectors;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Write the (verified) transaction at offset pos of the journal back
+ * to the home locations of its sectors.
+ *
+ * @param pos
+ * @param end offset of the transaction's commit record.
+ */
+static int __apply_transaction(uint32_t pos, uint32_t end) {
+    struct journal_descriptor *desc = __staged_descriptor();
+
+    while (pos < end) {
+        if (read_from_storage_disk(journal_start + pos, SECTOR_SIZE, staging))
+            return -1;
+        if (read_from_storage_disk(journal_start + pos + 1, desc->num_sectors * SECTOR_SIZE,
+                                   staging + SECTOR_SIZE))
+            return -1;
+
+        for (int i = 0; i < desc->num_sectors; i++) {
+            bcache_invalidate(desc->lbas[i], 1);
+            if (write_sectors_to_storage_disk(desc->lbas[i], 1, staging + (1 + i) * SECTOR_SIZE))
+                return -1;
+        }
+
+        pos += 1 + desc->num_sectors;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Replay the committed transactions left in the journal (by a crash)
+ * and empty it. Called at mount, before anything else reads the metadata.
+ */
+int journal_replay(void) {
+    struct journal_header *header = (struct journal_header *) staging;
+    uint32_t pos = 1;
+
+    if (!journal_sectors)
+        return 0;
+
+    if (read_from_storage_disk(journal_start, SECTOR_SIZE, staging)) {
+        print_string("journal: failed to read header.\n");
+        return -1;
+    }
+
+    if (header->magic != JOURNAL_MAGIC) {
+        // A new volume: start an empty journal.
+        sequence = 1;
+        head = 1;
+        return __write_header();
+    }
+
+    sequence = header->sequence;
+    while (pos < journal_sectors) {
+        uint32_t next;
+
+        if (__verify_transaction(pos, sequence, &next))
+            break;
+
+        if (__apply_transaction(pos, next - 1)) {
+            print_string("journal: failed to replay transaction.\n");
+            return -1;
+        }
+
+        stats.replayed++;
+        sequence++;
+        pos = next;
+    }
+
+    if (stats.replayed) {
+        print_string("journal: replayed ");
+        print_int32(stats.replayed);
+        print_string(" transactions.\n");
+    }
+
+    // Everything committed is home now, so the journal can start over.
+    head = 1;
+    return __write_header();
+}
+
+void journal_get_stats(struct journal_stats *out) {
+    *out = stats;
+}
+
+/**
+ * @brief Set up the journal, which occupies num_sectors sectors starting at
+ * start_sector. A volume without a journal has num_sectors == 0, in which
+ * case transactions are no-ops.
+ *
+ * @param start_sector
+ * @param num_sectors
+ */
+void init_journal(lba_t start_sector, uint32_t num_sectors) {
+    clear_buffer((uint8_t *) &stats, sizeof(stats));
+    journal_start = start_sector;
+    journal_sectors = 0;
+    depth = 0;
+    head = 1;
+    sequence = 1;
+
+    if (num_sectors < 2 + JOURNAL_STAGING_SECTORS)
+        return;
+
+    if (!staging) {
+        staging = object_alloc(JOURNAL_STAGING_SECTORS * SECTOR_SIZE);
+        if (!staging) {
+            print_string("journal: unable to allocate staging buffer.\n");
+            return;
+        }
+    }
+
+    journal_sectors = num_sectors;
+}
@@ -0,0 +1,69 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <drivers/disk/disk.h>
+#include <kernel/system.h>
+
+/**
+ * Write-ahead metadata journal.
+ *
+ * Metadata written through the buffer cache between journal_begin() and
+ * journal_end() makes up a transaction. Its sectors are pinned in the cache
+ * until journal_end(), which copies them to the journal region (descriptor
+ * sectors listing their home lbas, followed by the sectors themselves) in
+ * one sequential write and then writes a commit record. Only then are they
+ * allowed back to their home locations. File content is written straight to
+ * disk before the commit, so committed metadata never points at garbage.
+ *
+ * Journal region layout (journal_start_sector, journal_num_sectors in the
+ * master record):
+ *
+ * | journal_header | txn | txn | ... |
+ *
+ * where each txn is | descriptor | data ... | [descriptor | data ...] | commit |.
+ *
+ * At mount, journal_replay() writes back every transaction whose commit
+ * record is intact (in sequence order, starting at the header's sequence).
+ * Once all committed sectors have reached their home locations (a
+ * checkpoint), the header's sequence is moved on, which empties the journal.
+ */
+#define JOURNAL_MAGIC           0x4C4E524A  // "JRNL"
+#define JOURNAL_DESC_MAGIC      0x4353444A  // "JDSC"
+#define JOURNAL_COMMIT_MAGIC    0x544D434A  // "JCMT"
+
+struct journal_header {
+    uint32_t magic;
+    uint32_t sequence;              // Sequence number of the first transaction to replay.
+}__attribute__((packed));
+
+#define JOURNAL_DESC_MAX_SECTORS ((SECTOR_SIZE - 3 * sizeof(uint32_t)) / sizeof(lba_t))
+
+struct journal_descriptor {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t num_sectors;           // Number of data sectors following this descriptor.
+    lba_t lbas[JOURNAL_DESC_MAX_SECTORS];
+}__attribute__((packed)); // sizeof = 12 + 4 * 125 = 512
+
+struct journal_commit {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t num_sectors;           // Total data sectors in the transaction.
+    uint32_t checksum;              // Over all of the transaction's data sectors.
+}__attribute__((packed));
+
+struct journal_stats {
+    uint32_t transactions;
+    uint32_t sectors_logged;
+    uint32_t checkpoints;
+    uint32_t replayed;              // Transactions replayed at mount.
+};
+
+int journal_begin(void);
+int journal_end(void);
+int journal_checkpoint(void);
+int journal_replay(void);
+void journal_get_stats(struct journal_stats *);
+void init_journal(lba_t, uint32_t);
+
+#endif /* __JOURNAL_H__ */
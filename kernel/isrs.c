@@ -1,6 +1,7 @@
 #include "isrs.h"
 #include "print.h"
 #include "system.h"
+#include "task.h"
 
 #define __PAUSE_ON_FAULT__
 
@@ -48,6 +49,10 @@ const char exception_message_part_1[] = "Fault: msg=[";
 const char exception_message_part_2[] = "],code=[";
 const char exception_message_part_3[] = "]\n";
 
+#define PAGE_FAULT_INT_NO 14
+// Page fault error code bits.
+#define PAGE_FAULT_PRESENT 0x1      // Set for protection violations, clear for non-present pages.
+
 #ifdef CONFIG32
 void __install_isrs(void) {
     set_idt_entry(0,  addr_to_u32(&isr0),  0x08, 0x8E);
@@ -121,12 +126,34 @@ void __install_isrs64(void) {
     set_idt64_entry(31, addr_to_u64(&asm_isr64_31), 0x08, 0x0, 0x8E);
 }
 
+/**
+ * page_fault_handler - Handler for page faults (ISR 14). The first access to
+ * a page of the running task faults because the page isn't mapped yet; it is
+ * resolved by bringing the page in. Anything else is a real fault.
+ *
+ * @err_code: error code pushed by the processor.
+ * @return 0 if the faulting access can be retried, -1 otherwise.
+ */
+static int page_fault_handler(unsigned long err_code) {
+    unsigned long va;
+
+    if (err_code & PAGE_FAULT_PRESENT)
+        return -1;
+
+    __asm__ __volatile__("mov %%cr2, %0" : "=r" (va));
+
+    return handle_task_page_fault((va_t)va);
+}
+
 /**
  * fault_handler - Handler for CPU exceptions.
  * 
  * @regs: Register values pushed to the stack.
  */
 void fault_handler(struct registers* regs) {
+    if (regs->int_no == PAGE_FAULT_INT_NO && !page_fault_handler(regs->err_code))
+        return;
+
     print_string(exception_message_part_1);
     print_string(exception_messages[regs->int_no]);
     print_string(exception_message_part_2);
@@ -140,6 +167,9 @@ void fault_handler(struct registers* regs) {
 
 void fault_handler64(struct registers64* regs) {
     // while(1);
+    if (regs->int_no == PAGE_FAULT_INT_NO && !page_fault_handler(regs->err_code))
+        return;
+
     print_string(exception_message_part_1);
     print_string(exception_messages[regs->int_no]);
     print_string(exception_message_part_2);
@@ -166,6 +166,34 @@ void outsl(unsigned short port, void *buf, int nr) {
     asm volatile("cld\n\trep outsl\n\t"::"d"(port), "S"(buf), "c"(nr));
 }
 
+/**
+ * interrupts_enabled - check whether maskable interrupts are enabled.
+ *
+ * @returns: true if the interrupt flag (IF, bit 9 of EFLAGS) is set.
+ */
+bool interrupts_enabled(void) {
+    unsigned long flags;
+
+#ifdef CONFIG32
+    asm volatile("pushfl\n\tpopl %0" : "=r" (flags));
+#else
+    asm volatile("pushfq\n\tpopq %0" : "=r" (flags));
+#endif
+
+    return (flags & (1 << 9)) ? true : false;
+}
+
+/**
+ * wait_for_interrupt - enable interrupts and halt until the next one arrives.
+ *
+ * sti only takes effect after the following instruction, so no interrupt can
+ * be taken between the two. This makes it safe to call with interrupts
+ * disabled right after checking a condition an interrupt handler will change.
+ */
+void wait_for_interrupt(void) {
+    asm volatile("sti\n\thlt" ::: "memory");
+}
+
 int bit_scan_forward(unsigned int val) {
     int idx;
 
@@ -8,8 +8,8 @@
  * calls read data into/out of registers. 
  */
 unsigned char port_byte_in(unsigned short);
-unsigned char port_word_in(unsigned short);
-unsigned char port_long_in(unsigned short);
+unsigned short port_word_in(unsigned short);
+unsigned long port_long_in(unsigned short);
 void port_byte_out(unsigned short, unsigned char);
 void port_word_out(unsigned short, unsigned short);
 void port_long_out(unsigned short, unsigned long);
@@ -25,5 +25,12 @@ void outsb(unsigned short port, void *buf, int nr);
 void outsw(unsigned short port, void *buf, int nr);
 void outsl(unsigned short port, void *buf, int nr);
 
-int bit_scan_forward(unsigned char *ptr);
-int bit_scan_reverse64(uint64_t ptr);
+/**
+ * Ops for checking and waiting on interrupts.
+ */
+bool interrupts_enabled(void);
+void wait_for_interrupt(void);
+
+int bit_scan_forward(unsigned int val);
+int bit_scan_reverse32(uint32_t val);
+int bit_scan_reverse64(uint64_t val);
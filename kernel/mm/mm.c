@@ -83,6 +83,8 @@ unsigned int user_page_directory[USER_PAGE_DIR_SIZE]__attribute__((aligned(0x100
 static unsigned int user_page_tables[USER_PAGE_DIR_SIZE][USER_PAGE_TABLE_SIZE]__attribute__((aligned(0x1000)));
 
 struct memory_object_cache memory_object_caches[MEMORY_OBJECT_ORDER_RANGE + 1]; // +1 is for  NULL-termination
+static struct memory_object_cache named_object_caches[MAX_NAMED_OBJECT_CACHES];
+static int num_named_object_caches = 0;
 
 /**
  * map_va_range_to_pa_range - Map a contiguos block of virtual memory to a contiguous block of
@@ -180,15 +182,17 @@ int get_next_free_user_page(void) {
     return -1;
 }
 
-int reserve_and_map_user_memory(va_t va, pa_t pa, unsigned int amount) {
-    int num_pages;
-    int page_idx;
-    int i;
-
+/**
+ * check_user_memory - Check that a range of user memory follows our policies.
+ *
+ * @va: virtual address the range starts at.
+ * @pa: physical address backing va.
+ * @amount: length of the range.
+ */
+static int check_user_memory(va_t va, pa_t pa, unsigned int amount) {
     // Verify requested physical address is not in [0, _bss_end)
     if (pa < (pa_t)_bss_end)
         return -1;
-    page_idx = pa >> 12;
 
     // Our arbitrary policy is that programs should expect to start at
     // addresses no less than 250MB.
@@ -197,6 +201,18 @@ int reserve_and_map_user_memory(va_t va, pa_t pa, unsigned int amount) {
 
     if (amount > 3 * 0x40000000U)
         return -1;
+
+    return 0;
+}
+
+int reserve_and_map_user_memory(va_t va, pa_t pa, unsigned int amount) {
+    int num_pages;
+    int page_idx;
+    int i;
+
+    if (check_user_memory(va, pa, amount))
+        return -1;
+    page_idx = pa >> 12;
     num_pages = amount / PAGE_SIZE;
 
     for (i = page_idx; i < page_idx + num_pages; i++)
@@ -207,6 +223,23 @@ int reserve_and_map_user_memory(va_t va, pa_t pa, unsigned int amount) {
     return 0;
 }
 
+/**
+ * reserve_and_map_user_page - Reserve a single physical page and map it into
+ * the user page tables. The caller is responsible for flushing the TLB.
+ *
+ * @va: virtual address of the page.
+ * @pa: physical address of the page.
+ */
+int reserve_and_map_user_page(va_t va, pa_t pa) {
+    if (check_user_memory(va, pa, PAGE_SIZE))
+        return -1;
+
+    mark_page_used(pa >> 12);
+    map_va_range_to_pa_range(user_page_tables, va, (va_range_sz_t)PAGE_SIZE, pa, 0x7);
+
+    return 0;
+}
+
 int unreserve_and_unmap_user_memory(va_t va, pa_t pa, unsigned int amount) {
     int num_pages;
     int page_idx;
@@ -472,124 +505,228 @@ void init_page_usage_bitmap(void) {
 }
 
 /**
- * @brief Insert new object at the head of free list.
+ * @brief Insert a slab at the head of one of its cache's slab lists.
  *
- * @param cache
- * @param new_mo
+ * @param list
+ * @param slab
  */
-static void object_prepend_free(struct memory_object_cache *cache, struct memory_object *new_mo) {
-    new_mo->header.next = cache->free_objects;
-    cache->free_objects = new_mo;
-    cache->free++;
+static void slab_list_prepend(struct memory_object_slab **list, struct memory_object_slab *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list)
+        (*list)->prev = slab;
+    *list = slab;
 }
 
 /**
- * @brief Insert new object at the head of used list.
+ * @brief Remove a slab from the slab list it is on.
  *
- * @param cache
- * @param new_mo
+ * @param list
+ * @param slab
  */
-static void object_prepend_used(struct memory_object_cache *cache, struct memory_object *new_mo) {
-    new_mo->header.next = cache->used_objects;
-    cache->used_objects = new_mo;
-    cache->used++;
+static void slab_list_remove(struct memory_object_slab **list, struct memory_object_slab *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+
+    slab->prev = NULL;
+    slab->next = NULL;
 }
 
 /**
- * @brief Extract object at the head of free list. For removal
- * from the free list, this is okay as any free object would work
- * - so just do the simple thing and take the first one.
+ * @brief Get a new slab for a cache from the zone allocator and carve it up
+ * into free (constructed) objects. The slab is put on the cache's empty list.
  *
  * @param cache
- * @return struct memory_object*
+ * @return the slab, or NULL if the zone allocator is out of memory.
  */
-static struct memory_object *object_remove_free(struct memory_object_cache *cache) {
-    struct memory_object *mo = cache->free_objects;
+static struct memory_object_slab *slab_create(struct memory_object_cache *cache) {
+    const int first = ((sizeof(struct memory_object_slab) + cache->header_size + cache->align - 1) &
+                       ~(cache->align - 1)) - cache->header_size;
+    struct memory_object_slab *slab;
+    struct mem_block *block;
+    uint8_t *header_addr, *end;
+
+    block = zone_alloc(MEMORY_OBJECT_SLAB_SIZE);
+    if (!block) {
+        // Memory is tight: give back every cache's spare slabs and retry.
+        object_shrink_caches();
+        block = zone_alloc(MEMORY_OBJECT_SLAB_SIZE);
+        if (!block)
+            return NULL;
+    }
 
-    if (!mo)
-        return NULL;
+    slab = (struct memory_object_slab *) block->addr;
+    slab->cache = cache;
+    slab->block = block;
+    slab->free_objects = NULL;
+    slab->free = 0;
+
+    // The first object is aligned (the slab itself is page aligned), and so
+    // are the rest as the stride is a multiple of the alignment.
+    header_addr = (uint8_t *) block->addr + first;
+    end = (uint8_t *) block->addr + MEMORY_OBJECT_SLAB_SIZE;
+    for (; header_addr + cache->header_size + cache->object_size <= end; header_addr += cache->stride) {
+        struct memory_object *mo = (struct memory_object *) header_addr;
+
+        // Named caches' objects only have room for the link.
+        if (cache->order) {
+            mo->header.order = cache->order;
+            mo->header.size = cache->object_size;
+        }
+        if (cache->ctor)
+            cache->ctor(header_addr + cache->header_size);
 
-    cache->free_objects = cache->free_objects->header.next;
-    cache->free--;
+        mo->header.next = slab->free_objects;
+        slab->free_objects = mo;
+        slab->free++;
+    }
+    slab->total = slab->free;
 
-    mo->header.next = NULL;
+    slab_list_prepend(&cache->empty_slabs, slab);
+    cache->free += slab->total;
+    cache->num_slabs++;
+    cache->num_empty_slabs++;
 
-    return mo;
+    return slab;
 }
 
 /**
- * @brief Extract object from the list of used objects. Here, unlike with the free list,
- * we are extracting a specific object so we need to traverse the list.
+ * @brief Give an empty slab back to the zone allocator.
  *
  * @param cache
- * @param addr
- * @return struct memory_object*
+ * @param slab
  */
-static struct memory_object *object_remove_used(struct memory_object_cache *cache, uint8_t *addr) {
-    struct memory_object *mo = cache->used_objects;
-    struct memory_object *prev_mo;
-    uint8_t *mo_addr;
+static void slab_destroy(struct memory_object_cache *cache, struct memory_object_slab *slab) {
+    slab_list_remove(&cache->empty_slabs, slab);
+    cache->free -= slab->total;
+    cache->num_slabs--;
+    cache->num_empty_slabs--;
 
-    if (!mo)
-        return NULL;
+    zone_free(slab->block);
+}
 
-    mo_addr = (uint8_t *)(cache->used_objects) + sizeof(struct memory_object_header);
-    if (mo_addr == addr) {
-        cache->used_objects = cache->used_objects->header.next;
-        cache->used--;
+/**
+ * @brief Allocate a free object from a given cache, preferring partially
+ * full slabs, then empty ones, and growing the cache by a slab if need be.
+ *
+ * @param cache
+ * @return uint8_t*
+ */
+static uint8_t *__object_alloc(struct memory_object_cache* cache) {
+    struct memory_object_slab *slab = cache->partial_slabs;
+    struct memory_object* mo;
 
-        mo->header.next = NULL;
+    if (!slab) {
+        slab = cache->empty_slabs;
+        if (!slab && !(slab = slab_create(cache)))
+            return NULL;
 
-        return mo;
+        slab_list_remove(&cache->empty_slabs, slab);
+        slab_list_prepend(&cache->partial_slabs, slab);
+        cache->num_empty_slabs--;
     }
 
-    prev_mo = mo;
-    mo = prev_mo->header.next;
-    mo_addr = (uint8_t *)(mo) + sizeof(struct memory_object_header);
-    while (mo && mo_addr != addr) {
-        prev_mo = mo;
-        mo = mo->header.next;
-        mo_addr = (uint8_t *)(mo) + sizeof(struct memory_object_header);
+    mo = slab->free_objects;
+    slab->free_objects = mo->header.next;
+    slab->free--;
+    if (!slab->free) {
+        slab_list_remove(&cache->partial_slabs, slab);
+        slab_list_prepend(&cache->full_slabs, slab);
     }
 
-    if (!mo) {
-        print_string("cache-"); print_int32(cache->order);
-        print_string(" has no used mo for addr="); print_int32((pa_t)addr);
-        print_string("\n");
-        return NULL;
+    mo->header.slab = slab;
+    cache->free--;
+    cache->used++;
+    return (uint8_t *)(mo) + cache->header_size;
+}
+
+/**
+ * @brief Return an object (given by its header) to its slab, giving the slab
+ * back to the zone allocator if it becomes one empty slab too many.
+ *
+ * @param cache
+ * @param mo
+ */
+static void __object_free(struct memory_object_cache *cache, struct memory_object *mo) {
+    struct memory_object_slab *slab = mo->header.slab;
+
+    if (!slab->free) {
+        slab_list_remove(&cache->full_slabs, slab);
+        slab_list_prepend(&cache->partial_slabs, slab);
     }
 
-    prev_mo->header.next = mo->header.next;
+    mo->header.next = slab->free_objects;
+    slab->free_objects = mo;
+    slab->free++;
+    cache->free++;
     cache->used--;
 
-    mo->header.next = NULL;
+    if (slab->free == slab->total) {
+        slab_list_remove(&cache->partial_slabs, slab);
+        slab_list_prepend(&cache->empty_slabs, slab);
+        cache->num_empty_slabs++;
 
-    return mo;
+        if (cache->num_empty_slabs > MEMORY_OBJECT_EMPTY_SLABS)
+            slab_destroy(cache, slab);
+    }
 }
 
 /**
- * @brief Allocate a free object from a given cache.
+ * @brief Check that the header of an object about to be freed points at a
+ * slab of cache. The header of a free object points at another object (or
+ * nowhere), whose first field is never a cache pointer.
  *
  * @param cache
- * @return uint8_t*
+ * @param mo
+ * @param addr the object, for the error message.
  */
-static uint8_t *__object_alloc(struct memory_object_cache* cache) {
-    struct memory_object* mo;
+static bool object_is_used(struct memory_object_cache *cache, struct memory_object *mo, void *addr) {
+    if (cache && mo->header.slab && mo->header.slab->cache == cache)
+        return true;
 
-    if (!cache->free_objects)
-        return NULL;
+    print_string("object_free: no used mo for addr="); print_int32((pa_t)addr);
+    print_string("\n");
+    return false;
+}
 
-    mo = object_remove_free(cache);
-    if (!mo)
-        return NULL;
+/**
+ * @brief Allocate a large object: a zone block of its own, big enough for the
+ * header and sz bytes.
+ *
+ * @param sz
+ * @return uint8_t*
+ */
+static uint8_t *object_alloc_large(int sz) {
+    struct memory_object_header *moh;
+    struct mem_block *block;
+
+    block = zone_alloc(sz + sizeof(struct memory_object_header));
+    if (!block) {
+        object_shrink_caches();
+        block = zone_alloc(sz + sizeof(struct memory_object_header));
+        if (!block)
+            return NULL;
+    }
+
+    moh = (struct memory_object_header *) block->addr;
+    moh->block = block;
+    moh->order = MEMORY_OBJECT_LARGE_ORDER;
+    moh->size = sz;
 
-    object_prepend_used(cache, mo);
-    return (uint8_t *)(mo) + sizeof(struct memory_object_header);
+    return (uint8_t *)(moh) + sizeof(struct memory_object_header);
 }
 
 /**
  * @brief Allocate a memory object of size greater than or equal to sz.
  *
+ * Objects up to 2^MAX_MEMORY_OBJECT_ORDER bytes come from the object caches,
+ * bigger ones straight from the zone allocator (rounded up to a power of two
+ * number of pages). Either way they are freed with object_free.
+ *
  * @param sz
  * @return uint8_t*
  */
@@ -601,7 +738,7 @@ uint8_t *object_alloc(int sz) {
         order++;
 
     if (order > MAX_MEMORY_OBJECT_ORDER)
-        return NULL;
+        return object_alloc_large(sz);
 
     cache = &memory_object_caches[order - MIN_MEMORY_OBJECT_ORDER];
 
@@ -629,69 +766,90 @@ static struct memory_object_header *get_header(uint8_t *addr) {
 void object_free(uint8_t *addr) {
     struct memory_object_cache *cache;
     struct memory_object_header *moh;
-    struct memory_object *mo;
 
     if (!addr)
         return;
 
     moh = get_header(addr);
-    cache = &memory_object_caches[moh->order - MIN_MEMORY_OBJECT_ORDER];
+    if (moh->order == MEMORY_OBJECT_LARGE_ORDER) {
+        if (!moh->block || (uint8_t *) moh->block->addr != (uint8_t *) moh) {
+            print_string("object_free: no used mo for addr="); print_int32((pa_t)addr);
+            print_string("\n");
+            return;
+        }
 
-    mo = object_remove_used(cache, addr);
-    if (!mo)
+        // Clear the order so that freeing again is caught.
+        moh->order = 0;
+        zone_free(moh->block);
         return;
+    }
 
-    object_prepend_free(cache, mo);
-}
+    if (moh->order < MIN_MEMORY_OBJECT_ORDER || moh->order > MAX_MEMORY_OBJECT_ORDER)
+        cache = NULL;
+    else
+        cache = &memory_object_caches[moh->order - MIN_MEMORY_OBJECT_ORDER];
+
+    if (!object_is_used(cache, (struct memory_object *) moh, addr))
+        return;
 
-void init_memory_object(struct memory_object *object, const int order, const int size, struct memory_object *next_obj) {
-    object->header.order = order;
-    object->header.size = size;
-    object->header.next = next_obj;
+    __object_free(cache, (struct memory_object *) moh);
 }
 
-void memory_object_cache_init(struct memory_object_cache *cache, int order) {
-    int init_object_count = 0, consumed = 0, skip_size;
-    uint8_t *header_addr, *next_header_addr;
-    struct mem_block *object_block;
-    int object_block_size;
-
-    object_block = zone_alloc(ORDER_SIZE(_highest_initialized_zone_order));
-    if (!object_block) {
-        print_string("Cache init failed on __zone_alloc for ");
-        print_int32(order);
-        print_string("\n");
-        return;
+/**
+ * @brief Give every cache's empty slabs back to the zone allocator.
+ */
+void object_shrink_caches(void) {
+    for (int i = 0; i <= MEMORY_OBJECT_ORDER_RANGE; i++) {
+        struct memory_object_cache *cache = &memory_object_caches[i];
+
+        while (cache->empty_slabs)
+            slab_destroy(cache, cache->empty_slabs);
     }
-    object_block_size = ORDER_SIZE(object_block->order);
-    skip_size = sizeof(struct memory_object_header) + (1 << order);
 
-    if (skip_size > object_block_size)
-        return;
+    for (int i = 0; i < num_named_object_caches; i++) {
+        struct memory_object_cache *cache = &named_object_caches[i];
 
-    header_addr = NULL;
-    next_header_addr = (uint8_t *) object_block->addr;
+        while (cache->empty_slabs)
+            slab_destroy(cache, cache->empty_slabs);
+    }
+}
 
-    cache->free_objects = (struct memory_object *) next_header_addr;
-    cache->object_block_ptr = object_block;
-    cache->object_size = 1 << order;
-    cache->used_objects = NULL;
-    cache->order = order;
+/**
+ * @brief Set up an (empty) cache of objects of size bytes, each preceded by
+ * header_size bytes.
+ */
+static void __object_cache_init(struct memory_object_cache *cache, const char *name, int size,
+                                int header_size, int align, void (*ctor)(void *)) {
+    cache->name = name;
+    cache->partial_slabs = NULL;
+    cache->empty_slabs = NULL;
+    cache->full_slabs = NULL;
+    cache->ctor = ctor;
+    cache->object_size = size;
+    cache->header_size = header_size;
+    cache->align = align;
+    cache->stride = (header_size + size + align - 1) & ~(align - 1);
+    cache->order = 0;
     cache->free = 0;
     cache->used = 0;
+    cache->num_slabs = 0;
+    cache->num_empty_slabs = 0;
+}
 
-    do {
-        header_addr = next_header_addr;
-        next_header_addr = header_addr + skip_size;
-
-        init_memory_object((struct memory_object*)header_addr, cache->order, cache->object_size, (struct memory_object *) next_header_addr);
-        cache->free++;
+void memory_object_cache_init(struct memory_object_cache *cache, int order) {
+    static const char *names[] = {
+        "object-32", "object-64", "object-128", "object-256", "object-512", "object-1k", "object-2k"
+    };
 
-        init_object_count++;
-        consumed += skip_size;
-    } while (consumed + skip_size < object_block_size);
+    __object_cache_init(cache, names[order - MIN_MEMORY_OBJECT_ORDER], 1 << order,
+                        sizeof(struct memory_object_header), 16, NULL);
+    cache->order = order;
 
-    ((struct memory_object *)header_addr)->header.next = NULL;
+    if (!slab_create(cache)) {
+        print_string("Cache init failed on zone_alloc for ");
+        print_int32(order);
+        print_string("\n");
+    }
 }
 
 static void setup_memory_object_caches(void) {
@@ -706,6 +864,92 @@ static void setup_memory_object_caches(void) {
     }
 }
 
+/**
+ * @brief Create a named cache for objects of exactly size bytes, for a
+ * structure that is allocated often. Its objects are packed much more
+ * densely than object_alloc's power of two sizes allow.
+ *
+ * @param name shown by print_object_cache_stats, not copied.
+ * @param size
+ * @param align alignment of the objects, a power of two up to PAGE_SIZE (e.g.
+ * MEMORY_OBJECT_CACHE_LINE), or 0 for pointer alignment.
+ * @param ctor if not NULL, called on every object when the slab holding it is
+ * created. Objects must be freed in their constructed state.
+ * @return the cache, or NULL if the parameters are bad or there are too many
+ * named caches.
+ */
+struct memory_object_cache *object_cache_create(const char *name, int size, int align, void (*ctor)(void *)) {
+    struct memory_object_cache *cache;
+
+    if (align < (int) sizeof(void *))
+        align = sizeof(void *);
+
+    if (size <= 0 || (align & (align - 1)) || align > PAGE_SIZE ||
+        size > MEMORY_OBJECT_SLAB_SIZE / 4) {
+        print_string("object_cache_create: bad parameters for "); print_string(name);
+        print_string("\n");
+        return NULL;
+    }
+
+    if (num_named_object_caches == MAX_NAMED_OBJECT_CACHES) {
+        print_string("object_cache_create: too many caches.\n");
+        return NULL;
+    }
+
+    cache = &named_object_caches[num_named_object_caches++];
+    __object_cache_init(cache, name, size, sizeof(struct memory_object_slab *), align, ctor);
+
+    return cache;
+}
+
+/**
+ * @brief Allocate an object from a named cache.
+ *
+ * @param cache
+ */
+void *object_cache_alloc(struct memory_object_cache *cache) {
+    return __object_alloc(cache);
+}
+
+/**
+ * @brief Free an object allocated from a named cache.
+ *
+ * @param cache
+ * @param obj
+ */
+void object_cache_free(struct memory_object_cache *cache, void *obj) {
+    struct memory_object *mo;
+
+    if (!obj)
+        return;
+
+    mo = (struct memory_object *) ((uint8_t *) obj - cache->header_size);
+    if (!object_is_used(cache, mo, obj))
+        return;
+
+    __object_free(cache, mo);
+}
+
+static void __print_object_cache_stats(struct memory_object_cache *cache) {
+    print_string(cache->name); print_string(": size=");
+    print_int32(cache->object_size); print_string(" stride=");
+    print_int32(cache->stride); print_string(" used=");
+    print_int32(cache->used); print_string(" free=");
+    print_int32(cache->free); print_string(" slabs=");
+    print_int32(cache->num_slabs); print_string("\n");
+}
+
+/**
+ * @brief Print the usage of object_alloc's caches and of the named caches.
+ */
+void print_object_cache_stats(void) {
+    for (int i = 0; i <= MEMORY_OBJECT_ORDER_RANGE; i++)
+        __print_object_cache_stats(&memory_object_caches[i]);
+
+    for (int i = 0; i < num_named_object_caches; i++)
+        __print_object_cache_stats(&named_object_caches[i]);
+}
+
 bool is_writeable(uint64_t addr) {
     char *ptr = (char *) to_addr_width(addr);
     char old = *ptr;
@@ -43,8 +43,27 @@ struct gdt_info {
 	unsigned short len;
 	unsigned long addr;
 }__attribute__((packed));
+// Objects are carved out of slabs of MEMORY_OBJECT_SLAB_SIZE bytes taken from
+// the zone allocator. A cache grows by a slab when all of its slabs are full,
+// and gives slabs which become empty back to the zone allocator (keeping at
+// most MEMORY_OBJECT_EMPTY_SLABS of them around).
+#define MEMORY_OBJECT_SLAB_SIZE (1 << 16)
+#define MEMORY_OBJECT_EMPTY_SLABS 1
+
+// Allocations bigger than the largest object order get a zone block of their
+// own, with the header at its start and order set to this.
+#define MEMORY_OBJECT_LARGE_ORDER (MAX_MEMORY_OBJECT_ORDER + 1)
+
+// A free object's header links it into its slab's free list. An allocated
+// object's header points back at its slab instead (or at its zone block for
+// large allocations), which is how object_free finds where the object came
+// from (and catches bad and double frees) without any list walk.
 struct memory_object_header {
-	struct memory_object *next;
+	union {
+		struct memory_object *next;
+		struct memory_object_slab *slab;
+		struct mem_block *block;
+	};
 	int order;
 	int size;
 }__attribute__((packed));
@@ -53,14 +72,40 @@ struct memory_object {
 	struct memory_object_header header;
 };
 
-struct memory_object_cache {
-	struct mem_block *object_block_ptr;
+// Sits at the start of the slab's memory, followed by its objects.
+struct memory_object_slab {
+	struct memory_object_cache *cache;	// First, see object_free.
+	struct mem_block *block;
+	struct memory_object_slab *prev;
+	struct memory_object_slab *next;
 	struct memory_object *free_objects;
-	struct memory_object *used_objects;
-	uint16_t object_size;
-	int order;
+	int free;
+	int total;
+};
+
+// Named object caches (see object_cache_create) hold objects of one exact
+// size. Each object is preceded only by the pointer linking it into its
+// slab's free list or, while allocated, pointing back at its slab.
+#define MAX_NAMED_OBJECT_CACHES 16
+#define MEMORY_OBJECT_CACHE_LINE 64
+
+struct memory_object_cache {
+	const char *name;
+	// Slabs with some objects free are allocated from first, to keep the
+	// number of slabs in use down.
+	struct memory_object_slab *partial_slabs;
+	struct memory_object_slab *empty_slabs;
+	struct memory_object_slab *full_slabs;
+	void (*ctor)(void *);	// Run on every object when its slab is created.
+	int object_size;
+	int header_size;		// Bytes in front of each object.
+	int stride;				// Bytes from one object to the next.
+	int align;
+	int order;				// Order of object_alloc's caches, 0 for named caches.
 	int free;
 	int used;
+	int num_slabs;
+	int num_empty_slabs;
 };
 
 void make_gdt_entry(struct gdt_entry* entry,
@@ -79,6 +124,7 @@ void make_gdt64_tss_entry(struct gdt64_tss_entry* entry,
                     char flags);
 unsigned int get_available_memory(void);
 int reserve_and_map_user_memory(va_t va, pa_t pa, unsigned int amount);
+int reserve_and_map_user_page(va_t va, pa_t pa);
 int unreserve_and_unmap_user_memory(va_t va, pa_t pa, unsigned int amount);
 
 struct mem_block *zone_alloc(const int amt);
@@ -86,6 +132,12 @@ void zone_free(struct mem_block *block);
 
 uint8_t* object_alloc(int amt);
 void object_free(uint8_t *va);
+void object_shrink_caches(void);
+
+struct memory_object_cache *object_cache_create(const char *name, int size, int align, void (*ctor)(void *));
+void *object_cache_alloc(struct memory_object_cache *cache);
+void object_cache_free(struct memory_object_cache *cache, void *obj);
+void print_object_cache_stats(void);
 
 void init_mm(void);
 
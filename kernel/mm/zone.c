@@ -50,319 +50,114 @@ static bool zone_initialized(struct order_zone *zone) {
 	return zone_state_set(zone, INITIALIZED);
 }
 
-/**
- * @brief Add block to the end of zone's used_list.
- * 
- * @param zone 
- * @param block 
- */
-static void zone_append_used(struct order_zone *zone, struct mem_block *block) {
-    struct mem_block *used_tail = zone->used_list;
-
-    if (used_tail) {
-        while (used_tail->next)
-            used_tail = used_tail->next;
-        used_tail->next = block;
-    } else {
-        zone->used_list = block;
-    }
-
-    block->next = NULL;
-    block->state = USED;
-    block->order = zone->order;
-
-    zone->used++;
-}
-
 void hlt() {
     while(1);
 }
 
-extern bp();
-
 /**
- * @brief Add block to the end of zone's free_list.
- * 
- * @param zone 
- * @param block 
+ * @brief Get the index of block's mem_block in its pool slice.
+ *
+ * Every zone owns the slice of mem_block_pool that starts at
+ * order * DEFAULT_PAGES_PER_ZONE and has one mem_block per page of the zone,
+ * so the index is the page frame number of the block's first page, counted
+ * from the start of the zone it was carved out of (its trueorder zone).
+ *
+ * @param block
+ * @return uint32_t
  */
-static void zone_append_free(struct order_zone *zone, struct mem_block *block) {
-    struct mem_block *free_tail = zone->free_list;
-
-    int i = 0;
-    if (free_tail) {
-        while (free_tail->next) {
-            if (free_tail->next > 0x100000000ull) {
-                print_int32(i); print_string("[ERROR!]\n");
-                bp();
-            }
-            free_tail = free_tail->next;
-            i += 1;
-        }
-        free_tail->next = block;
-    } else {
-        zone->free_list = block;
-    }
-
-    block->next = NULL;
-    block->state = FREE;
-    block->order = zone->order;
-
-    zone->free++;
+static inline uint32_t block_pfn(const struct mem_block *block) {
+    return block - &mem_block_pool[block->trueorder * DEFAULT_PAGES_PER_ZONE];
 }
 
 /**
- * @brief Add block to the beginning of zone's used_list.
- * 
- * @param zone 
- * @param block 
+ * @brief Get the buddy of a block of a given order.
+ *
+ * Blocks of order n start at page frame numbers that are multiples of 2^n
+ * (see init_order_zone()), so a block's buddy is the one whose pfn differs
+ * from it only in bit n.
+ *
+ * @param block
+ * @param order
+ * @return struct mem_block*
  */
-/* Commenting this out for now as it's not being used generates a warning.
-static void zone_prepend_used(struct order_zone *zone, struct mem_block *block) {
-    block->next = zone->used_list;
-    block->order = zone->order;
-    block->state = USED;
-
-    zone->used_list = block;
-    zone->used++;
+static struct mem_block *get_block_buddy(struct mem_block *block, uint8_t order) {
+    if (block_pfn(block) & (1 << order))
+        return block - (1 << order);
+    return block + (1 << order);
 }
-*/
 
 /**
- * @brief Add block to the end of zone's free_list.
- * 
- * @param zone 
- * @param block 
+ * @brief Add block to the beginning of zone's free_list.
+ *
+ * @param zone
+ * @param block
  */
-static void zone_prepend_free(struct order_zone *zone, struct mem_block *block) {
+static void zone_push_free(struct order_zone *zone, struct mem_block *block) {
+    block->prev = NULL;
     block->next = zone->free_list;
     block->order = zone->order;
     block->state = FREE;
 
+    if (zone->free_list)
+        zone->free_list->prev = block;
     zone->free_list = block;
     zone->free++;
 }
 
-/**
- * @brief Remove block from zone's used_list.
- * 
- * @param zone 
- * @param block 
- */
-static void zone_remove_used(struct order_zone* zone, struct mem_block *block) {
-    struct mem_block *predecessor;
-        
-    if (!zone->used_list) {
-        print_string("The zone's used_list is empty yet we are tring to free block=");
-        print_ptr(block); print_string(", which is BAD.\n");
-        return;
-    }
-
-    if (zone->used_list == block) {
-        zone->used_list = zone->used_list->next;
-        goto done;
-    }
-
-    predecessor = zone->used_list;
-    while(predecessor->next != block) {
-        predecessor = predecessor->next;
-        if (!predecessor) {
-            print_string("Could not find block="); print_ptr(block);
-            print_string(" in the used_list of zone"); print_int32(zone->order);
-            print_string(" which is BAD.\n");
-            return;
-        }
-    }
-
-    predecessor->next = block->next;
-
-done:
-    zone->used--;
-}
-
 /**
  * @brief Remove block from zone's free_list.
- * 
- * @param zone 
- * @param block 
+ *
+ * @param zone
+ * @param block
  */
-static void zone_remove_free(struct order_zone* zone, struct mem_block *block) {
-    struct mem_block *predecessor;
-        
-    if (!zone->free_list) {
-        print_string("The zone's used_list is empty yet we are tring to free block=");
-        print_ptr(block); print_string(", which is BAD.\n");
-        return;
-    }
-
-    if (zone->free_list == block) {
-        zone->free_list = zone->free_list->next;
-        goto done;
-    }
-
-    predecessor = zone->free_list;
-    while(predecessor->next != block) {
-        predecessor = predecessor->next;
-        if (!predecessor) {
-            print_string("Could not find block="); print_ptr(block);
-            print_string(" in the used_list of zone "); print_int32(zone->order);
-            print_string(" which is BAD.\n");
-            return;
-        }
-    }
+static void zone_remove_free(struct order_zone *zone, struct mem_block *block) {
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        zone->free_list = block->next;
 
-    predecessor->next = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
 
-done:
+    block->next = NULL;
+    block->prev = NULL;
     zone->free--;
 }
 
 /**
- * @brief Get the buddy of a block in the context of a zone.
- * 
- * Since a zone has 2^zone->order pages in a block, the buddy of a given block
- * , "in the context of a zone", is 2^zone->order mem_blocks away from the
- * block.
- * 
- * @param zone 
- * @param block 
- * @return struct mem_block* 
- */
-static struct mem_block *get_block_buddy(struct order_zone *zone, struct mem_block *block) {
-    /* 
-        Pointer arithmetic means this gives the index in terms of blocks rather
-        than byte offset.
-    */
-    uint32_t block_pool_index = block - &mem_block_pool[0];
-
-    /*
-    This could be a source of brutal headaches, I'll leave this here to get
-    debug prints going quickly.
-
-    print_string("block="); print_int32(block);
-    print_string(",&mem_block_pool[0]="); print_int32(&mem_block_pool[0]);
-    print_string(",block_pool_index="); print_int32(block_pool_index); print_string("\n");
-    */
-
-    /*
-      I'm not really able to think of the specific reason but I just know
-      that if a block is at an odd index from the start of the pool, it must
-      be the RHS of the pair of buddies, so its buddy would be on the left,
-      requiring subtraction here.
-      Also, 2^zone->order is added or subtracted because a block's buddy is that
-      many blocks away from it.
-    */
-    if (block_pool_index & 0x1)
-        return block - (1 << zone->order);
-    return block + (1 << zone->order);
-}
-
-/**
- * @brief Extract the head of the zone's list of FREE blocks,
- * split it into 2 halves and return them. The blocks are going into the
- * next-lower-order zone (NLOZ).
- * 
+ * @brief Take a FREE block out of a zone, splitting one borrowed from the
+ * next higher order zone (NHOZ) if the zone has none.
+ *
+ * When a block is split, we keep its lower half and the upper half goes on
+ * zone's free_list. Both halves keep the trueorder of the block they were
+ * split from.
+ *
  * @param zone
- * @param block
- * @param block_buddy
+ * @return struct mem_block*
  */
-static void zone_split_head(struct order_zone *zone,
-                     /*out*/struct mem_block **block,
-                     /*out*/struct mem_block **block_buddy) {
-    struct mem_block *old_freelist_head, *old_freelist_head_buddy;
-    unsigned int num_pages_in_split_blocks;
-    struct order_zone *nloz;
-    uint8_t nlo;
-
-    old_freelist_head = zone->free_list;
-    zone_remove_free(zone, old_freelist_head);
-
-    nlo = zone->order - 1;
-    old_freelist_head->order = nlo;
-    
-    num_pages_in_split_blocks = 1 << (nlo);
-    nloz = &order_zones[nlo];
-
-    // Get the buddy of old_free_list_head
-    old_freelist_head_buddy = get_block_buddy(nloz, old_freelist_head);
-    if (old_freelist_head_buddy < old_freelist_head)
-        old_freelist_head_buddy->addr = old_freelist_head->addr - (PAGE_SIZE * num_pages_in_split_blocks);
-    else
-        old_freelist_head_buddy->addr = old_freelist_head->addr + (PAGE_SIZE * num_pages_in_split_blocks);
-    old_freelist_head_buddy->order = nlo;
-    old_freelist_head_buddy->trueorder = old_freelist_head->trueorder;
+static struct mem_block *zone_take_free(struct order_zone *zone) {
+    struct mem_block *block = zone->free_list, *buddy;
 
-    *block = old_freelist_head;
-    *block_buddy = old_freelist_head_buddy;	
-}
-
-/**
- * @brief Try to request that zone splits one of it's FREE blocks into 2 and
- * pass these back in block and block_buddy.
- * 
- * @param zone 
- * @param block 
- * @param block_buddy 
- * @return uint32_t 
- */
-static uint32_t zone_borrow(struct order_zone *zone,
-                            /*out*/ struct mem_block **block,
-                            /*out*/ struct mem_block **block_buddy) {
-    uint32_t error = 0;
-
-    // If the zone's free_list is empty we need to borrow form the next higher
-    // order zone (NHOZ).
-    if (!zone->free_list) {
-        struct mem_block *to_return, *to_keep;
-        uint8_t nho = zone->order + 1;
-        struct order_zone *nhoz;
-        
-        if (nho > _highest_initialized_zone_order)
-            return -1;
-
-        // Get the zone from which we'll request blocks;
-        nhoz = &order_zones[nho];
-
-        error = zone_borrow(nhoz, &to_return, &to_keep);
-        if (error)
-            return -1;
-
-        zone_append_free(zone, to_keep);
-
-        // Insert the new block at the head of the free list so that
-        // it can be split and returned by zone_split_head;
-        zone_prepend_free(zone, to_return);
+    if (block) {
+        zone_remove_free(zone, block);
+        return block;
     }
 
-    zone_split_head(zone, block, block_buddy);
+    if (zone->order + 1 > _highest_initialized_zone_order)
+        return NULL;
 
-    return error;
-}
+    block = zone_take_free(&order_zones[zone->order + 1]);
+    if (!block)
+        return NULL;
 
-/**
- * @brief Re-integrate a block that was previously borrowed by a lower-order zone.
- * 
- * @param zone 
- * @param block 
- */
-static void zone_collect(struct order_zone *zone, struct mem_block *block) {
-    if (zone->order == block->trueorder) {
-        zone_append_free(zone, block);
-    } else {
-        uint8_t nho = zone->order + 1;
-        struct mem_block *buddy;
-        struct order_zone *nhoz;
-
-        nhoz = &order_zones[nho];
-        buddy = get_block_buddy(zone, block);
-        if (buddy->state == USED) {
-            zone_append_free(zone, block);
-        } else {
-            zone_remove_free(zone, buddy);
-            // Tell NHOZ to add this block.
-            zone_collect(nhoz, block);
-        }
-    }
+    buddy = block + (1 << zone->order);
+    buddy->addr = block->addr + ORDER_SIZE(zone->order);
+    buddy->trueorder = block->trueorder;
+    zone_push_free(zone, buddy);
+
+    block->order = zone->order;
+
+    return block;
 }
 
 /**
@@ -372,50 +167,14 @@ static void zone_collect(struct order_zone *zone, struct mem_block *block) {
  * @return struct mem_block* 
  */
 struct mem_block *__zone_alloc(struct order_zone *zone) {
-    struct mem_block *block = NULL;
-    /**
-     * Algorithm:
-     * 
-     * Try to get a block from the free_list:
-     * 		If there is a free block:
-     * 			mark it "USED"
-     * 			move it from the free_list to the used_list.
-     * 			return it
-     * 		Else:
-     * 			Figure out the next higher order zone (NHOZ) order_zones[order+1].
-     * 			If it is <= MAX_ORDER:
-     * 				Try to request that the NHOZ split one if it's freeblocks and give them to us: //<--BIG Q: is this recursive?----------------------------->//
-     * 					If this succeeds:														   //<--Also note that the blocks' "order"s must be changed.-->//
-     * 						Add one block to the free_list, add the other to the used_list and return the other.
-     * 					Else:
-     * 						return NULL.
-     */
-    if (zone->free_list) {
-        block = zone->free_list;
-        zone_remove_free(zone, block);
-        zone_append_used(zone, block);
-    } else {
-        // Try to get 2 blocks from the next higher order zone (NHOZ).
-        struct mem_block *borrowed_block, *borrowed_block_buddy;
-        struct order_zone *nhoz;
-        uint32_t error;
-        uint8_t nho;
-
-        nho = zone->order + 1;
-        if (nho > _highest_initialized_zone_order)
-            goto done;
-    
-        nhoz = &order_zones[nho];
-        error = zone_borrow(nhoz, &borrowed_block, &borrowed_block_buddy);
-        if (error)
-            return NULL;
-
-        zone_append_free(zone, borrowed_block_buddy);
-        zone_append_used(zone, borrowed_block);
-        block = borrowed_block;
-    }
+    struct mem_block *block = zone_take_free(zone);
+
+    if (!block)
+        return NULL;
+
+    block->state = USED;
+    zone->used++;
 
-done:
     return block;
 }
 
@@ -433,55 +192,45 @@ struct mem_block *zone_alloc(const int amt) {
 
 /**
  * @brief Free a block from a zone.
- * 
+ *
+ * While the block is smaller than the block it was split from (its trueorder)
+ * and its buddy is FREE and of the same order, the two are merged. The lower
+ * half's mem_block describes the merged block; the upper half's is marked
+ * MERGED until the block is split again.
+ *
  * @param zone 
  * @param block
- * @return struct mem_block* 
  */
 void __zone_free(struct order_zone *zone, struct mem_block *block) {
-    struct mem_block *buddy;
-    /**
-     * Algorithm:
-     * 
-     * If block->trueorder == block->order:
-     * 		Simply mark the block "FREE".
-     * 		Move it from the current zone's used_list to its free_list.
-     * Else:
-     * 		If this block's buddy is not free:
-     * 			Simply mark the block "FREE".
-     * 			Move it from the current zone's used_list to its free_list.
-     * 			//<--We can only combine them when they are both free.-->//
-     * 			//<--We'll try to do so later.-------------------------->//
-     * 		Else:
-     * 			(Using the left block's mem_block pointer, try to return the
-     * 			block to order_zones[order+1], NHOZ)
-     *			Remove this block from the current zone's used_list. //<--Note that it may not be present in the used_list due to the recursive nature of this free function and that's OK.-->//
-     * 			Set block->order = block->order + 1.
-     * 			Recursively call zone_free(NHOZ, BLOCK)
-     * 			
-     */
-    if (block->trueorder == zone->order) {
-        zone_remove_used(zone, block);
-        zone_append_free(zone, block);
+    uint8_t order = zone->order;
+
+    if (block->state != USED || block->order != order) {
+        print_string("zone: block="); print_ptr(block);
+        print_string(" is not in use in zone "); print_int32(order);
+        print_string(", not freeing it.\n");
         return;
     }
 
-    // block->trueorder != block->order ... the interesting stuff!
-    // Fetch the block's buddy.
-    buddy = get_block_buddy(zone, block);
-    zone_remove_used(zone, block);
-    if (buddy->state == USED) {
-        // Remove the block from the used list and put it in the free list.
-        zone_append_free(zone, block);
-    } else { // Ah, the REALLY interesting stuff!
-        uint8_t nho = zone->order + 1;
-        struct order_zone *nhoz;
-        
-        zone_remove_free(zone, buddy);
-        // Tell NHOZ to add this block.
-        nhoz = &order_zones[nho];
-        zone_collect(nhoz, block);
+    zone->used--;
+
+    while (order < block->trueorder) {
+        struct mem_block *buddy = get_block_buddy(block, order);
+
+        if (buddy->state != FREE || buddy->order != order)
+            break;
+
+        zone_remove_free(&order_zones[order], buddy);
+        if (buddy < block) {
+            struct mem_block *upper = block;
+
+            block = buddy;
+            buddy = upper;
+        }
+        buddy->state = MERGED;
+        order++;
     }
+
+    zone_push_free(&order_zones[order], block);
 }
 
 void zone_free(struct mem_block *block) {
@@ -572,7 +321,6 @@ void init_order_zone(const uint8_t order, const pa_t phy_mem_start, const pa_ran
     /* Initialize the zone. */
     zone->free_list = &mem_block_pool[order * DEFAULT_PAGES_PER_ZONE];
     zone->num_blocks = num_blocks;
-    zone->used_list = NULL;
     zone->used = 0;
     zone->free = 0;
     zone->order = order;
@@ -581,12 +329,14 @@ void init_order_zone(const uint8_t order, const pa_t phy_mem_start, const pa_ran
     /**
      * To index zone->free_list, we must skip num_block_pages mem_blocks as
      * each block spans that many pages. This makes finding a block's buddy and
-     * its corresponding physical address straightforward (see
+     * its corresponding physical address simple arithmetic on its index (see
      * get_block_buddy()).
      */
     for (; block_index < num_blocks; block_index += 1, mem_block_pool_index += num_block_pages) {
         zone->free_list[mem_block_pool_index].addr = phy_mem_start + (num_block_pages * PAGE_SIZE * block_index);
         zone->free_list[mem_block_pool_index].next = &zone->free_list[mem_block_pool_index + num_block_pages];
+        zone->free_list[mem_block_pool_index].prev =
+            block_index ? &zone->free_list[mem_block_pool_index - num_block_pages] : NULL;
         zone->free_list[mem_block_pool_index].trueorder = order;
         zone->free_list[mem_block_pool_index].order = order;
         zone->free_list[mem_block_pool_index].state = FREE;
@@ -11,12 +11,14 @@
 
 enum mem_block_state {
 	FREE,
-	USED
+	USED,
+	MERGED		/* Upper half of a block merged with its buddy.		*/
 };
 
 struct mem_block {
 	enum mem_block_state state;
-	struct mem_block *next;
+	struct mem_block *next;		/* free_list neighbours.			*/
+	struct mem_block *prev;
 	uint8_t order;
 	uint8_t trueorder; /* A block may be split in 2, decrementing its
 						  order by 1. trueorder lets us know to merge this block
@@ -29,8 +31,7 @@ struct mem_block {
 };
 
 struct order_zone {
-	struct mem_block *free_list;	/* List of mem_blocks.					*/
-	struct mem_block *used_list;	/* List of mem_blocks.					*/
+	struct mem_block *free_list;	/* List of FREE mem_blocks.				*/
 	uint64_t phy_mem_start;
 	uint8_t order;					/* Power-of-2 indicator or size of the 	*/
 									/* blocks in this region. The blocks 	*/
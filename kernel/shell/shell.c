@@ -8,12 +8,19 @@
 #include <kernel/string.h>
 #include <kernel/system.h>
 
-#define NUM_KNOWN_COMMANDS 10
+#define NUM_KNOWN_COMMANDS 19
 
 extern struct fnode root_fnode;
 extern struct dir_entry root_dir_entry;
 
 extern void disk_test(void);
+extern void disk_bench(void);
+extern void bitmap_bench(void);
+extern void create_bench(void);
+extern void file_test(void);
+extern void read_bench(void);
+extern void object_bench(void);
+extern void zone_bench(void);
 
 volatile int shell_input_counter_ = 0;
 volatile int last_processed_pos_ = 0;
@@ -34,7 +41,16 @@ static char* known_commands[NUM_KNOWN_COMMANDS] = {
     "disk-id",
     "cd",
     "fidel",
-    "fodel"
+    "fodel",
+    "disk-bench",
+    "bitmap-bench",
+    "sync",
+    "create-bench",
+    "file-test",
+    "read-bench",
+    "object-bench",
+    "cache-stats",
+    "zone-bench"
 };
 static char prompt[MAX_FILENAME_LENGTH + 3];
 static char stub[3] = "$ ";
@@ -195,6 +211,59 @@ static void exec_known_cmd(const int cmd, char *cmdp, char *argsp) {
         }
         break;
     }
+    case 10: { // disk-bench
+        print_string("Running disk_bench.\n");
+        disk_bench();
+
+        break;
+    }
+    case 11: { // bitmap-bench
+        print_string("Running bitmap_bench.\n");
+        bitmap_bench();
+
+        break;
+    }
+    case 12: { // sync
+        if (fs_sync())
+            print_string("Error: sync failed.\n");
+
+        break;
+    }
+    case 13: { // create-bench
+        print_string("Running create_bench.\n");
+        create_bench();
+
+        break;
+    }
+    case 14: { // file-test
+        print_string("Running file_test.\n");
+        file_test();
+
+        break;
+    }
+    case 15: { // read-bench
+        print_string("Running read_bench.\n");
+        read_bench();
+
+        break;
+    }
+    case 16: { // object-bench
+        print_string("Running object_bench.\n");
+        object_bench();
+
+        break;
+    }
+    case 17: { // cache-stats
+        print_object_cache_stats();
+
+        break;
+    }
+    case 18: { // zone-bench
+        print_string("Running zone_bench.\n");
+        zone_bench();
+
+        break;
+    }
     default:
         print_string("don't know what that is sorry :(\n");
     }
@@ -323,9 +392,12 @@ void main_shell_run(void) {
         if (prompt)
             show_prompt();
 
-        // Wait for input from keyboard.
-        while (p == c)
+        // Wait for input from keyboard, writing back filesystem changes
+        // meanwhile.
+        while (p == c) {
+            fs_sync_if_due();
             c = shell_input_counter_;
+        }
 
         prompt = process_new_scancodes(p_mod, c - p);
     }
@@ -1,6 +1,7 @@
 #include "string.h"
 
 #include "drivers/screen/screen.h"
+#include "low_level.h"
 
 void int_to_string(char* s, unsigned int val, int n) {
     char t;
@@ -94,3 +95,72 @@ unsigned char get_bit(const uint8_t* addr, const int nr) {
  
     return sh & *(addr + byte_offset);
 }
+
+/**
+ * @brief Index (0 = most significant) of the first set bit of a non-zero byte,
+ * matching the bit order used by set_bit/get_bit.
+ */
+static inline int __first_bit_in_byte(uint8_t b) {
+    return 7 - bit_scan_reverse32(b);
+}
+
+/**
+ * @brief Find the first bit at or after start which differs from the bits of
+ * skip (0x00 to look for a set bit, 0xFF to look for a clear bit).
+ *
+ * Bytes equal to skip are passed over a byte at a time until addr is 8-byte
+ * aligned, and then 64 bits at a time.
+ */
+static int __find_next_bit(const uint8_t *addr, int size, int start, uint8_t skip) {
+    const uint64_t skip64 = skip ? ~0ULL : 0;
+    int nr = start;
+
+    while (nr < size && (nr & 7)) {
+        if ((addr[nr >> 3] ^ skip) & (0x80 >> (nr & 7)))
+            return nr;
+        nr++;
+    }
+
+    while (nr + 8 <= size && ((unsigned long) &addr[nr >> 3] & 7)) {
+        if (addr[nr >> 3] != skip)
+            return nr + __first_bit_in_byte(addr[nr >> 3] ^ skip);
+        nr += 8;
+    }
+
+    while (nr + 64 <= size && *((const uint64_t *) &addr[nr >> 3]) == skip64)
+        nr += 64;
+
+    while (nr + 8 <= size) {
+        if (addr[nr >> 3] != skip)
+            return nr + __first_bit_in_byte(addr[nr >> 3] ^ skip);
+        nr += 8;
+    }
+
+    while (nr < size) {
+        if ((addr[nr >> 3] ^ skip) & (0x80 >> (nr & 7)))
+            return nr;
+        nr++;
+    }
+
+    return size;
+}
+
+/**
+ * @brief Find the first 0 bit at or after bit start of the size-bit bitmap at
+ * addr.
+ *
+ * @return the bit's index, or size if there is none.
+ */
+int find_next_zero_bit(const uint8_t *addr, int size, int start) {
+    return __find_next_bit(addr, size, start, 0xFF);
+}
+
+/**
+ * @brief Find the first 1 bit at or after bit start of the size-bit bitmap at
+ * addr.
+ *
+ * @return the bit's index, or size if there is none.
+ */
+int find_next_set_bit(const uint8_t *addr, int size, int start) {
+    return __find_next_bit(addr, size, start, 0x00);
+}
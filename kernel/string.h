@@ -19,4 +19,7 @@ void set_bit(uint8_t* addr, const int nr);
 void clear_bit(uint8_t* addr, const int nr);
 unsigned char get_bit(const uint8_t* addr, const int nr);
 
+int find_next_zero_bit(const uint8_t *addr, int size, int start);
+int find_next_set_bit(const uint8_t *addr, int size, int start);
+
 #endif
@@ -1,8 +1,10 @@
 #include "mm/mm.h"
 #include <drivers/disk/disk.h>
+#include <fs/buffer_cache.h>
 #include <fs/filesystem.h>
 #include "print.h"
 #include "string.h"
+#include "timer.h"
 
 extern int _highest_initialized_zone_order;
 
@@ -44,6 +46,38 @@ static bool alloc_free(int sz) {
     return failed;
 }
 
+#define NAMED_CACHE_TEST_MAGIC 0x5A5A5A5A
+
+static void named_cache_test_ctor(void *obj) {
+    *(uint32_t *) obj = NAMED_CACHE_TEST_MAGIC;
+}
+
+/**
+ * @brief Allocate from a cache-line aligned named cache with a constructor
+ * and check that objects come out aligned and constructed.
+ */
+static bool named_cache_test(void) {
+    static struct memory_object_cache *cache = NULL;
+    uint8_t *objects[4];
+    bool failed = false;
+
+    if (!cache)
+        cache = object_cache_create("named-cache-test", 24, MEMORY_OBJECT_CACHE_LINE, named_cache_test_ctor);
+    if (!cache)
+        return true;
+
+    for (int i = 0; i < 4; i++) {
+        objects[i] = object_cache_alloc(cache);
+        failed |= !objects[i] || (addr_to_u64(objects[i]) & (MEMORY_OBJECT_CACHE_LINE - 1)) ||
+                  *(uint32_t *) objects[i] != NAMED_CACHE_TEST_MAGIC;
+    }
+
+    for (int i = 0; i < 4; i++)
+        object_cache_free(cache, objects[i]);
+
+    return failed;
+}
+
 static bool mem_object_test(void) {
     bool failed = false;
 
@@ -57,6 +91,17 @@ static bool mem_object_test(void) {
         }
     }
 
+    // Bigger than any object order: goes straight to the zone allocator.
+    if (alloc_free(3 * PAGE_SIZE)) {
+        failed = true;
+        print_string("a/f failed, large allocation\n");
+    }
+
+    if (named_cache_test()) {
+        failed = true;
+        print_string("a/f failed, named cache\n");
+    }
+
     return failed;
 }
 
@@ -102,7 +147,7 @@ static int block_in_list(struct mem_block *block, struct mem_block *list) {
 }
 
 static bool mem_zone_test_alloc_free(struct order_zone *zone) {
-    int used_presence = 0, free_presence = 0;
+    int free_presence = 0;
     struct mem_block *alloced_block;
     int free_before, free_after;
     int used_before, used_after;
@@ -124,9 +169,8 @@ static bool mem_zone_test_alloc_free(struct order_zone *zone) {
     free_presence = block_in_list(alloced_block, zone->free_list);
     SPIN_ON(free_presence);
 
-    // The allocated blocks must occur among the used blocks exactly once.
-    used_presence = block_in_list(alloced_block, zone->used_list);
-    SPIN_ON(used_presence != 1);
+    // The allocated block must be marked used.
+    SPIN_ON(alloced_block->state != USED);
 
     SPIN_ON(test_read_write(alloced_block));
     free_before = zone->free;
@@ -366,6 +410,601 @@ void disk_test(void) {
     }
 }
 
+/**
+ * @brief Finish a benchmark's report line with " in <ticks> ticks, <rate>
+ * <unit>", where rate is amount per second divided by 2^shift (printed with
+ * one decimal if shift isn't 0).
+ *
+ * @param amount what was done (bytes, KiB, files, ...) in ticks.
+ * @param ticks
+ * @param shift
+ * @param unit
+ */
+static void __report_rate(uint64_t amount, int ticks, int shift, const char *unit) {
+    uint64_t rate;
+
+    if (ticks == 0)
+        ticks = 1;
+#ifndef CONFIG32
+    rate = (amount * DEFAULT_TIMER_FREQUENCY_HZ) / ticks;
+#else
+    rate = udiv(amount * DEFAULT_TIMER_FREQUENCY_HZ, (uint64_t) ticks);
+#endif
+
+    print_string(" in "); print_int32(ticks); print_string(" ticks, ");
+    print_int32((uint32_t) (rate >> shift));
+    if (shift) {
+        print_string(".");
+        print_int32(((rate & ((1ULL << shift) - 1)) * 10) >> shift);
+    }
+    print_string(" "); print_string(unit);
+}
+
+#define DISK_BENCH_BYTES (16 << 20)
+
+/**
+ * @brief Read DISK_BENCH_BYTES from the fnode table region in chunks of the
+ * largest zone block and report the throughput.
+ *
+ * @param mode the disk transfer mode to measure.
+ * @param block buffer to read into.
+ * @param block_size
+ */
+static void __disk_bench_mode(enum disk_transfer_mode mode, struct mem_block *block, int block_size) {
+    const int sectors_per_block = block_size >> SECTOR_SIZE_SHIFT;
+    enum disk_transfer_mode old_mode = disk_get_transfer_mode();
+    int start_time, ticks, error = 0;
+
+    if (disk_set_transfer_mode(mode)) {
+        print_string(mode == DISK_MODE_DMA ? "DMA" : "PIO");
+        print_string(" not available.\n");
+        return;
+    }
+
+    start_time = mark_time();
+    for (int done = 0; done < DISK_BENCH_BYTES; done += block_size) {
+        lba_t lba = master_record.fnode_table_start_sector + (done / block_size) * sectors_per_block;
+
+        error |= read_from_storage_disk(lba, block_size, (uint8_t *) block->addr);
+    }
+    ticks = mark_time() - start_time;
+
+    disk_set_transfer_mode(old_mode);
+
+    print_string(mode == DISK_MODE_DMA ? "DMA: " : "PIO: ");
+    print_int32(DISK_BENCH_BYTES >> 20); print_string("MiB");
+    __report_rate(DISK_BENCH_BYTES >> 10, ticks, 10, "MB/s");
+    print_string(error ? " (read errors)\n" : "\n");
+}
+
+/**
+ * @brief Compare storage disk read throughput with PIO and with bus master DMA.
+ */
+void disk_bench(void) {
+    const int block_size = ORDER_SIZE(_highest_initialized_zone_order);
+    struct mem_block *block = zone_alloc(block_size);
+
+    if (!block) {
+        print_string("disk_bench: unable to allocate buffer.\n");
+        return;
+    }
+
+    __disk_bench_mode(DISK_MODE_PIO, block, block_size);
+    __disk_bench_mode(DISK_MODE_DMA, block, block_size);
+
+    zone_free(block);
+}
+
+#define BITMAP_BENCH_TICKS DEFAULT_TIMER_FREQUENCY_HZ
+
+/**
+ * @brief Report how fast a bitmap of size bytes was scanned by passes
+ * repetitions of a search taking ticks timer ticks.
+ */
+static void __report_scan_rate(const char *what, int size, int passes, int ticks) {
+    print_string(what); print_string(": ");
+    print_int32(passes); print_string(" passes");
+    __report_rate((uint64_t) passes * (size >> 10), ticks, 20, "GB/s");
+    print_string("\n");
+}
+
+/**
+ * @brief Measure the rate at which the free-bit search primitives scan a
+ * mostly full bitmap, against a bit-at-a-time get_bit loop.
+ */
+void bitmap_bench(void) {
+    const int size = ORDER_SIZE(_highest_initialized_zone_order);
+    const int bits = size * BITS_PER_BYTE;
+    struct mem_block *block = zone_alloc(size);
+    int start_time, ticks, passes, found = 0;
+    uint8_t *bitmap;
+
+    if (!block) {
+        print_string("bitmap_bench: unable to allocate bitmap.\n");
+        return;
+    }
+    bitmap = (uint8_t *) block->addr;
+
+    // Full except for the very last bit.
+    fill_byte_buffer(bitmap, 0, size, 0xFF);
+    clear_bit(bitmap, bits - 1);
+
+    start_time = mark_time();
+    for (passes = 0; mark_time() - start_time < BITMAP_BENCH_TICKS; passes++)
+        found |= find_next_zero_bit(bitmap, bits, 0) != bits - 1;
+    ticks = mark_time() - start_time;
+    __report_scan_rate("find_next_zero_bit", size, passes, ticks);
+
+    start_time = mark_time();
+    for (passes = 0; mark_time() - start_time < BITMAP_BENCH_TICKS; passes++) {
+        int bit = 0;
+
+        while (bit < bits && get_bit(bitmap, bit))
+            bit++;
+        found |= bit != bits - 1;
+    }
+    ticks = mark_time() - start_time;
+    __report_scan_rate("get_bit loop", size, passes, ticks);
+
+    if (found)
+        print_string("bitmap_bench: search returned a wrong bit!\n");
+
+    zone_free(block);
+}
+
+extern struct fnode root_fnode;
+extern struct dir_entry root_dir_entry;
+
+/**
+ * @brief Set up a context for working in the root folder, for the fs tests
+ * and benchmarks. Undo with __put_root_context().
+ *
+ * @param ctx
+ * @param who printed with the error message.
+ */
+static int __get_root_context(struct fs_context *ctx, const char *who) {
+    *ctx = (struct fs_context) {
+        .curr_dir_fnode = &root_fnode,
+        .curr_dir_fnode_location = root_dir_entry.fnode_location,
+        .working_directory_chain = init_directory_chain(),
+    };
+
+    if (!ctx->working_directory_chain) {
+        print_string(who);
+        print_string(": unable to create directory chain.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void __put_root_context(struct fs_context *ctx) {
+    destroy_directory_chain(ctx->working_directory_chain);
+}
+
+#define CREATE_BENCH_FILES 64
+
+/**
+ * @brief Create (and then delete) CREATE_BENCH_FILES small files in the root
+ * folder, syncing after every batch files, and report the creation rate.
+ *
+ * @param ctx
+ * @param batch
+ */
+static void __create_bench_batch(struct fs_context *ctx, int batch) {
+    char content[] = "create_bench";
+    struct file_creation_info info;
+    char name[8] = "cb";
+    int start_time, ticks, error = 0;
+
+    fs_sync();
+
+    start_time = mark_time();
+    for (int i = 0; i < CREATE_BENCH_FILES; i++) {
+        int_to_string(&name[2], i, 4);
+
+        clear_buffer((uint8_t *) &info, sizeof(info));
+        memcpy(info.path, name, strlen(name));
+        info.file_content = (uint8_t *) content;
+        info.file_size = strlen(content);
+
+        error |= create_file(ctx, &info);
+        if ((i + 1) % batch == 0)
+            error |= fs_sync();
+    }
+    error |= fs_sync();
+    ticks = mark_time() - start_time;
+
+    for (int i = 0; i < CREATE_BENCH_FILES; i++) {
+        int_to_string(&name[2], i, 4);
+        delete_file(ctx, name);
+    }
+    fs_sync();
+
+    print_string("batch "); print_int32(batch); print_string(": ");
+    print_int32(CREATE_BENCH_FILES); print_string(" files");
+    __report_rate(CREATE_BENCH_FILES, ticks, 0, "files/s");
+    print_string(error ? " (errors)\n" : "\n");
+}
+
+/**
+ * @brief Measure how file creation throughput grows with the number of
+ * creations group committed together.
+ */
+void create_bench(void) {
+    struct fs_context ctx;
+
+    if (__get_root_context(&ctx, "create_bench"))
+        return;
+
+    __create_bench_batch(&ctx, 1);
+    __create_bench_batch(&ctx, 8);
+    __create_bench_batch(&ctx, CREATE_BENCH_FILES);
+
+    __put_root_context(&ctx);
+}
+
+#define FILE_TEST_BYTES 20000
+
+/**
+ * @brief Write a file through a file handle in odd-sized pieces (growing it
+ * from empty), then read it back in small pieces and in one go and check
+ * the content.
+ *
+ * @param ctx
+ * @param name
+ * @param buffer at least FILE_TEST_BYTES bytes.
+ */
+static bool __file_test(struct fs_context *ctx, char *name, uint8_t *buffer) {
+    struct file_creation_info info;
+    struct file_handle *file;
+    uint8_t piece[333];
+    bool ok = true;
+    int done;
+
+    clear_buffer((uint8_t *) &info, sizeof(info));
+    memcpy(info.path, name, strlen(name));
+    if (create_file(ctx, &info))
+        return false;
+
+    file = file_open(ctx, name);
+    if (!file)
+        return false;
+
+    for (int i = 0; i < FILE_TEST_BYTES; i++)
+        buffer[i] = (uint8_t) (i * 7 + (i >> 9));
+
+    for (done = 0; done < FILE_TEST_BYTES; done += 1000)
+        ok &= file_write(file, buffer + done, 1000) == 1000;
+    ok &= file->fnode.size == FILE_TEST_BYTES;
+
+    ok &= file_seek(file, 0, FILE_SEEK_SET) == 0;
+    for (done = 0; ok && done < FILE_TEST_BYTES; ) {
+        int n = file_read(file, piece, sizeof(piece));
+
+        if (n <= 0)
+            break;
+        for (int i = 0; i < n; i++)
+            ok &= piece[i] == buffer[done + i];
+        done += n;
+    }
+    ok &= done == FILE_TEST_BYTES;
+    ok &= file_read(file, piece, sizeof(piece)) == 0;
+
+    // A single read of many sectors.
+    ok &= file_seek(file, 0, FILE_SEEK_SET) == 0;
+    clear_buffer(buffer, FILE_TEST_BYTES);
+    ok &= file_read(file, buffer, FILE_TEST_BYTES) == FILE_TEST_BYTES;
+    for (int i = 0; i < FILE_TEST_BYTES; i++)
+        ok &= buffer[i] == (uint8_t) (i * 7 + (i >> 9));
+
+    file_close(file);
+
+    return ok;
+}
+
+#define FILE_TEST_APPENDS (2 * FNODE_MAX_EXTENTS)
+
+static inline uint8_t __append_pattern(int piece, int f, int i) {
+    return (uint8_t) (piece * 31 + f * 7 + i);
+}
+
+/**
+ * @brief Create two extent-mapped files and append to them a sector at a
+ * time, in turn, so that each append starts a new extent. They run out of
+ * extents and have to be converted to block mapping. Then read them back
+ * and check the content.
+ *
+ * @param ctx
+ * @param names
+ * @param buffer at least SECTOR_SIZE bytes.
+ */
+static bool __file_test_fragmented(struct fs_context *ctx, char *names[2], uint8_t *buffer) {
+    struct file_handle *files[2] = { NULL, NULL };
+    struct file_creation_info info;
+    bool ok = true;
+
+    for (int f = 0; f < 2; f++) {
+        for (int i = 0; i < SECTOR_SIZE; i++)
+            buffer[i] = __append_pattern(0, f, i);
+
+        clear_buffer((uint8_t *) &info, sizeof(info));
+        memcpy(info.path, names[f], strlen(names[f]));
+        info.file_content = buffer;
+        info.file_size = SECTOR_SIZE;
+        if (create_file(ctx, &info) || !(files[f] = file_open(ctx, names[f]))) {
+            ok = false;
+            goto done;
+        }
+        ok &= (files[f]->fnode.flags & FNODE_FLAG_EXTENTS) != 0;
+    }
+
+    for (int piece = 1; ok && piece <= FILE_TEST_APPENDS; piece++) {
+        for (int f = 0; f < 2; f++) {
+            for (int i = 0; i < SECTOR_SIZE; i++)
+                buffer[i] = __append_pattern(piece, f, i);
+
+            ok &= file_seek(files[f], 0, FILE_SEEK_END) == piece * SECTOR_SIZE;
+            ok &= file_write(files[f], buffer, SECTOR_SIZE) == SECTOR_SIZE;
+        }
+    }
+
+    for (int f = 0; ok && f < 2; f++) {
+        ok &= !(files[f]->fnode.flags & FNODE_FLAG_EXTENTS);
+        ok &= file_seek(files[f], 0, FILE_SEEK_SET) == 0;
+
+        for (int piece = 0; ok && piece <= FILE_TEST_APPENDS; piece++) {
+            ok &= file_read(files[f], buffer, SECTOR_SIZE) == SECTOR_SIZE;
+            for (int i = 0; i < SECTOR_SIZE; i++)
+                ok &= buffer[i] == __append_pattern(piece, f, i);
+        }
+    }
+
+done:
+    for (int f = 0; f < 2; f++) {
+        if (files[f])
+            file_close(files[f]);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Exercise the file handle API (file_open, file_read, file_write,
+ * file_seek, file_close).
+ */
+void file_test(void) {
+    char fragmented_name_a[] = "frag_a", fragmented_name_b[] = "frag_b";
+    char *fragmented_names[2] = { fragmented_name_a, fragmented_name_b };
+    struct mem_block *block;
+    char name[] = "file_test";
+    struct fs_context ctx;
+
+    if (__get_root_context(&ctx, "file_test"))
+        return;
+
+    block = zone_alloc(FILE_TEST_BYTES);
+    if (!block) {
+        print_string("file_test: allocation failed.\n");
+        __put_root_context(&ctx);
+        return;
+    }
+
+    if (__file_test(&ctx, name, (uint8_t *) block->addr))
+        print_string("file_test passed.\n");
+    else
+        print_string("file_test FAILED.\n");
+
+    if (__file_test_fragmented(&ctx, fragmented_names, (uint8_t *) block->addr))
+        print_string("file_test (fragmented) passed.\n");
+    else
+        print_string("file_test (fragmented) FAILED.\n");
+
+    delete_file(&ctx, name);
+    delete_file(&ctx, fragmented_names[0]);
+    delete_file(&ctx, fragmented_names[1]);
+    fs_sync();
+
+    __put_root_context(&ctx);
+    zone_free(block);
+}
+
+#define READ_BENCH_BYTES (1 << 20)
+#define READ_BENCH_CHUNK (8 << 10)
+#define READ_BENCH_PASSES 8
+
+/**
+ * @brief Drop a file's sectors from the buffer cache, so that the next read
+ * of it goes to the disk.
+ *
+ * @param fnode
+ */
+static void __uncache_file(const struct fnode *fnode) {
+    const int file_sectors = fnode_num_sectors(fnode);
+
+    for (int sector = 0; sector < file_sectors; ) {
+        fblock_index_t lba;
+        int run = fnode_map_run(fnode, sector, &lba);
+
+        if (!run)
+            return;
+
+        bcache_invalidate(lba, run);
+        sector += run;
+    }
+}
+
+/**
+ * @brief Read a file sequentially from a cold cache READ_BENCH_PASSES times,
+ * READ_BENCH_CHUNK bytes at a time, and report the throughput.
+ *
+ * @param file
+ * @param readahead whether to read ahead.
+ * @param buffer at least READ_BENCH_CHUNK bytes.
+ */
+static void __read_bench_mode(struct file_handle *file, bool readahead, uint8_t *buffer) {
+    int start_time, ticks = 0, error = 0;
+
+    file->readahead = readahead;
+
+    for (int pass = 0; pass < READ_BENCH_PASSES; pass++) {
+        __uncache_file(&file->fnode);
+        error |= file_seek(file, 0, FILE_SEEK_SET);
+
+        start_time = mark_time();
+        for (int done = 0; done < READ_BENCH_BYTES; done += READ_BENCH_CHUNK)
+            error |= file_read(file, buffer, READ_BENCH_CHUNK) != READ_BENCH_CHUNK;
+        ticks += mark_time() - start_time;
+    }
+
+    print_string(readahead ? "readahead: " : "no readahead: ");
+    print_int32((READ_BENCH_BYTES >> 20) * READ_BENCH_PASSES); print_string("MiB");
+    __report_rate((READ_BENCH_BYTES >> 10) * READ_BENCH_PASSES, ticks, 10, "MB/s");
+    print_string(error ? " (read errors)\n" : "\n");
+}
+
+/**
+ * @brief Compare sequential file read throughput with and without readahead.
+ */
+void read_bench(void) {
+    struct mem_block *block;
+    struct file_creation_info info;
+    struct file_handle *file = NULL;
+    char name[] = "read_bench";
+    bool created = false;
+    struct fs_context ctx;
+    int error = 0;
+
+    if (__get_root_context(&ctx, "read_bench"))
+        return;
+
+    block = zone_alloc(READ_BENCH_CHUNK);
+    if (!block) {
+        print_string("read_bench: allocation failed.\n");
+        goto cleanup;
+    }
+
+    clear_buffer((uint8_t *) &info, sizeof(info));
+    memcpy(info.path, name, strlen(name));
+    created = !create_file(&ctx, &info);
+    if (!created || !(file = file_open(&ctx, name))) {
+        print_string("read_bench: unable to create file.\n");
+        goto cleanup;
+    }
+
+    fill_byte_buffer((uint8_t *) block->addr, 0, READ_BENCH_CHUNK, 0xA5);
+    for (int done = 0; done < READ_BENCH_BYTES; done += READ_BENCH_CHUNK)
+        error |= file_write(file, (uint8_t *) block->addr, READ_BENCH_CHUNK) != READ_BENCH_CHUNK;
+    if (error) {
+        print_string("read_bench: unable to write file.\n");
+        goto cleanup;
+    }
+
+    __read_bench_mode(file, false, (uint8_t *) block->addr);
+    __read_bench_mode(file, true, (uint8_t *) block->addr);
+
+cleanup:
+    if (file)
+        file_close(file);
+    if (created) {
+        delete_file(&ctx, name);
+        fs_sync();
+    }
+    __put_root_context(&ctx);
+    if (block)
+        zone_free(block);
+}
+
+#define OBJECT_BENCH_LIVE 10000
+#define OBJECT_BENCH_SIZE 32
+#define OBJECT_BENCH_TICKS DEFAULT_TIMER_FREQUENCY_HZ
+
+/**
+ * @brief Measure object_alloc/object_free pairs per second while the heap
+ * holds OBJECT_BENCH_LIVE live objects. The oldest live object is freed
+ * each time, which is the worst case for an allocator that has to search
+ * for the object being freed.
+ */
+void object_bench(void) {
+    struct mem_block *block = zone_alloc(OBJECT_BENCH_LIVE * sizeof(uint8_t *));
+    int start_time, ticks, ops, live, error = 0;
+    uint8_t **objects;
+
+    if (!block) {
+        print_string("object_bench: unable to allocate object table.\n");
+        return;
+    }
+    objects = (uint8_t **) block->addr;
+
+    for (live = 0; live < OBJECT_BENCH_LIVE; live++) {
+        objects[live] = object_alloc(OBJECT_BENCH_SIZE);
+        if (!objects[live])
+            break;
+    }
+    if (live < OBJECT_BENCH_LIVE) {
+        print_string("object_bench: only "); print_int32(live);
+        print_string(" objects fit, measuring with those.\n");
+    }
+
+    start_time = mark_time();
+    for (ops = 0; live && mark_time() - start_time < OBJECT_BENCH_TICKS; ops++) {
+        const int i = ops % live;
+
+        object_free(objects[i]);
+        objects[i] = object_alloc(OBJECT_BENCH_SIZE);
+        error |= !objects[i];
+    }
+    ticks = mark_time() - start_time;
+
+    for (int i = 0; i < live; i++)
+        object_free(objects[i]);
+    zone_free(block);
+
+    print_int32(live); print_string(" live objects: ");
+    print_int32(ops); print_string(" alloc/free pairs");
+    __report_rate(ops, ticks, 0, "pairs/s");
+    print_string(error ? " (allocation failures)\n" : "\n");
+}
+
+#define ZONE_BENCH_BLOCKS 64
+#define ZONE_BENCH_TICKS (DEFAULT_TIMER_FREQUENCY_HZ / 2)
+
+/**
+ * @brief Measure zone_alloc/zone_free pairs per second for every order.
+ * Each round allocates up to ZONE_BENCH_BLOCKS blocks of the order and frees
+ * them newest first, so blocks borrowed from higher order zones are split
+ * and merged back along the way.
+ */
+void zone_bench(void) {
+    struct mem_block *blocks[ZONE_BENCH_BLOCKS];
+
+    for (int order = 0; order <= _highest_initialized_zone_order; order++) {
+        int start_time, ticks, ops = 0, held = 0;
+
+        start_time = mark_time();
+        while (mark_time() - start_time < ZONE_BENCH_TICKS) {
+            for (held = 0; held < ZONE_BENCH_BLOCKS; held++) {
+                blocks[held] = zone_alloc(ORDER_SIZE(order));
+                if (!blocks[held])
+                    break;
+            }
+
+            for (int i = held - 1; i >= 0; i--)
+                zone_free(blocks[i]);
+
+            if (!held)
+                break;
+            ops += held;
+        }
+        ticks = mark_time() - start_time;
+
+        print_string("order "); print_int32(order); print_string(": ");
+        print_int32(ops); print_string(" alloc/free pairs");
+        __report_rate(ops, ticks, 0, "pairs/s");
+        print_string(held ? "\n" : " (no free blocks)\n");
+    }
+}
+
 void system_test(void) {
     mem_test();
 
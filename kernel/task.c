@@ -4,6 +4,7 @@
 #include "print.h"
 
 #include <drivers/disk/disk.h>
+#include <fs/filesystem.h>
 
 // If we stop using `--only-section=.text` to prepare binaries to run, we should
 // figure out what the correct app start offset is.
@@ -41,6 +42,10 @@ tss64_t kernel_tss64 __attribute__((aligned(0x1000)));
 
 struct task_info dummy_task;
 
+// The user task currently running, if any. Its page faults are resolved by
+// handle_task_page_fault.
+static task_info *current_task = NULL;
+
 #ifdef CONFIG32
 static void configure_kernel_tss(void) {
     tss_t *kernel_tss_ = &kernel_tss;
@@ -104,56 +109,139 @@ void configure_user_tss(task_info* task) {
 
 
 /**
- * load_task_into_ram - Read a task's program from disk into main memory.
- * 
- * @task: pointer to task to be loaded.
- * 
- * TODO: Handle disk load errors.
+ * load_task_pages - Read pages of a task's program from disk into the
+ * physical pages reserved for them.
+ *
+ * The disk transfers straight into the task's memory (by DMA when enabled),
+ * without going through the buffer cache or a bounce buffer. Any part of
+ * the last page past the end of the program is left alone, except for the
+ * rest of the program's last sector, which is zeroed.
+ *
+ * @task: task whose program is to be loaded.
+ * @first_page: index of the first page (from the start of the program).
+ * @n_pages: number of pages to load.
  */
-void load_task_into_ram(task_info *task) {
-    int start_sector = task->start_disk_sector;
-    pa_t write_pos = task->start_phy_addr;
-    int app_size = task->mem_required;
-    int amt_left = app_size;
-    int amt_read = 0;
-
-    while(amt_left) {
-        int chunk_size = amt_left > 8192 ? 8192 : amt_left;
-        int sector_offset = amt_read / 512 /* size of a sector. */;
-
-        read_from_storage_disk(start_sector + sector_offset, chunk_size, (void *)write_pos);
-
-        amt_left -= chunk_size;
-        write_pos += chunk_size;
-        amt_read += chunk_size;
+int load_task_pages(task_info *task, uint32_t first_page, int n_pages) {
+    struct file_handle *file = file_open_fnode(task->fnode_id);
+    const uint32_t offset = first_page * PAGE_SIZE;
+    int amt = n_pages * PAGE_SIZE;
+    int error = 0;
+
+    if (!file) {
+        print_string("load_task_pages: unable to open program file.\n");
+        return -1;
+    }
+
+    if (offset < task->mem_required) {
+        if (amt > task->mem_required - offset)
+            amt = task->mem_required - offset;
+
+        if (file_read_direct(file, offset, (void *)(task->start_phy_addr + offset), amt) != amt) {
+            print_string("load_task_pages: failed to read program file.\n");
+            error = -1;
+        }
     }
+
+    file_close(file);
+
+    return error;
+}
+
+/**
+ * task_memory_size - Total amount of memory a task may touch: its program,
+ * then its heap, then its stack.
+ *
+ * @task: the task.
+ */
+static va_range_sz_t task_memory_size(task_info *task) {
+    return task->mem_required + task->heap_size + task->stack_size;
+}
+
+#ifdef CONFIG32
+static inline unsigned int read_cr3(void) {
+    unsigned int cr3;
+
+    __asm__ __volatile__("movl %%cr3, %0" : "=r" (cr3));
+    return cr3;
+}
+
+static inline void write_cr3(unsigned int cr3) {
+    __asm__ __volatile__("movl %0, %%cr3" : : "r" (cr3) : "memory");
+}
+#endif
+
+/**
+ * handle_task_page_fault - Bring in the page of the running task containing
+ * va, on the task's first access to it.
+ *
+ * Program pages are read from the program file, heap and stack pages start
+ * out zeroed. Either way, physical memory is only reserved for the pages a
+ * task actually touches.
+ *
+ * @va: the faulting virtual address.
+ * @return 0 if the page was mapped, -1 if va isn't part of the running task.
+ */
+int handle_task_page_fault(va_t va) {
+#ifdef CONFIG32
+    task_info *task = current_task;
+    va_range_sz_t offset;
+    unsigned int cr3;
+    pa_t pa;
+    int error = 0;
+
+    if (!task || va < task->start_virt_addr || va - task->start_virt_addr >= task_memory_size(task))
+        return -1;
+
+    offset = ((va - task->start_virt_addr) / PAGE_SIZE) * PAGE_SIZE;
+    pa = task->start_phy_addr + offset;
+
+    // The fault was taken with the task's page directory loaded. Fill in the
+    // page through the kernel's identity mapping (which is also what DMA
+    // transfers need), and only then map it into the task.
+    cr3 = read_cr3();
+    write_cr3((unsigned int)(pa_t)kernel_page_directory);
+
+    clear_buffer((uint8_t *)pa, PAGE_SIZE);
+    if (offset < task->mem_required)
+        error = load_task_pages(task, offset / PAGE_SIZE, 1);
+    if (!error)
+        error = reserve_and_map_user_page(task->start_virt_addr + offset, pa);
+
+    // Reloading cr3 also flushes the stale (not present) translation.
+    write_cr3(cr3);
+
+    if (error)
+        print_string("handle_task_page_fault: unable to bring in page.\n");
+
+    return error;
+#else
+    return -1;
+#endif
 }
 
 /**
  * prepare_for_task_switch - set up virtual memory and track memory usage.
- * 
+ *
+ * Nothing is mapped up front: the task's pages are brought in as it touches
+ * them (see handle_task_page_fault).
+ *
  * @task: task whose requirements are to be met.
  */
 int prepare_for_task_switch(task_info *task) {
-    va_range_sz_t requested_memory = task->mem_required + task->heap_size + task->stack_size;
     va_range_sz_t maybe_available_memory = (va_range_sz_t)get_available_memory();
 
-    // Verify that there is enough free memory to load the app in.
-    if (maybe_available_memory < requested_memory) {
+    // The task needs at least the page it starts on.
+    if (maybe_available_memory < PAGE_SIZE) {
         print_string("memory check failed: (requested, available) (");
-        print_int32(requested_memory); print_string(","); print_int32(maybe_available_memory); print_string(")\n");
+        print_int32(PAGE_SIZE); print_string(","); print_int32(maybe_available_memory); print_string(")\n");
         return -1;
     }
 
-    print_string("memory check passed: (requested, available) (");
-    print_int32(requested_memory); print_string(","); print_int32(maybe_available_memory); print_string(")\n");
-    
-    if (reserve_and_map_user_memory(task->start_virt_addr, task->start_phy_addr, requested_memory) != 0)
-        return -1;
+    print_string("memory check passed: (reserved on demand, available) (");
+    print_int32(task_memory_size(task)); print_string(","); print_int32(maybe_available_memory); print_string(")\n");
 
     configure_user_tss(task);
-
-    load_task_into_ram(task);
+    current_task = task;
 
     return 0;
 }
@@ -165,9 +253,11 @@ int prepare_for_task_switch(task_info *task) {
  * @task: the task which needs to be cleaned up.
  */
 int clean_up_after_task(task_info *task) {
-    va_range_sz_t requested_memory = task->mem_required + task->heap_size + task->stack_size;
+    current_task = NULL;
 
-    if (unreserve_and_unmap_user_memory(task->start_virt_addr, task->start_phy_addr, requested_memory))
+    // Pages the task never touched were never reserved or mapped, and
+    // unreserving and unmapping them is harmless.
+    if (unreserve_and_unmap_user_memory(task->start_virt_addr, task->start_phy_addr, task_memory_size(task)))
         return -1;
     
     return 0;
@@ -77,13 +77,16 @@ typedef struct task_info {
     va_range_sz_t heap_size;
     /* Max size of stack allocated to program. */
     va_range_sz_t stack_size;
-    /* Info on finding the program in disk.*/
-    unsigned long start_disk_sector;
+    /* fnode id of the program's file on disk. */
+    uint32_t fnode_id;
 
 }__attribute__((packed)) task_info;
 
 void setup_tss(void);
 
+int load_task_pages(struct task_info *task, uint32_t first_page, int n_pages);
+int handle_task_page_fault(va_t va);
+
 void exec_waiting_tasks(void);
 void exec_task(struct task_info *task);
 
@@ -3,7 +3,7 @@
 ;
 ; SillyFS layout:
 ;
-; | master_record | fnode_bitmap | sector_bitmap | fnode_table | data_blocks |
+; | master_record | fnode_bitmap | sector_bitmap | fnode_table | data_blocks | journal |
 ;
 ;---------------start of block/sector  0----------;
 ;                   |-------------|
@@ -18,5 +18,8 @@ dd 0x1 + 0x2000 + 0x2000                ; fnode_table_start_sector   (1 + 2^13 +
 dd 0x1 + 0x2000                         ; sector_bitmap_start_sector (1 + 2^13)
 dd 0x400000                             ; sector_bitmap_size         (2^22)
 dd 0x1 + 0x2000 + 0x2000 + 0x800000     ; data_blocks_start_sector   (1 + 2^13 + 2^13 + 2^32)
+dd 0                                    ; state (FS_STATE_DIRTY, so the bitmaps are built on first mount)
+dd 0x2000000 - 0x800                    ; journal_start_sector       (2^25 - 2^11, the last 1MiB of the disk)
+dd 0x800                                ; journal_num_sectors        (2^11)
 times 512 - ($ - $$) db 0
 ;-------------------------------------------------------------------------------------------------;